@@ -7,7 +7,13 @@
       'target_name': 'ogg',
       'include_dirs': [ "<!(node -e \"require('nan')\")" ],
       'sources': [
+        'src/arena.cc',
         'src/binding.cc',
+        'src/ogg_state.cc',
+        'src/page_index.cc',
+        'src/probe.cc',
+        'src/skeleton.cc',
+        'src/thread_pool.cc',
       ],
       'dependencies': [
         'deps/libogg/libogg.gyp:libogg',
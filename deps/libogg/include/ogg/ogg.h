@@ -47,6 +47,41 @@ typedef struct {
   long body_len;
 } ogg_page;
 
+/* every field of an ogg_page header, decoded in one pass by
+   ogg_page_describe() */
+
+typedef struct {
+  ogg_int64_t granulepos;
+  long pageno;
+  long header_len;
+  long body_len;
+  long lead;                /* body bytes ending a packet begun on an
+                               earlier page; 0 unless continued */
+  long tail;                /* body bytes of a packet ending on a later
+                               page; 0 if the last segment is short.
+                               Both are body_len when one packet spans
+                               the whole page */
+  int serialno;
+  int version;
+  int continued;            /* the flags are 0 or 1 */
+  int bos;
+  int eos;
+  int segments;
+  int packets;              /* as ogg_page_packets() */
+} ogg_page_desc;
+
+/* a page whose body is still in pieces, as handed to
+   ogg_stream_iovecin_ref(); see ogg_stream_pageout_iov() */
+
+typedef struct {
+  unsigned char *header;
+  long header_len;
+  ogg_iovec_t *body;        /* the body, as slices of the packet
+                               buffers it is made of */
+  int body_count;
+  long body_len;
+} ogg_page_iov;
+
 /* ogg_stream_state contains the current encode/decode state of a logical
    Ogg bitstream **********************************************************/
 
@@ -82,6 +117,23 @@ typedef struct {
                              layer) also knows about the gap */
   ogg_int64_t   granulepos;
 
+  ogg_uint32_t *crc_vals;   /* CRC of each segment in the lacing fifo,
+                               taken as packets are copied in, so that
+                               pages are checksummed without another pass
+                               over their data. Only kept for encode */
+
+  ogg_iovec_t *ref_vals;    /* the buffers of the packets submitted with
+                               ogg_stream_iovecin_ref(), which make up the
+                               body fifo instead of body_data */
+  long    ref_storage;
+  long    ref_fill;
+  long    ref_returned;     /* buffers entirely paged out */
+  long    ref_offset;       /* bytes of the next one paged out */
+  int     body_refs;        /* set while the body fifo is made of refs */
+
+  ogg_iovec_t *page_vals;   /* body slices of the last ogg_page_iov */
+  long    page_storage;
+
 } ogg_stream_state;
 
 /* ogg_packet is used to encapsulate the data and metadata belonging
@@ -111,6 +163,19 @@ typedef struct {
   int unsynced;
   int headerbytes;
   int bodybytes;
+
+  int ring;                /* set by ogg_sync_init_ring() */
+  int wrap;                /* end of the older data once fill has wrapped
+                              around to the start of a ring, else 0 */
+  int lastpage;            /* returned and wrap marks before the last */
+  int lastwrap;            /* page, for ogg_sync_pagereject() */
+  unsigned char *scratch;  /* a page straddling the wrap is copied here */
+  int scratch_storage;
+
+  int verify_interval;     /* see ogg_sync_set_verify(); -1 for none */
+  int verify_count;        /* pages since the last one verified */
+  long pages_verified;
+  long pages_skipped;
 } ogg_sync_state;
 
 /* Ogg BITSTREAM PRIMITIVES: bitstream ************************/
@@ -162,10 +227,16 @@ extern int      ogg_stream_pageout(ogg_stream_state *os, ogg_page *og);
 extern int      ogg_stream_pageout_fill(ogg_stream_state *os, ogg_page *og, int nfill);
 extern int      ogg_stream_flush(ogg_stream_state *os, ogg_page *og);
 extern int      ogg_stream_flush_fill(ogg_stream_state *os, ogg_page *og, int nfill);
+extern int      ogg_stream_iovecin_ref(ogg_stream_state *os, ogg_iovec_t *iov,
+                                   int count, long e_o_s, ogg_int64_t granulepos);
+extern int      ogg_stream_pageout_iov(ogg_stream_state *os, ogg_page_iov *og);
+extern int      ogg_stream_flush_iov(ogg_stream_state *os, ogg_page_iov *og);
 
 /* Ogg BITSTREAM PRIMITIVES: decoding **************************/
 
 extern int      ogg_sync_init(ogg_sync_state *oy);
+extern int      ogg_sync_init_ring(ogg_sync_state *oy);
+extern int      ogg_sync_set_verify(ogg_sync_state *oy, int interval);
 extern int      ogg_sync_clear(ogg_sync_state *oy);
 extern int      ogg_sync_reset(ogg_sync_state *oy);
 extern int      ogg_sync_destroy(ogg_sync_state *oy);
@@ -175,7 +246,12 @@ extern char    *ogg_sync_buffer(ogg_sync_state *oy, long size);
 extern int      ogg_sync_wrote(ogg_sync_state *oy, long bytes);
 extern long     ogg_sync_pageseek(ogg_sync_state *oy,ogg_page *og);
 extern int      ogg_sync_pageout(ogg_sync_state *oy, ogg_page *og);
+extern int      ogg_sync_pageout_unchecked(ogg_sync_state *oy, ogg_page *og);
+extern int      ogg_sync_pagereject(ogg_sync_state *oy, const ogg_page *og);
 extern int      ogg_stream_pagein(ogg_stream_state *os, ogg_page *og);
+extern int      ogg_stream_pagein_desc(ogg_stream_state *os, ogg_page *og,
+                                       const ogg_page_desc *desc, int check);
+extern int      ogg_stream_pagein_checked(ogg_stream_state *os, ogg_page *og);
 extern int      ogg_stream_packetout(ogg_stream_state *os,ogg_packet *op);
 extern int      ogg_stream_packetpeek(ogg_stream_state *os,ogg_packet *op);
 
@@ -187,9 +263,11 @@ extern int      ogg_stream_reset(ogg_stream_state *os);
 extern int      ogg_stream_reset_serialno(ogg_stream_state *os,int serialno);
 extern int      ogg_stream_destroy(ogg_stream_state *os);
 extern int      ogg_stream_check(ogg_stream_state *os);
+extern int      ogg_stream_reserve(ogg_stream_state *os,long bytes);
 extern int      ogg_stream_eos(ogg_stream_state *os);
 
 extern void     ogg_page_checksum_set(ogg_page *og);
+extern int      ogg_page_checksum_check(const ogg_page *og);
 
 extern int      ogg_page_version(const ogg_page *og);
 extern int      ogg_page_continued(const ogg_page *og);
@@ -199,9 +277,17 @@ extern ogg_int64_t  ogg_page_granulepos(const ogg_page *og);
 extern int      ogg_page_serialno(const ogg_page *og);
 extern long     ogg_page_pageno(const ogg_page *og);
 extern int      ogg_page_packets(const ogg_page *og);
+extern int      ogg_page_describe(const ogg_page *og, ogg_page_desc *desc);
 
 extern void     ogg_packet_clear(ogg_packet *op);
 
+/* Ogg BITSTREAM PRIMITIVES: memory ***************************/
+
+extern int      ogg_set_allocator(void *(*malloc_func)(size_t size),
+                                  void *(*calloc_func)(size_t count,size_t size),
+                                  void *(*realloc_func)(void *ptr,size_t size),
+                                  void (*free_func)(void *ptr));
+
 
 #ifdef __cplusplus
 }
@@ -18,11 +18,25 @@
 #define _OS_TYPES_H
 
 /* make it easy on the folks that want to compile the libs with a
-   different malloc than stdlib */
-#define _ogg_malloc  malloc
-#define _ogg_calloc  calloc
-#define _ogg_realloc realloc
-#define _ogg_free    free
+   different malloc than stdlib; the one used at runtime can be swapped
+   out as well, see ogg_set_allocator() */
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+extern void *(*_ogg_malloc_func)(size_t size);
+extern void *(*_ogg_calloc_func)(size_t count,size_t size);
+extern void *(*_ogg_realloc_func)(void *ptr,size_t size);
+extern void  (*_ogg_free_func)(void *ptr);
+#ifdef __cplusplus
+}
+#endif
+
+#define _ogg_malloc  _ogg_malloc_func
+#define _ogg_calloc  _ogg_calloc_func
+#define _ogg_realloc _ogg_realloc_func
+#define _ogg_free    _ogg_free_func
 
 #if defined(_WIN32) 
 
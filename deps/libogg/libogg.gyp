@@ -53,6 +53,8 @@
       'sources': [
         'src/framing.c',
         'src/bitwise.c',
+        'src/alloc.c',
+        'src/crctable.h',
       ],
       'defines': [
         'PIC',
@@ -0,0 +1,51 @@
+/********************************************************************
+ *                                                                  *
+ * THIS FILE IS PART OF THE Ogg CONTAINER SOURCE CODE.              *
+ * USE, DISTRIBUTION AND REPRODUCTION OF THIS LIBRARY SOURCE IS     *
+ * GOVERNED BY A BSD-STYLE SOURCE LICENSE INCLUDED WITH THIS SOURCE *
+ * IN 'COPYING'. PLEASE READ THESE TERMS BEFORE DISTRIBUTING.       *
+ *                                                                  *
+ * THE OggVorbis SOURCE CODE IS (C) COPYRIGHT 1994-2010             *
+ * by the Xiph.Org Foundation http://www.xiph.org/                  *
+ *                                                                  *
+ ********************************************************************
+
+  function: runtime selectable allocator
+
+ ********************************************************************/
+
+#include <stdlib.h>
+#include <ogg/ogg.h>
+
+/* what the _ogg_malloc() and friends of os_types.h call */
+void *(*_ogg_malloc_func)(size_t size)=malloc;
+void *(*_ogg_calloc_func)(size_t count,size_t size)=calloc;
+void *(*_ogg_realloc_func)(void *ptr,size_t size)=realloc;
+void  (*_ogg_free_func)(void *ptr)=free;
+
+/* Has libogg (and anything else built with its os_types.h) allocate
+   memory through the given functions rather than the C library's, or
+   through the C library's again when they're all NULL.  Whatever was
+   allocated before would get handed to the wrong free(), so this is
+   only to be called while there's none of it around, and before any
+   other thread gets to use libogg.  Returns 0, or -1 if only some of
+   the functions are NULL. */
+
+int ogg_set_allocator(void *(*malloc_func)(size_t size),
+                      void *(*calloc_func)(size_t count,size_t size),
+                      void *(*realloc_func)(void *ptr,size_t size),
+                      void (*free_func)(void *ptr)){
+  if(!malloc_func && !calloc_func && !realloc_func && !free_func){
+    malloc_func=malloc;
+    calloc_func=calloc;
+    realloc_func=realloc;
+    free_func=free;
+  }
+  if(!malloc_func || !calloc_func || !realloc_func || !free_func)
+    return -1;
+  _ogg_malloc_func=malloc_func;
+  _ogg_calloc_func=calloc_func;
+  _ogg_realloc_func=realloc_func;
+  _ogg_free_func=free_func;
+  return 0;
+}
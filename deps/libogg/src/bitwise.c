@@ -37,6 +37,27 @@ static const unsigned long mask[]=
 static const unsigned int mask8B[]=
 {0x00,0x80,0xc0,0xe0,0xf0,0xf8,0xfc,0xfe,0xff};
 
+/* Makes room for at least `needed` bytes.  The buffer grows by half
+   again as much as it has, so that writing a large packet reallocates a
+   logarithmic number of times rather than every BUFFER_INCREMENT
+   bytes. */
+static int _oggpack_grow(oggpack_buffer *b,long needed){
+  long storage;
+  void *ret;
+  if(needed>LONG_MAX-BUFFER_INCREMENT) return -1;
+  if(b->storage<LONG_MAX-b->storage/2)
+    storage=b->storage+b->storage/2;
+  else
+    storage=LONG_MAX;
+  if(storage<needed+BUFFER_INCREMENT)storage=needed+BUFFER_INCREMENT;
+  ret=_ogg_realloc(b->buffer,storage);
+  if(!ret) return -1;
+  b->buffer=ret;
+  b->storage=storage;
+  b->ptr=b->buffer+b->endbyte;
+  return 0;
+}
+
 void oggpack_writeinit(oggpack_buffer *b){
   memset(b,0,sizeof(*b));
   b->ptr=b->buffer=_ogg_malloc(BUFFER_INCREMENT);
@@ -83,14 +104,8 @@ void oggpackB_writetrunc(oggpack_buffer *b,long bits){
 void oggpack_write(oggpack_buffer *b,unsigned long value,int bits){
   if(bits<0 || bits>32) goto err;
   if(b->endbyte>=b->storage-4){
-    void *ret;
     if(!b->ptr)return;
-    if(b->storage>LONG_MAX-BUFFER_INCREMENT) goto err;
-    ret=_ogg_realloc(b->buffer,b->storage+BUFFER_INCREMENT);
-    if(!ret) goto err;
-    b->buffer=ret;
-    b->storage+=BUFFER_INCREMENT;
-    b->ptr=b->buffer+b->endbyte;
+    if(_oggpack_grow(b,b->storage)) goto err;
   }
 
   value&=mask[bits];
@@ -126,14 +141,8 @@ void oggpack_write(oggpack_buffer *b,unsigned long value,int bits){
 void oggpackB_write(oggpack_buffer *b,unsigned long value,int bits){
   if(bits<0 || bits>32) goto err;
   if(b->endbyte>=b->storage-4){
-    void *ret;
     if(!b->ptr)return;
-    if(b->storage>LONG_MAX-BUFFER_INCREMENT) goto err;
-    ret=_ogg_realloc(b->buffer,b->storage+BUFFER_INCREMENT);
-    if(!ret) goto err;
-    b->buffer=ret;
-    b->storage+=BUFFER_INCREMENT;
-    b->ptr=b->buffer+b->endbyte;
+    if(_oggpack_grow(b,b->storage)) goto err;
   }
 
   value=(value&mask[bits])<<(32-bits);
@@ -197,14 +206,9 @@ static void oggpack_writecopy_helper(oggpack_buffer *b,
   }else{
     /* aligned block copy */
     if(b->endbyte+bytes+1>=b->storage){
-      void *ret;
       if(!b->ptr) goto err;
-      if(b->endbyte+bytes+BUFFER_INCREMENT>b->storage) goto err;
-      b->storage=b->endbyte+bytes+BUFFER_INCREMENT;
-      ret=_ogg_realloc(b->buffer,b->storage);
-      if(!ret) goto err;
-      b->buffer=ret;
-      b->ptr=b->buffer+b->endbyte;
+      if(b->endbyte>LONG_MAX-bytes) goto err;
+      if(_oggpack_grow(b,b->endbyte+bytes)) goto err;
     }
 
     memmove(b->ptr,source,bytes);
@@ -21,6 +21,7 @@
  ********************************************************************/
 
 #include <stdlib.h>
+#include <limits.h>
 #include <string.h>
 #include <ogg/ogg.h>
 
@@ -95,10 +96,64 @@ int ogg_page_packets(const ogg_page *og){
   return(count);
 }
 
+/* Decodes the whole header of og, and sums up its segment table, in a
+   single pass, so that nothing downstream (ogg_stream_pagein_desc(),
+   seeking, indexing) has to go back to the header bytes.  Returns 0, or
+   -1 if the header and body lengths don't add up to a page */
+
+int ogg_page_describe(const ogg_page *og,ogg_page_desc *desc){
+  const unsigned char *header;
+  long bytes=0,first=0,end=0;
+  int i,n;
+
+  if(!og || !desc || og->header_len<27) return -1;
+  header=og->header;
+  n=header[26];
+  if(og->header_len!=27+n) return -1;
+
+  desc->version=header[4];
+  desc->continued=(header[5]&0x01)!=0;
+  desc->bos=(header[5]&0x02)!=0;
+  desc->eos=(header[5]&0x04)!=0;
+
+  {
+    /* in halves, so that -1 (and any other negative value) doesn't
+       get shifted out of range */
+    ogg_uint32_t lo=header[6]|(header[7]<<8)|(header[8]<<16)|
+      ((ogg_uint32_t)header[9]<<24);
+    ogg_uint32_t hi=header[10]|(header[11]<<8)|(header[12]<<16)|
+      ((ogg_uint32_t)header[13]<<24);
+    desc->granulepos=(ogg_int64_t)(ogg_int32_t)hi*4294967296+lo;
+  }
+  desc->serialno=(int)(header[14]|(header[15]<<8)|(header[16]<<16)|
+                       ((ogg_uint32_t)header[17]<<24));
+  desc->pageno=(ogg_int32_t)(header[18]|(header[19]<<8)|(header[20]<<16)|
+                             ((ogg_uint32_t)header[21]<<24));
+
+  desc->segments=n;
+  desc->packets=0;
+  for(i=0;i<n;i++){
+    int val=header[27+i];
+    bytes+=val;
+    if(val<255){
+      if(!desc->packets)first=bytes;
+      desc->packets++;
+      end=bytes;
+    }
+  }
+  if(bytes!=og->body_len) return -1;
+
+  desc->header_len=og->header_len;
+  desc->body_len=bytes;
+  desc->lead=desc->continued?(desc->packets?first:bytes):0;
+  desc->tail=bytes-end;
+  return 0;
+}
+
 
 #if 0
 /* helper to initialize lookup for direct-table CRC (illustrative; we
-   use the static init below) */
+   use the static init in crctable.h) */
 
 static ogg_uint32_t _ogg_crc_entry(unsigned long index){
   int           i;
@@ -117,71 +172,320 @@ static ogg_uint32_t _ogg_crc_entry(unsigned long index){
 }
 #endif
 
-static const ogg_uint32_t crc_lookup[256]={
-  0x00000000,0x04c11db7,0x09823b6e,0x0d4326d9,
-  0x130476dc,0x17c56b6b,0x1a864db2,0x1e475005,
-  0x2608edb8,0x22c9f00f,0x2f8ad6d6,0x2b4bcb61,
-  0x350c9b64,0x31cd86d3,0x3c8ea00a,0x384fbdbd,
-  0x4c11db70,0x48d0c6c7,0x4593e01e,0x4152fda9,
-  0x5f15adac,0x5bd4b01b,0x569796c2,0x52568b75,
-  0x6a1936c8,0x6ed82b7f,0x639b0da6,0x675a1011,
-  0x791d4014,0x7ddc5da3,0x709f7b7a,0x745e66cd,
-  0x9823b6e0,0x9ce2ab57,0x91a18d8e,0x95609039,
-  0x8b27c03c,0x8fe6dd8b,0x82a5fb52,0x8664e6e5,
-  0xbe2b5b58,0xbaea46ef,0xb7a96036,0xb3687d81,
-  0xad2f2d84,0xa9ee3033,0xa4ad16ea,0xa06c0b5d,
-  0xd4326d90,0xd0f37027,0xddb056fe,0xd9714b49,
-  0xc7361b4c,0xc3f706fb,0xceb42022,0xca753d95,
-  0xf23a8028,0xf6fb9d9f,0xfbb8bb46,0xff79a6f1,
-  0xe13ef6f4,0xe5ffeb43,0xe8bccd9a,0xec7dd02d,
-  0x34867077,0x30476dc0,0x3d044b19,0x39c556ae,
-  0x278206ab,0x23431b1c,0x2e003dc5,0x2ac12072,
-  0x128e9dcf,0x164f8078,0x1b0ca6a1,0x1fcdbb16,
-  0x018aeb13,0x054bf6a4,0x0808d07d,0x0cc9cdca,
-  0x7897ab07,0x7c56b6b0,0x71159069,0x75d48dde,
-  0x6b93dddb,0x6f52c06c,0x6211e6b5,0x66d0fb02,
-  0x5e9f46bf,0x5a5e5b08,0x571d7dd1,0x53dc6066,
-  0x4d9b3063,0x495a2dd4,0x44190b0d,0x40d816ba,
-  0xaca5c697,0xa864db20,0xa527fdf9,0xa1e6e04e,
-  0xbfa1b04b,0xbb60adfc,0xb6238b25,0xb2e29692,
-  0x8aad2b2f,0x8e6c3698,0x832f1041,0x87ee0df6,
-  0x99a95df3,0x9d684044,0x902b669d,0x94ea7b2a,
-  0xe0b41de7,0xe4750050,0xe9362689,0xedf73b3e,
-  0xf3b06b3b,0xf771768c,0xfa325055,0xfef34de2,
-  0xc6bcf05f,0xc27dede8,0xcf3ecb31,0xcbffd686,
-  0xd5b88683,0xd1799b34,0xdc3abded,0xd8fba05a,
-  0x690ce0ee,0x6dcdfd59,0x608edb80,0x644fc637,
-  0x7a089632,0x7ec98b85,0x738aad5c,0x774bb0eb,
-  0x4f040d56,0x4bc510e1,0x46863638,0x42472b8f,
-  0x5c007b8a,0x58c1663d,0x558240e4,0x51435d53,
-  0x251d3b9e,0x21dc2629,0x2c9f00f0,0x285e1d47,
-  0x36194d42,0x32d850f5,0x3f9b762c,0x3b5a6b9b,
-  0x0315d626,0x07d4cb91,0x0a97ed48,0x0e56f0ff,
-  0x1011a0fa,0x14d0bd4d,0x19939b94,0x1d528623,
-  0xf12f560e,0xf5ee4bb9,0xf8ad6d60,0xfc6c70d7,
-  0xe22b20d2,0xe6ea3d65,0xeba91bbc,0xef68060b,
-  0xd727bbb6,0xd3e6a601,0xdea580d8,0xda649d6f,
-  0xc423cd6a,0xc0e2d0dd,0xcda1f604,0xc960ebb3,
-  0xbd3e8d7e,0xb9ff90c9,0xb4bcb610,0xb07daba7,
-  0xae3afba2,0xaafbe615,0xa7b8c0cc,0xa379dd7b,
-  0x9b3660c6,0x9ff77d71,0x92b45ba8,0x9675461f,
-  0x8832161a,0x8cf30bad,0x81b02d74,0x857130c3,
-  0x5d8a9099,0x594b8d2e,0x5408abf7,0x50c9b640,
-  0x4e8ee645,0x4a4ffbf2,0x470cdd2b,0x43cdc09c,
-  0x7b827d21,0x7f436096,0x7200464f,0x76c15bf8,
-  0x68860bfd,0x6c47164a,0x61043093,0x65c52d24,
-  0x119b4be9,0x155a565e,0x18197087,0x1cd86d30,
-  0x029f3d35,0x065e2082,0x0b1d065b,0x0fdc1bec,
-  0x3793a651,0x3352bbe6,0x3e119d3f,0x3ad08088,
-  0x2497d08d,0x2056cd3a,0x2d15ebe3,0x29d4f654,
-  0xc5a92679,0xc1683bce,0xcc2b1d17,0xc8ea00a0,
-  0xd6ad50a5,0xd26c4d12,0xdf2f6bcb,0xdbee767c,
-  0xe3a1cbc1,0xe760d676,0xea23f0af,0xeee2ed18,
-  0xf0a5bd1d,0xf464a0aa,0xf9278673,0xfde69bc4,
-  0x89b8fd09,0x8d79e0be,0x803ac667,0x84fbdbd0,
-  0x9abc8bd5,0x9e7d9662,0x933eb0bb,0x97ffad0c,
-  0xafb010b1,0xab710d06,0xa6322bdf,0xa2f33668,
-  0xbcb4666d,0xb8757bda,0xb5365d03,0xb1f740b4};
+#include "crctable.h"
+
+/* CRC engine. The kernels advance crc_reg over the n bytes at src and,
+   when dst isn't NULL, copy them to dst on the way, so that data which
+   has to be moved anyway is only streamed through the cache once. The
+   fastest kernel the CPU supports is picked on first use: carry-less
+   multiplication (PCLMULQDQ on x86-64, PMULL on ARMv8) folding 64 bytes
+   at a time, or else slicing-by-8 table lookups. The kernel pointer
+   may get stored by several threads at once, but they all store the
+   same value. */
+
+static ogg_uint32_t _ogg_crc_bytewise(ogg_uint32_t crc,unsigned char *dst,
+                                      const unsigned char *src,long n){
+  if(dst)memcpy(dst,src,n);
+  while(n-->0)
+    crc=(crc<<8)^crc_lookup[0][((crc>>24)&0xff)^*src++];
+  return crc;
+}
+
+#define OGG_CRC_SLICE8(crc,p) \
+  do{ \
+    (crc)^=((ogg_uint32_t)(p)[0]<<24)|((ogg_uint32_t)(p)[1]<<16)| \
+      ((ogg_uint32_t)(p)[2]<<8)|(ogg_uint32_t)(p)[3]; \
+    (crc)=crc_lookup[7][((crc)>>24)&0xff]^crc_lookup[6][((crc)>>16)&0xff]^ \
+      crc_lookup[5][((crc)>>8)&0xff]^crc_lookup[4][(crc)&0xff]^ \
+      crc_lookup[3][(p)[4]]^crc_lookup[2][(p)[5]]^ \
+      crc_lookup[1][(p)[6]]^crc_lookup[0][(p)[7]]; \
+  }while(0)
+
+static ogg_uint32_t _ogg_crc_slice8(ogg_uint32_t crc,unsigned char *dst,
+                                    const unsigned char *src,long n){
+  if(dst){
+    while(n>=8){
+      memcpy(dst,src,8);
+      OGG_CRC_SLICE8(crc,src);
+      src+=8;
+      dst+=8;
+      n-=8;
+    }
+  }else{
+    while(n>=8){
+      OGG_CRC_SLICE8(crc,src);
+      src+=8;
+      n-=8;
+    }
+  }
+  return _ogg_crc_bytewise(crc,dst,src,n);
+}
+
+/* The folding kernels treat 16 bytes as a 128 bit polynomial, first
+   byte most significant, so that multiplying it by x^128 (mod the CRC
+   polynomial P) shifts it onto the next 16 bytes. The running value
+   only stays congruent to the data mod P; its CRC, i.e. value * x^32
+   mod P, is taken with the tables at the end. These are x^n mod P: */
+#define OGG_CRC_X128 0xe8a45605
+#define OGG_CRC_X192 0xc5b9cd4c
+#define OGG_CRC_X512 0xe6228b11
+#define OGG_CRC_X576 0x8833794c
+
+#if defined(__x86_64__) || defined(_M_X64)
+#  if defined(__GNUC__)
+#    define OGG_CRC_CLMUL 1
+#    define OGG_CRC_TARGET __attribute__((target("pclmul,ssse3")))
+#    include <cpuid.h>
+#    include <immintrin.h>
+#  elif defined(_MSC_VER)
+#    define OGG_CRC_CLMUL 1
+#    define OGG_CRC_TARGET
+#    include <intrin.h>
+#  endif
+#elif defined(__aarch64__) && defined(__GNUC__) && \
+  (defined(__linux__) || defined(__APPLE__))
+#  define OGG_CRC_PMULL 1
+#  if defined(__clang__)
+#    define OGG_CRC_TARGET __attribute__((target("crypto")))
+#  else
+#    define OGG_CRC_TARGET __attribute__((target("+crypto")))
+#  endif
+#  include <arm_neon.h>
+#  if defined(__linux__)
+#    include <sys/auxv.h>
+#    ifndef HWCAP_PMULL
+#      define HWCAP_PMULL (1 << 4)
+#    endif
+#  endif
+#endif
+
+#ifdef OGG_CRC_CLMUL
+/* x * x^128 mod P, k holding x^128 (low) and x^192 (high) mod P, or
+   the same for x^512 */
+#define OGG_CRC_FOLD(x,k) \
+  _mm_xor_si128(_mm_clmulepi64_si128((x),(k),0x11), \
+                _mm_clmulepi64_si128((x),(k),0x00))
+
+/* loads 16 bytes at src+off, copying them to dst+off if there's a dst */
+OGG_CRC_TARGET
+static __m128i _ogg_crc_load(unsigned char *dst,const unsigned char *src,
+                             long off,__m128i bswap){
+  __m128i v=_mm_loadu_si128((const __m128i *)(src+off));
+  if(dst)_mm_storeu_si128((__m128i *)(dst+off),v);
+  return _mm_shuffle_epi8(v,bswap);
+}
+
+OGG_CRC_TARGET
+static ogg_uint32_t _ogg_crc_clmul(ogg_uint32_t crc,unsigned char *dst,
+                                   const unsigned char *src,long n){
+  const __m128i bswap=_mm_set_epi8(0,1,2,3,4,5,6,7,8,9,10,11,12,13,14,15);
+  const __m128i k128=_mm_set_epi64x(OGG_CRC_X192,OGG_CRC_X128);
+  const __m128i k512=_mm_set_epi64x(OGG_CRC_X576,OGG_CRC_X512);
+  __m128i x0,x1,x2,x3;
+  unsigned char buf[16];
+
+  if(n<64)return _ogg_crc_slice8(crc,dst,src,n);
+
+  /* crc_reg * x^(8n) lines up with the first 4 bytes */
+  x0=_mm_xor_si128(_ogg_crc_load(dst,src,0,bswap),
+                   _mm_set_epi32((int)crc,0,0,0));
+  x1=_ogg_crc_load(dst,src,16,bswap);
+  x2=_ogg_crc_load(dst,src,32,bswap);
+  x3=_ogg_crc_load(dst,src,48,bswap);
+  src+=64;
+  if(dst)dst+=64;
+  n-=64;
+
+  while(n>=64){
+    x0=_mm_xor_si128(OGG_CRC_FOLD(x0,k512),_ogg_crc_load(dst,src,0,bswap));
+    x1=_mm_xor_si128(OGG_CRC_FOLD(x1,k512),_ogg_crc_load(dst,src,16,bswap));
+    x2=_mm_xor_si128(OGG_CRC_FOLD(x2,k512),_ogg_crc_load(dst,src,32,bswap));
+    x3=_mm_xor_si128(OGG_CRC_FOLD(x3,k512),_ogg_crc_load(dst,src,48,bswap));
+    src+=64;
+    if(dst)dst+=64;
+    n-=64;
+  }
+
+  x1=_mm_xor_si128(OGG_CRC_FOLD(x0,k128),x1);
+  x2=_mm_xor_si128(OGG_CRC_FOLD(x1,k128),x2);
+  x3=_mm_xor_si128(OGG_CRC_FOLD(x2,k128),x3);
+  while(n>=16){
+    x3=_mm_xor_si128(OGG_CRC_FOLD(x3,k128),_ogg_crc_load(dst,src,0,bswap));
+    src+=16;
+    if(dst)dst+=16;
+    n-=16;
+  }
+
+  _mm_storeu_si128((__m128i *)buf,_mm_shuffle_epi8(x3,bswap));
+  crc=_ogg_crc_slice8(0,NULL,buf,16);
+  return _ogg_crc_slice8(crc,dst,src,n);
+}
+
+static int _ogg_crc_have_clmul(void){
+#if defined(_MSC_VER)
+  int info[4];
+  __cpuid(info,1);
+  return (info[2]&(1<<1)) && (info[2]&(1<<9));
+#else
+  unsigned int a,b,c,d;
+  if(!__get_cpuid(1,&a,&b,&c,&d))return 0;
+  return (c&bit_PCLMUL) && (c&bit_SSSE3);
+#endif
+}
+#endif
+
+#ifdef OGG_CRC_PMULL
+/* loads 16 bytes at src+off, copying them to dst+off if there's a dst,
+   and reverses them */
+OGG_CRC_TARGET
+static uint8x16_t _ogg_crc_load(unsigned char *dst,const unsigned char *src,
+                                long off){
+  uint8x16_t v=vld1q_u8(src+off);
+  if(dst)vst1q_u8(dst+off,v);
+  v=vrev64q_u8(v);
+  return vextq_u8(v,v,8);
+}
+
+OGG_CRC_TARGET
+static uint8x16_t _ogg_crc_fold(uint8x16_t x,poly64x2_t k){
+  poly64x2_t xp=vreinterpretq_p64_u8(x);
+  return veorq_u8(vreinterpretq_u8_p128(vmull_high_p64(xp,k)),
+                  vreinterpretq_u8_p128(vmull_p64(vgetq_lane_p64(xp,0),
+                                                  vgetq_lane_p64(k,0))));
+}
+
+OGG_CRC_TARGET
+static ogg_uint32_t _ogg_crc_pmull(ogg_uint32_t crc,unsigned char *dst,
+                                   const unsigned char *src,long n){
+  const poly64x2_t k128=vcombine_p64(vcreate_p64(OGG_CRC_X128),
+                                     vcreate_p64(OGG_CRC_X192));
+  const poly64x2_t k512=vcombine_p64(vcreate_p64(OGG_CRC_X512),
+                                     vcreate_p64(OGG_CRC_X576));
+  uint8x16_t x0,x1,x2,x3;
+  unsigned char buf[16];
+
+  if(n<64)return _ogg_crc_slice8(crc,dst,src,n);
+
+  /* crc_reg * x^(8n) lines up with the first 4 bytes */
+  x0=veorq_u8(_ogg_crc_load(dst,src,0),
+              vreinterpretq_u8_u32(vsetq_lane_u32(crc,vdupq_n_u32(0),3)));
+  x1=_ogg_crc_load(dst,src,16);
+  x2=_ogg_crc_load(dst,src,32);
+  x3=_ogg_crc_load(dst,src,48);
+  src+=64;
+  if(dst)dst+=64;
+  n-=64;
+
+  while(n>=64){
+    x0=veorq_u8(_ogg_crc_fold(x0,k512),_ogg_crc_load(dst,src,0));
+    x1=veorq_u8(_ogg_crc_fold(x1,k512),_ogg_crc_load(dst,src,16));
+    x2=veorq_u8(_ogg_crc_fold(x2,k512),_ogg_crc_load(dst,src,32));
+    x3=veorq_u8(_ogg_crc_fold(x3,k512),_ogg_crc_load(dst,src,48));
+    src+=64;
+    if(dst)dst+=64;
+    n-=64;
+  }
+
+  x1=veorq_u8(_ogg_crc_fold(x0,k128),x1);
+  x2=veorq_u8(_ogg_crc_fold(x1,k128),x2);
+  x3=veorq_u8(_ogg_crc_fold(x2,k128),x3);
+  while(n>=16){
+    x3=veorq_u8(_ogg_crc_fold(x3,k128),_ogg_crc_load(dst,src,0));
+    src+=16;
+    if(dst)dst+=16;
+    n-=16;
+  }
+
+  x3=vrev64q_u8(x3);
+  vst1q_u8(buf,vextq_u8(x3,x3,8));
+  crc=_ogg_crc_slice8(0,NULL,buf,16);
+  return _ogg_crc_slice8(crc,dst,src,n);
+}
+
+static int _ogg_crc_have_pmull(void){
+#if defined(__APPLE__)
+  return 1;
+#else
+  return (getauxval(AT_HWCAP)&HWCAP_PMULL)!=0;
+#endif
+}
+#endif
+
+static ogg_uint32_t _ogg_crc_init(ogg_uint32_t crc,unsigned char *dst,
+                                  const unsigned char *src,long n);
+
+static ogg_uint32_t (*_ogg_crc_kernel)(ogg_uint32_t crc,unsigned char *dst,
+                                       const unsigned char *src,long n)=
+  _ogg_crc_init;
+
+static ogg_uint32_t _ogg_crc_init(ogg_uint32_t crc,unsigned char *dst,
+                                  const unsigned char *src,long n){
+  _ogg_crc_kernel=_ogg_crc_slice8;
+#ifdef OGG_CRC_CLMUL
+  if(_ogg_crc_have_clmul())_ogg_crc_kernel=_ogg_crc_clmul;
+#endif
+#ifdef OGG_CRC_PMULL
+  if(_ogg_crc_have_pmull())_ogg_crc_kernel=_ogg_crc_pmull;
+#endif
+  return _ogg_crc_kernel(crc,dst,src,n);
+}
+
+/* advances crc_reg over n bytes */
+static ogg_uint32_t _ogg_crc_update(ogg_uint32_t crc,const unsigned char *p,
+                                    long n){
+  return _ogg_crc_kernel(crc,NULL,p,n);
+}
+
+/* memcpy()s n bytes, advancing crc_reg over them */
+static ogg_uint32_t _ogg_crc_copy(ogg_uint32_t crc,unsigned char *dst,
+                                  const unsigned char *src,long n){
+  return _ogg_crc_kernel(crc,dst,src,n);
+}
+
+/* crc_reg advanced over some bytes, followed by n bytes whose CRC (from a
+   zero register) is crc2: multiply crc_reg by x^(8n) mod P, and add */
+static ogg_uint32_t _ogg_crc_combine(ogg_uint32_t crc,ogg_uint32_t crc2,
+                                     int n){
+  ogg_uint32_t shift=crc_shift[n];
+  ogg_uint32_t ret=0;
+  int i;
+  for(i=31;i>=0;i--){
+    ret=(ret<<1)^(ret&0x80000000UL?0x04c11db7:0);
+    if((crc>>i)&1)ret^=shift;
+  }
+  return ret^crc2;
+}
+
+/* the CRC of a page header, with zeros standing in for its checksum
+   field */
+static ogg_uint32_t _ogg_page_header_crc(const unsigned char *header,
+                                         long header_len){
+  static const unsigned char zeros[4]={0,0,0,0};
+  ogg_uint32_t crc_reg;
+  crc_reg=_ogg_crc_update(0,header,22);
+  crc_reg=_ogg_crc_update(crc_reg,zeros,4);
+  return _ogg_crc_update(crc_reg,header+26,header_len-26);
+}
+
+/* the CRC of a whole page, same */
+static ogg_uint32_t _ogg_page_crc(const ogg_page *og){
+  ogg_uint32_t crc_reg=_ogg_page_header_crc(og->header,og->header_len);
+  return _ogg_crc_update(crc_reg,og->body,og->body_len);
+}
+
+/* the checksum stored in a page header */
+static ogg_uint32_t _ogg_page_checksum(const unsigned char *header){
+  return (ogg_uint32_t)header[22]|((ogg_uint32_t)header[23]<<8)|
+    ((ogg_uint32_t)header[24]<<16)|((ogg_uint32_t)header[25]<<24);
+}
+
+static void _ogg_page_checksum_store(unsigned char *header,
+                                     ogg_uint32_t crc_reg){
+  header[22]=(unsigned char)(crc_reg&0xff);
+  header[23]=(unsigned char)((crc_reg>>8)&0xff);
+  header[24]=(unsigned char)((crc_reg>>16)&0xff);
+  header[25]=(unsigned char)((crc_reg>>24)&0xff);
+}
 
 /* init the encode/decode logical stream state */
 
@@ -194,8 +498,10 @@ int ogg_stream_init(ogg_stream_state *os,int serialno){
     os->body_data=_ogg_malloc(os->body_storage*sizeof(*os->body_data));
     os->lacing_vals=_ogg_malloc(os->lacing_storage*sizeof(*os->lacing_vals));
     os->granule_vals=_ogg_malloc(os->lacing_storage*sizeof(*os->granule_vals));
+    os->crc_vals=_ogg_malloc(os->lacing_storage*sizeof(*os->crc_vals));
 
-    if(!os->body_data || !os->lacing_vals || !os->granule_vals){
+    if(!os->body_data || !os->lacing_vals || !os->granule_vals ||
+       !os->crc_vals){
       ogg_stream_clear(os);
       return -1;
     }
@@ -219,6 +525,9 @@ int ogg_stream_clear(ogg_stream_state *os){
     if(os->body_data)_ogg_free(os->body_data);
     if(os->lacing_vals)_ogg_free(os->lacing_vals);
     if(os->granule_vals)_ogg_free(os->granule_vals);
+    if(os->crc_vals)_ogg_free(os->crc_vals);
+    if(os->ref_vals)_ogg_free(os->ref_vals);
+    if(os->page_vals)_ogg_free(os->page_vals);
 
     memset(os,0,sizeof(*os));
   }
@@ -236,109 +545,229 @@ int ogg_stream_destroy(ogg_stream_state *os){
 /* Helpers for ogg_stream_encode; this keeps the structure and
    what's happening fairly clear */
 
-static int _os_body_expand(ogg_stream_state *os,int needed){
+/* The body data and segments that have been returned (as packets on
+   decode, in pages on encode) stay at the start of their fifos until
+   they outweigh what's still buffered, or until dropping them saves
+   growing the fifo.  Either way the bytes moved are at most the ones
+   returned since the last time, so trimming costs constant time per
+   byte, however much is buffered. */
+
+static void _os_body_trim(ogg_stream_state *os,long needed){
+  long br=os->body_returned;
+  if(br && (br>=os->body_fill-br || os->body_storage<=os->body_fill+needed)){
+    os->body_fill-=br;
+    if(os->body_fill)
+      memmove(os->body_data,os->body_data+br,os->body_fill);
+    os->body_returned=0;
+  }
+}
+
+static void _os_lacing_trim(ogg_stream_state *os,long needed){
+  long lr=os->lacing_returned;
+  if(lr && (lr>=os->lacing_fill-lr ||
+            os->lacing_storage<=os->lacing_fill+needed)){
+    if(os->lacing_fill-lr){
+      memmove(os->lacing_vals,os->lacing_vals+lr,
+              (os->lacing_fill-lr)*sizeof(*os->lacing_vals));
+      memmove(os->granule_vals,os->granule_vals+lr,
+              (os->lacing_fill-lr)*sizeof(*os->granule_vals));
+      memmove(os->crc_vals,os->crc_vals+lr,
+              (os->lacing_fill-lr)*sizeof(*os->crc_vals));
+    }
+    os->lacing_fill-=lr;
+    os->lacing_packet-=lr;
+    os->lacing_returned=0;
+  }
+}
+
+/* New size for a buffer of `storage` elements that has to hold more
+   than `needed`: half again as large, or `slack` more than needed,
+   whichever is more, so that a run of growing demands (a large packet
+   coming in a page at a time, say) reallocates a logarithmic number of
+   times.  0 if that's more than `max`. */
+static long _ogg_grow(long storage,long needed,long slack,long max){
+  long grown;
+  if(needed>=max)return 0;
+  grown=storage<max-storage/2?storage+storage/2:max;
+  if(grown<=needed)grown=needed<max-slack?needed+slack:max;
+  return grown;
+}
+
+static int _os_body_expand(ogg_stream_state *os,long needed){
+  _os_body_trim(os,needed);
   if(os->body_storage<=os->body_fill+needed){
+    long body_storage;
     void *ret;
-    ret=_ogg_realloc(os->body_data,(os->body_storage+needed+1024)*
-                     sizeof(*os->body_data));
+    if(needed>LONG_MAX-os->body_fill ||
+       !(body_storage=_ogg_grow(os->body_storage,os->body_fill+needed,
+                                1024,LONG_MAX))){
+      ogg_stream_clear(os);
+      return -1;
+    }
+    ret=_ogg_realloc(os->body_data,body_storage*sizeof(*os->body_data));
     if(!ret){
       ogg_stream_clear(os);
       return -1;
     }
-    os->body_storage+=(needed+1024);
+    os->body_storage=body_storage;
     os->body_data=ret;
   }
   return 0;
 }
 
-static int _os_lacing_expand(ogg_stream_state *os,int needed){
+static int _os_lacing_expand(ogg_stream_state *os,long needed){
+  _os_lacing_trim(os,needed);
   if(os->lacing_storage<=os->lacing_fill+needed){
+    long lacing_storage;
     void *ret;
-    ret=_ogg_realloc(os->lacing_vals,(os->lacing_storage+needed+32)*
-                     sizeof(*os->lacing_vals));
+    if(needed>LONG_MAX-os->lacing_fill ||
+       !(lacing_storage=_ogg_grow(os->lacing_storage,os->lacing_fill+needed,
+                                  32,LONG_MAX/sizeof(*os->granule_vals)))){
+      ogg_stream_clear(os);
+      return -1;
+    }
+    ret=_ogg_realloc(os->lacing_vals,lacing_storage*sizeof(*os->lacing_vals));
     if(!ret){
       ogg_stream_clear(os);
       return -1;
     }
     os->lacing_vals=ret;
-    ret=_ogg_realloc(os->granule_vals,(os->lacing_storage+needed+32)*
-                     sizeof(*os->granule_vals));
+    ret=_ogg_realloc(os->granule_vals,lacing_storage*sizeof(*os->granule_vals));
     if(!ret){
       ogg_stream_clear(os);
       return -1;
     }
     os->granule_vals=ret;
-    os->lacing_storage+=(needed+32);
+    ret=_ogg_realloc(os->crc_vals,lacing_storage*sizeof(*os->crc_vals));
+    if(!ret){
+      ogg_stream_clear(os);
+      return -1;
+    }
+    os->crc_vals=ret;
+    os->lacing_storage=lacing_storage;
   }
   return 0;
 }
 
-/* checksum the page */
-/* Direct table CRC; note that this will be faster in the future if we
-   perform the checksum simultaneously with other copies */
+/* The by-reference counterpart of _os_body_expand(): the body fifo only
+   counts bytes then, and it's the buffers making them up that need
+   room */
 
-void ogg_page_checksum_set(ogg_page *og){
-  if(og){
-    ogg_uint32_t crc_reg=0;
-    int i;
-
-    /* safety; needed for API behavior, but not framing code */
-    og->header[22]=0;
-    og->header[23]=0;
-    og->header[24]=0;
-    og->header[25]=0;
+static int _os_ref_expand(ogg_stream_state *os,long needed){
+  long rr=os->ref_returned;
 
-    for(i=0;i<og->header_len;i++)
-      crc_reg=(crc_reg<<8)^crc_lookup[((crc_reg >> 24)&0xff)^og->header[i]];
-    for(i=0;i<og->body_len;i++)
-      crc_reg=(crc_reg<<8)^crc_lookup[((crc_reg >> 24)&0xff)^og->body[i]];
+  os->body_fill-=os->body_returned;
+  os->body_returned=0;
 
-    og->header[22]=(unsigned char)(crc_reg&0xff);
-    og->header[23]=(unsigned char)((crc_reg>>8)&0xff);
-    og->header[24]=(unsigned char)((crc_reg>>16)&0xff);
-    og->header[25]=(unsigned char)((crc_reg>>24)&0xff);
+  if(rr && (rr>=os->ref_fill-rr || os->ref_storage<=os->ref_fill+needed)){
+    if(os->ref_fill-rr)
+      memmove(os->ref_vals,os->ref_vals+rr,
+              (os->ref_fill-rr)*sizeof(*os->ref_vals));
+    os->ref_fill-=rr;
+    os->ref_returned=0;
+  }
+  if(os->ref_storage<=os->ref_fill+needed){
+    long ref_storage;
+    void *ret;
+    if(!(ref_storage=_ogg_grow(os->ref_storage,os->ref_fill+needed,
+                               32,LONG_MAX/sizeof(*os->ref_vals)))){
+      ogg_stream_clear(os);
+      return -1;
+    }
+    ret=_ogg_realloc(os->ref_vals,ref_storage*sizeof(*os->ref_vals));
+    if(!ret){
+      ogg_stream_clear(os);
+      return -1;
+    }
+    os->ref_vals=ret;
+    os->ref_storage=ref_storage;
   }
+  return 0;
 }
 
-/* submit data to the internal buffer of the framing engine */
-int ogg_stream_iovecin(ogg_stream_state *os, ogg_iovec_t *iov, int count,
-                       long e_o_s, ogg_int64_t granulepos){
+static int _os_page_expand(ogg_stream_state *os,long needed){
+  if(os->page_storage<needed){
+    void *ret=_ogg_realloc(os->page_vals,needed*sizeof(*os->page_vals));
+    if(!ret){
+      ogg_stream_clear(os);
+      return -1;
+    }
+    os->page_vals=ret;
+    os->page_storage=needed;
+  }
+  return 0;
+}
 
-  int bytes = 0, lacing_vals, i;
+/* Capacity hint: makes room for `bytes` more bytes of packet data, and
+   the segments to lace them, ahead of time.  Handy when the largest
+   packet a codec produces is known, so that big packets don't have to
+   work their way up to it.  Returns 0, or -1 if the stream is unusable
+   (or out of memory, which makes it so). */
 
+int ogg_stream_reserve(ogg_stream_state *os,long bytes){
   if(ogg_stream_check(os)) return -1;
-  if(!iov) return 0;
+  if(bytes<0) return -1;
+  if(_os_body_expand(os,bytes) || _os_lacing_expand(os,bytes/255+1))
+    return -1;
+  return 0;
+}
 
-  for (i = 0; i < count; ++i) bytes += (int)iov[i].iov_len;
-  lacing_vals=bytes/255+1;
+/* checksum the page */
+/* the framing code checksums the pages it builds or accepts while
+   copying their data, see ogg_stream_iovecin() and
+   ogg_stream_pagein_checked(); this is for everything else */
 
-  if(os->body_returned){
-    /* advance packet data according to the body_returned pointer. We
-       had to keep it around to return a pointer into the buffer last
-       call */
+void ogg_page_checksum_set(ogg_page *og){
+  if(og)
+    _ogg_page_checksum_store(og->header,_ogg_page_crc(og));
+}
 
-    os->body_fill-=os->body_returned;
-    if(os->body_fill)
-      memmove(os->body_data,os->body_data+os->body_returned,
-              os->body_fill);
-    os->body_returned=0;
-  }
+/* returns 0 if the checksum stored in the page header matches the page,
+   -1 if it doesn't */
 
-  /* make sure we have the buffer storage */
-  if(_os_body_expand(os,bytes) || _os_lacing_expand(os,lacing_vals))
-    return -1;
+int ogg_page_checksum_check(const ogg_page *og){
+  if(!og || og->header_len<27) return -1;
+  if(_ogg_page_crc(og)!=_ogg_page_checksum(og->header)) return -1;
+  return 0;
+}
 
-  /* Copy in the submitted packet.  Yes, the copy is a waste; this is
-     the liability of overly clean abstraction for the time being.  It
-     will actually be fairly easy to eliminate the extra copy in the
-     future */
+/* Takes the CRC of each 255 byte segment of a packet, copying it to dst
+   on the way unless that's NULL, so that ogg_stream_flush_i() doesn't
+   have to read the data again */
+
+static void _os_segment_crcs(ogg_stream_state *os,ogg_iovec_t *iov,
+                             int count,unsigned char *dst){
+  ogg_uint32_t *crc_vals=os->crc_vals+os->lacing_fill;
+  ogg_uint32_t crc_reg=0;
+  long left=255;
+  int i;
 
   for (i = 0; i < count; ++i) {
-    memcpy(os->body_data+os->body_fill, iov[i].iov_base, iov[i].iov_len);
-    os->body_fill += (int)iov[i].iov_len;
+    const unsigned char *src=iov[i].iov_base;
+    long n=(long)iov[i].iov_len;
+
+    while(n>0){
+      long len=n<left?n:left;
+      crc_reg=_ogg_crc_copy(crc_reg,dst,src,len);
+      if(dst)dst+=len;
+      src+=len;
+      n-=len;
+      left-=len;
+      if(left==0){
+        *crc_vals++=crc_reg;
+        crc_reg=0;
+        left=255;
+      }
+    }
   }
+  /* the last segment is short, possibly empty */
+  *crc_vals=crc_reg;
+}
 
-  /* Store lacing vals for this packet */
+/* Store lacing vals for a packet of `bytes` bytes */
+static void _os_lacing_store(ogg_stream_state *os,int bytes,int lacing_vals,
+                             long e_o_s,ogg_int64_t granulepos){
+  int i;
   for(i=0;i<lacing_vals-1;i++){
     os->lacing_vals[os->lacing_fill+i]=255;
     os->granule_vals[os->lacing_fill+i]=os->granulepos;
@@ -350,12 +779,87 @@ int ogg_stream_iovecin(ogg_stream_state *os, ogg_iovec_t *iov, int count,
   os->lacing_vals[os->lacing_fill]|= 0x100;
 
   os->lacing_fill+=lacing_vals;
+  /* everything buffered on encode is whole packets */
+  os->lacing_packet=os->lacing_fill;
 
   /* for the sake of completeness */
   os->packetno++;
 
   if(e_o_s)os->e_o_s=1;
+}
+
+/* submit data to the internal buffer of the framing engine */
+int ogg_stream_iovecin(ogg_stream_state *os, ogg_iovec_t *iov, int count,
+                       long e_o_s, ogg_int64_t granulepos){
+
+  int bytes = 0, lacing_vals, i;
+
+  if(ogg_stream_check(os)) return -1;
+  if(!iov) return 0;
+
+  /* can't mix with the references in the body fifo */
+  if(os->body_refs){
+    if(os->body_fill>os->body_returned) return -1;
+    os->body_fill=os->body_returned=0;
+    os->body_refs=0;
+  }
+
+  for (i = 0; i < count; ++i) bytes += (int)iov[i].iov_len;
+  lacing_vals=bytes/255+1;
+
+  /* make sure we have the buffer storage; this also drops the data
+     returned in pages, if it's time to */
+  if(_os_body_expand(os,bytes) || _os_lacing_expand(os,lacing_vals))
+    return -1;
+
+  /* Copy in the submitted packet.  ogg_stream_iovecin_ref() does
+     without the copy, for callers that can keep their buffers around
+     until the pages are out */
+
+  _os_segment_crcs(os,iov,count,os->body_data+os->body_fill);
+  os->body_fill+=bytes;
+
+  _os_lacing_store(os,bytes,lacing_vals,e_o_s,granulepos);
+  return(0);
+}
+
+/* Same as ogg_stream_iovecin(), except that the packet data isn't
+   copied: the stream keeps pointers into the caller's buffers, which
+   have to stay allocated, and unchanged, until the pages holding their
+   bytes have been output.  Those pages come out of
+   ogg_stream_pageout_iov()/ogg_stream_flush_iov() as slices of the
+   same buffers; ogg_stream_pageout() and friends still work, but gather
+   each body into body_data to do so.  A stream only switches between
+   the two ways of submitting packets when everything buffered has been
+   paged out, -1 is returned otherwise. */
+
+int ogg_stream_iovecin_ref(ogg_stream_state *os, ogg_iovec_t *iov, int count,
+                           long e_o_s, ogg_int64_t granulepos){
+
+  int bytes = 0, lacing_vals, i;
+
+  if(ogg_stream_check(os)) return -1;
+  if(!iov) return 0;
+
+  if(!os->body_refs){
+    if(os->body_fill>os->body_returned) return -1;
+    os->body_fill=os->body_returned=0;
+    os->ref_fill=os->ref_returned=os->ref_offset=0;
+    os->body_refs=1;
+  }
+
+  for (i = 0; i < count; ++i) bytes += (int)iov[i].iov_len;
+  lacing_vals=bytes/255+1;
+
+  if(_os_ref_expand(os,count) || _os_lacing_expand(os,lacing_vals))
+    return -1;
+
+  _os_segment_crcs(os,iov,count,NULL);
+  for (i = 0; i < count; ++i)
+    if(iov[i].iov_len)os->ref_vals[os->ref_fill++]=iov[i];
+  os->body_fill+=bytes;
 
+  _os_lacing_store(os,bytes,lacing_vals,e_o_s,granulepos);
   return(0);
 }
 
@@ -372,7 +876,11 @@ int ogg_stream_packetin(ogg_stream_state *os,ogg_packet *op){
 static int ogg_stream_flush_i(ogg_stream_state *os,ogg_page *og, int force, int nfill){
   int i;
   int vals=0;
-  int maxvals=(os->lacing_fill>255?255:os->lacing_fill);
+  /* the segments not in a page yet */
+  int *lacing=os->lacing_vals+os->lacing_returned;
+  ogg_int64_t *granules=os->granule_vals+os->lacing_returned;
+  long pending=os->lacing_fill-os->lacing_returned;
+  int maxvals=(pending>255?255:pending);
   int bytes=0;
   long acc=0;
   ogg_int64_t granule_pos=-1;
@@ -388,7 +896,7 @@ static int ogg_stream_flush_i(ogg_stream_state *os,ogg_page *og, int force, int
   if(os->b_o_s==0){  /* 'initial header page' case */
     granule_pos=0;
     for(vals=0;vals<maxvals;vals++){
-      if((os->lacing_vals[vals]&0x0ff)<255){
+      if((lacing[vals]&0x0ff)<255){
         vals++;
         break;
       }
@@ -411,9 +919,9 @@ static int ogg_stream_flush_i(ogg_stream_state *os,ogg_page *og, int force, int
         force=1;
         break;
       }
-      acc+=os->lacing_vals[vals]&0x0ff;
-      if((os->lacing_vals[vals]&0xff)<255){
-        granule_pos=os->granule_vals[vals];
+      acc+=lacing[vals]&0x0ff;
+      if((lacing[vals]&0xff)<255){
+        granule_pos=granules[vals];
         packet_just_done=++packets_done;
       }else
         packet_just_done=0;
@@ -431,11 +939,11 @@ static int ogg_stream_flush_i(ogg_stream_state *os,ogg_page *og, int force, int
 
   /* continued packet flag? */
   os->header[5]=0x00;
-  if((os->lacing_vals[0]&0x100)==0)os->header[5]|=0x01;
+  if((lacing[0]&0x100)==0)os->header[5]|=0x01;
   /* first page flag? */
   if(os->b_o_s==0)os->header[5]|=0x02;
   /* last page flag? */
-  if(os->e_o_s && os->lacing_fill==vals)os->header[5]|=0x04;
+  if(os->e_o_s && pending==vals)os->header[5]|=0x04;
   os->b_o_s=1;
 
   /* 64 bits of PCM position */
@@ -477,29 +985,120 @@ static int ogg_stream_flush_i(ogg_stream_state *os,ogg_page *og, int force, int
   /* segment table */
   os->header[26]=(unsigned char)(vals&0xff);
   for(i=0;i<vals;i++)
-    bytes+=os->header[i+27]=(unsigned char)(os->lacing_vals[i]&0xff);
+    bytes+=os->header[i+27]=(unsigned char)(lacing[i]&0xff);
 
   /* set pointers in the ogg_page struct */
   og->header=os->header;
   og->header_len=os->header_fill=vals+27;
-  og->body=os->body_data+os->body_returned;
+  og->body=os->body_refs?NULL:os->body_data+os->body_returned;
   og->body_len=bytes;
 
-  /* advance the lacing data and set the body_returned pointer */
+  /* calculate the checksum from that of the header and the ones taken
+     of each segment when it was copied in */
 
-  os->lacing_fill-=vals;
-  memmove(os->lacing_vals,os->lacing_vals+vals,os->lacing_fill*sizeof(*os->lacing_vals));
-  memmove(os->granule_vals,os->granule_vals+vals,os->lacing_fill*sizeof(*os->granule_vals));
-  os->body_returned+=bytes;
+  {
+    ogg_uint32_t *crcs=os->crc_vals+os->lacing_returned;
+    ogg_uint32_t crc_reg=_ogg_crc_update(0,os->header,og->header_len);
+    for(i=0;i<vals;i++)
+      crc_reg=_ogg_crc_combine(crc_reg,crcs[i],lacing[i]&0xff);
+    _ogg_page_checksum_store(os->header,crc_reg);
+  }
 
-  /* calculate the checksum */
+  /* advance the lacing data and set the body_returned pointer; the
+     fifos get trimmed lazily, see _os_body_trim() */
 
-  ogg_page_checksum_set(og);
+  os->lacing_returned+=vals;
+  os->body_returned+=bytes;
 
   /* done */
   return(1);
 }
 
+/* Slices the next `bytes` bytes of a by-reference body fifo out of the
+   buffers making it up, into page_vals.  Returns the number of slices,
+   or -1 if out of memory */
+
+static int _os_ref_slice(ogg_stream_state *os,long bytes){
+  long i=os->ref_returned;
+  long off=os->ref_offset;
+  int n=0;
+
+  /* no more than one slice per buffer */
+  if(_os_page_expand(os,os->ref_fill-os->ref_returned)) return -1;
+
+  while(bytes>0){
+    ogg_iovec_t *ref=os->ref_vals+i;
+    long len=(long)ref->iov_len-off;
+    if(len>bytes)len=bytes;
+    os->page_vals[n].iov_base=(unsigned char *)ref->iov_base+off;
+    os->page_vals[n].iov_len=len;
+    n++;
+    bytes-=len;
+    off+=len;
+    if(off==(long)ref->iov_len){
+      i++;
+      off=0;
+    }
+  }
+
+  os->ref_returned=i;
+  os->ref_offset=off;
+  return n;
+}
+
+/* Finishes a page just built by ogg_stream_flush_i() for the ogg_page
+   interface: a by-reference body gets gathered into body_data, which
+   holds nothing else in that mode */
+
+static int _os_page_gather(ogg_stream_state *os,ogg_page *og,int ret){
+  long at=0;
+  int i,n;
+
+  if(!ret || !os->body_refs) return ret;
+
+  if((n=_os_ref_slice(os,og->body_len))<0) return 0;
+  if(os->body_storage<og->body_len){
+    void *data=_ogg_realloc(os->body_data,og->body_len);
+    if(!data){
+      ogg_stream_clear(os);
+      return 0;
+    }
+    os->body_data=data;
+    os->body_storage=og->body_len;
+  }
+  for(i=0;i<n;i++){
+    memcpy(os->body_data+at,os->page_vals[i].iov_base,os->page_vals[i].iov_len);
+    at+=(long)os->page_vals[i].iov_len;
+  }
+  og->body=os->body_data;
+  return ret;
+}
+
+/* Same, for the ogg_page_iov interface */
+
+static int _os_page_slice(ogg_stream_state *os,ogg_page_iov *og,
+                          const ogg_page *page,int ret){
+  int n;
+
+  if(!ret) return 0;
+
+  if(os->body_refs){
+    if((n=_os_ref_slice(os,page->body_len))<0) return 0;
+  }else{
+    if(_os_page_expand(os,1)) return 0;
+    os->page_vals[0].iov_base=page->body;
+    os->page_vals[0].iov_len=page->body_len;
+    n=page->body_len?1:0;
+  }
+
+  og->header=page->header;
+  og->header_len=page->header_len;
+  og->body=os->page_vals;
+  og->body_count=n;
+  og->body_len=page->body_len;
+  return ret;
+}
+
 /* This will flush remaining packets into a page (returning nonzero),
    even if there is not enough data to trigger a flush normally
    (undersized page). If there are no packets or partial packets to
@@ -515,7 +1114,7 @@ static int ogg_stream_flush_i(ogg_stream_state *os,ogg_page *og, int force, int
    a page regardless of size in the middle of a stream. */
 
 int ogg_stream_flush(ogg_stream_state *os,ogg_page *og){
-  return ogg_stream_flush_i(os,og,1,4096);
+  return _os_page_gather(os,og,ogg_stream_flush_i(os,og,1,4096));
 }
 
 /* Like the above, but an argument is provided to adjust the nominal
@@ -523,7 +1122,24 @@ int ogg_stream_flush(ogg_stream_state *os,ogg_page *og){
    own delay based flushing */
 
 int ogg_stream_flush_fill(ogg_stream_state *os,ogg_page *og, int nfill){
-  return ogg_stream_flush_i(os,og,1,nfill);
+  return _os_page_gather(os,og,ogg_stream_flush_i(os,og,1,nfill));
+}
+
+/* Like ogg_stream_flush(), but the page body comes out as slices of the
+   buffers given to ogg_stream_iovecin_ref() (or as a single slice of
+   body_data for packets that were copied in), so that it can be written
+   out with writev() or the like without ever being copied */
+
+int ogg_stream_flush_iov(ogg_stream_state *os,ogg_page_iov *og){
+  ogg_page page;
+  return _os_page_slice(os,og,&page,ogg_stream_flush_i(os,&page,1,4096));
+}
+
+/* Whether the next page has to be forced out however small it is */
+
+static int _os_pageout_force(ogg_stream_state *os){
+  return (os->e_o_s&&os->lacing_fill>os->lacing_returned) ||  /* 'were done, now flush' case */
+    (os->lacing_fill>os->lacing_returned&&!os->b_o_s);        /* 'initial header page' case */
 }
 
 /* This constructs pages from buffered packet segments.  The pointers
@@ -531,14 +1147,9 @@ returned are to static buffers; do not free. The returned buffers are
 good only until the next call (using the same ogg_stream_state) */
 
 int ogg_stream_pageout(ogg_stream_state *os, ogg_page *og){
-  int force=0;
   if(ogg_stream_check(os)) return 0;
-
-  if((os->e_o_s&&os->lacing_fill) ||          /* 'were done, now flush' case */
-     (os->lacing_fill&&!os->b_o_s))           /* 'initial header page' case */
-    force=1;
-
-  return(ogg_stream_flush_i(os,og,force,4096));
+  return _os_page_gather(os,og,
+                         ogg_stream_flush_i(os,og,_os_pageout_force(os),4096));
 }
 
 /* Like the above, but an argument is provided to adjust the nominal
@@ -546,14 +1157,19 @@ page size for applications which are smart enough to provide their
 own delay based flushing */
 
 int ogg_stream_pageout_fill(ogg_stream_state *os, ogg_page *og, int nfill){
-  int force=0;
   if(ogg_stream_check(os)) return 0;
+  return _os_page_gather(os,og,
+                         ogg_stream_flush_i(os,og,_os_pageout_force(os),nfill));
+}
 
-  if((os->e_o_s&&os->lacing_fill) ||          /* 'were done, now flush' case */
-     (os->lacing_fill&&!os->b_o_s))           /* 'initial header page' case */
-    force=1;
+/* ogg_stream_pageout() for the ogg_page_iov interface, see
+   ogg_stream_flush_iov() */
 
-  return(ogg_stream_flush_i(os,og,force,nfill));
+int ogg_stream_pageout_iov(ogg_stream_state *os, ogg_page_iov *og){
+  ogg_page page;
+  if(ogg_stream_check(os)) return 0;
+  return _os_page_slice(os,og,&page,
+                        ogg_stream_flush_i(os,&page,_os_pageout_force(os),4096));
 }
 
 int ogg_stream_eos(ogg_stream_state *os){
@@ -585,10 +1201,46 @@ int ogg_sync_init(ogg_sync_state *oy){
   return(0);
 }
 
+/* Same, for a sync state that keeps its data in a ring buffer rather
+   than moving the bytes not returned yet down to the start of the
+   buffer before exposing more.  Once the end of the buffer is reached,
+   writing continues at its start if the bytes returned since make room
+   for it; the buffer exposed by ogg_sync_buffer() is always in one
+   piece.  A page that straddles the wrap is copied out to be returned
+   in one piece as well; that's the only copy, and it's rare.  Works
+   with all of the ogg_sync_* calls, and pages stay good for as long as
+   they do otherwise. */
+int ogg_sync_init_ring(ogg_sync_state *oy){
+  if(oy){
+    ogg_sync_init(oy);
+    oy->ring=1;
+  }
+  return(0);
+}
+
+/* For input that's known to be intact (written by ourselves, kept on
+   storage that has checksums of its own), ogg_sync_pageout() and
+   ogg_sync_pageseek() can verify the checksum of only 1 in every
+   interval pages, or of none at all with an interval of 0.  The capture
+   pattern and the rest of the header are still parsed as usual, and
+   the first page found after losing sync is always verified, as it may
+   well be a stray capture pattern in the junk.  The default is 1,
+   verify every page.  pages_verified and pages_skipped count the pages
+   returned either way.  Returns 0, or -1 for a negative interval. */
+int ogg_sync_set_verify(ogg_sync_state *oy, int interval){
+  if(ogg_sync_check(oy))return -1;
+  if(interval<0)return -1;
+  /* a zeroed (or cleared) state verifies every page */
+  oy->verify_interval=interval?interval:-1;
+  oy->verify_count=0;
+  return 0;
+}
+
 /* clear non-flat storage within */
 int ogg_sync_clear(ogg_sync_state *oy){
   if(oy){
     if(oy->data)_ogg_free(oy->data);
+    if(oy->scratch)_ogg_free(oy->scratch);
     memset(oy,0,sizeof(*oy));
   }
   return(0);
@@ -607,9 +1259,269 @@ int ogg_sync_check(ogg_sync_state *oy){
   return 0;
 }
 
+/* Helpers for the ring buffer.  The bytes not returned yet are
+   [returned,fill), or [returned,wrap) followed by [0,fill) once fill
+   has wrapped around to the start of the buffer.  wrap is never set
+   without oy->ring. */
+
+/* number of bytes not returned yet */
+static long _ogg_sync_avail(ogg_sync_state *oy){
+  if(oy->wrap)return oy->wrap-oy->returned+oy->fill;
+  return oy->fill-oy->returned;
+}
+
+/* number of those that are in one piece at oy->data+oy->returned */
+static long _ogg_sync_contig(ogg_sync_state *oy){
+  return (oy->wrap?oy->wrap:oy->fill)-oy->returned;
+}
+
+/* copies n bytes, starting off bytes past the returned mark */
+static void _ogg_sync_read(ogg_sync_state *oy,long off,
+                           unsigned char *dst,long n){
+  long contig=_ogg_sync_contig(oy);
+  if(off<contig){
+    long len=n<contig-off?n:contig-off;
+    memcpy(dst,oy->data+oy->returned+off,len);
+    dst+=len;
+    off+=len;
+    n-=len;
+  }
+  if(n)memcpy(dst,oy->data+off-contig,n);
+}
+
+/* returns n bytes at the returned mark in one piece, copying them to
+   tmp if they straddle the wrap */
+static const unsigned char *_ogg_sync_view(ogg_sync_state *oy,
+                                           unsigned char *tmp,long n){
+  if(_ogg_sync_contig(oy)>=n)return oy->data+oy->returned;
+  _ogg_sync_read(oy,0,tmp,n);
+  return tmp;
+}
+
+/* Capture pattern search.  Once sync is lost, everything up to the
+   next "OggS" is junk, so that gets searched for in bulk rather than an
+   'O' at a time; junk that's full of them (text, say) would otherwise
+   cost a pageseek call each.  The kernels return the offset of the
+   first "OggS" entirely within the n (at least 3) bytes at p, or n-3 if
+   there's none, the first offset where the pattern would run off the
+   end. */
+
+#if defined(__x86_64__) || defined(_M_X64)
+#  define OGG_SCAN_SSE2 1
+#  if defined(__GNUC__)
+#    define OGG_SCAN_AVX2 1
+#    include <cpuid.h>
+#    include <immintrin.h>
+#  else
+#    include <intrin.h>
+#  endif
+#elif defined(__aarch64__) && defined(__GNUC__)
+#  define OGG_SCAN_NEON 1
+#  include <arm_neon.h>
+#endif
+
+static long _ogg_scan_bytewise(const unsigned char *p,long n){
+  long i=0;
+  while(i<n-3){
+    const unsigned char *o=memchr(p+i,'O',n-3-i);
+    if(!o)break;
+    i=(long)(o-p);
+    if(o[1]=='g' && o[2]=='g' && o[3]=='S')return i;
+    i++;
+  }
+  return n-3;
+}
+
+#ifdef OGG_SCAN_SSE2
+static int _ogg_scan_ctz(unsigned int x){
+#if defined(_MSC_VER)
+  unsigned long i;
+  _BitScanForward(&i,x);
+  return (int)i;
+#else
+  return __builtin_ctz(x);
+#endif
+}
+
+/* 16 positions at a time: the bytes at +0..+3 of each get compared
+   against 'O','g','g','S' in four loads */
+static long _ogg_scan_sse2(const unsigned char *p,long n){
+  const __m128i O=_mm_set1_epi8('O');
+  const __m128i g=_mm_set1_epi8('g');
+  const __m128i S=_mm_set1_epi8('S');
+  long i;
+  for(i=0;i+19<=n;i+=16){
+    __m128i m=_mm_and_si128(
+      _mm_and_si128(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(p+i)),O),
+                    _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(p+i+1)),g)),
+      _mm_and_si128(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(p+i+2)),g),
+                    _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(p+i+3)),S)));
+    int mask=_mm_movemask_epi8(m);
+    if(mask)return i+_ogg_scan_ctz((unsigned int)mask);
+  }
+  return i+_ogg_scan_bytewise(p+i,n-i);
+}
+#endif
+
+#ifdef OGG_SCAN_AVX2
+/* same, 32 at a time */
+__attribute__((target("avx2")))
+static long _ogg_scan_avx2(const unsigned char *p,long n){
+  const __m256i O=_mm256_set1_epi8('O');
+  const __m256i g=_mm256_set1_epi8('g');
+  const __m256i S=_mm256_set1_epi8('S');
+  long i;
+  for(i=0;i+35<=n;i+=32){
+    __m256i m=_mm256_and_si256(
+      _mm256_and_si256(
+        _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(p+i)),O),
+        _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(p+i+1)),g)),
+      _mm256_and_si256(
+        _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(p+i+2)),g),
+        _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(p+i+3)),S)));
+    unsigned int mask=(unsigned int)_mm256_movemask_epi8(m);
+    if(mask)return i+_ogg_scan_ctz(mask);
+  }
+  return i+_ogg_scan_sse2(p+i,n-i);
+}
+
+static int _ogg_scan_have_avx2(void){
+  unsigned int a,b,c,d,lo,hi;
+  if(!__get_cpuid(1,&a,&b,&c,&d) || !(c&bit_OSXSAVE))return 0;
+  /* the OS has to save the YMM registers as well as the XMM ones */
+  __asm__("xgetbv":"=a"(lo),"=d"(hi):"c"(0));
+  if((lo&6)!=6)return 0;
+  if(__get_cpuid_max(0,NULL)<7)return 0;
+  __cpuid_count(7,0,a,b,c,d);
+  return (b&bit_AVX2)!=0;
+}
+#endif
+
+#ifdef OGG_SCAN_NEON
+static long _ogg_scan_neon(const unsigned char *p,long n){
+  const uint8x16_t O=vdupq_n_u8('O');
+  const uint8x16_t g=vdupq_n_u8('g');
+  const uint8x16_t S=vdupq_n_u8('S');
+  long i;
+  for(i=0;i+19<=n;i+=16){
+    uint8x16_t m=vandq_u8(vandq_u8(vceqq_u8(vld1q_u8(p+i),O),
+                                   vceqq_u8(vld1q_u8(p+i+1),g)),
+                          vandq_u8(vceqq_u8(vld1q_u8(p+i+2),g),
+                                   vceqq_u8(vld1q_u8(p+i+3),S)));
+    /* narrowed to 4 bits per position */
+    uint64_t mask=vget_lane_u64(vreinterpret_u64_u8(
+      vshrn_n_u16(vreinterpretq_u16_u8(m),4)),0);
+    if(mask)return i+(__builtin_ctzll(mask)>>2);
+  }
+  return i+_ogg_scan_bytewise(p+i,n-i);
+}
+#endif
+
+static long _ogg_scan_init(const unsigned char *p,long n);
+
+static long (*_ogg_scan_kernel)(const unsigned char *p,long n)=
+  _ogg_scan_init;
+
+static long _ogg_scan_init(const unsigned char *p,long n){
+  _ogg_scan_kernel=_ogg_scan_bytewise;
+#ifdef OGG_SCAN_SSE2
+  _ogg_scan_kernel=_ogg_scan_sse2;
+#endif
+#ifdef OGG_SCAN_AVX2
+  if(_ogg_scan_have_avx2())_ogg_scan_kernel=_ogg_scan_avx2;
+#endif
+#ifdef OGG_SCAN_NEON
+  _ogg_scan_kernel=_ogg_scan_neon;
+#endif
+  return _ogg_scan_kernel(p,n);
+}
+
+/* whether the bytes off bytes past the returned mark are "OggS", or as
+   much of it as is buffered */
+static int _ogg_sync_match(ogg_sync_state *oy,long off){
+  unsigned char tmp[4];
+  long n=_ogg_sync_avail(oy)-off;
+  if(n>4)n=4;
+  _ogg_sync_read(oy,off,tmp,n);
+  return !memcmp(tmp,"OggS",n);
+}
+
+/* offset of the first possible capture pattern at least 1 byte past
+   the returned mark, or the number of bytes available if there's none.
+   A pattern cut short by the end of the data counts, the rest of it may
+   be yet to come */
+static long _ogg_sync_capture(ogg_sync_state *oy){
+  long avail=_ogg_sync_avail(oy);
+  long contig=_ogg_sync_contig(oy);
+  long off=1;
+  if(off<contig-3)
+    off+=_ogg_scan_kernel(oy->data+oy->returned+off,contig-off);
+  /* that leaves the last few before the wrap, which may straddle it */
+  for(;off<contig;off++)
+    if(_ogg_sync_match(oy,off))return off;
+  if(off<avail-3)
+    off+=_ogg_scan_kernel(oy->data+off-contig,avail-off);
+  for(;off<avail;off++)
+    if(_ogg_sync_match(oy,off))return off;
+  return avail;
+}
+
+/* moves the returned mark n bytes on */
+static void _ogg_sync_advance(ogg_sync_state *oy,long n){
+  oy->returned+=n;
+  if(oy->wrap && oy->returned>=oy->wrap){
+    oy->returned-=oy->wrap;
+    oy->wrap=0;
+  }
+}
+
+static char *_ogg_sync_ring_buffer(ogg_sync_state *oy, long size){
+  if(!oy->wrap){
+    /* empty; start over at the beginning for free */
+    if(oy->returned==oy->fill)
+      oy->returned=oy->fill=0;
+    if(size<=oy->storage-oy->fill)
+      return((char *)oy->data+oy->fill);
+    /* wrap around if there's room before the returned mark */
+    if(size<=oy->returned){
+      oy->wrap=oy->fill;
+      oy->fill=0;
+      return((char *)oy->data);
+    }
+  }else if(size<=oy->returned-oy->fill)
+    return((char *)oy->data+oy->fill);
+
+  /* We need to straighten out the bytes not returned yet, extending
+     the internal buffer (by at least an extra page, to be nice) unless
+     they fit as they are */
+  {
+    long avail=_ogg_sync_avail(oy);
+    long newsize=size<INT_MAX-avail?
+      (size+avail<oy->storage?oy->storage:
+       _ogg_grow(oy->storage,size+avail,4096,INT_MAX)):0;
+    unsigned char *ret=newsize?_ogg_malloc(newsize):NULL;
+
+    if(!ret){
+      ogg_sync_clear(oy);
+      return NULL;
+    }
+    if(avail)_ogg_sync_read(oy,0,ret,avail);
+    if(oy->data)_ogg_free(oy->data);
+    oy->data=ret;
+    oy->storage=newsize;
+    oy->returned=0;
+    oy->fill=avail;
+    oy->wrap=0;
+  }
+
+  return((char *)oy->data+oy->fill);
+}
+
 char *ogg_sync_buffer(ogg_sync_state *oy, long size){
   if(ogg_sync_check(oy)) return NULL;
 
+  if(oy->ring) return _ogg_sync_ring_buffer(oy,size);
+
   /* first, clear out any space that has been previously returned */
   if(oy->returned){
     oy->fill-=oy->returned;
@@ -619,10 +1531,17 @@ char *ogg_sync_buffer(ogg_sync_state *oy, long size){
   }
 
   if(size>oy->storage-oy->fill){
-    /* We need to extend the internal buffer */
-    long newsize=size+oy->fill+4096; /* an extra page to be nice */
+    /* We need to extend the internal buffer, by at least an extra page
+       to be nice */
+    long newsize=size<INT_MAX-oy->fill?
+      _ogg_grow(oy->storage,size+oy->fill,4096,INT_MAX):0;
     void *ret;
 
+    if(!newsize){
+      ogg_sync_clear(oy);
+      return NULL;
+    }
+
     if(oy->data)
       ret=_ogg_realloc(oy->data,newsize);
     else
@@ -641,7 +1560,7 @@ char *ogg_sync_buffer(ogg_sync_state *oy, long size){
 
 int ogg_sync_wrote(ogg_sync_state *oy, long bytes){
   if(ogg_sync_check(oy))return -1;
-  if(oy->fill+bytes>oy->storage)return -1;
+  if(oy->fill+bytes>(oy->wrap?oy->returned:oy->storage))return -1;
   oy->fill+=bytes;
   return(0);
 }
@@ -656,91 +1575,122 @@ int ogg_sync_wrote(ogg_sync_state *oy, long bytes){
 
 */
 
-long ogg_sync_pageseek(ogg_sync_state *oy,ogg_page *og){
+static long _ogg_sync_pageseek(ogg_sync_state *oy,ogg_page *og,int check){
   unsigned char *page=oy->data+oy->returned;
-  unsigned char *next;
-  long bytes=oy->fill-oy->returned;
+  unsigned char tmp[282];
+  long bytes;
+  long skip;
+  int verify;
 
   if(ogg_sync_check(oy))return 0;
 
+  bytes=_ogg_sync_avail(oy);
+
   if(oy->headerbytes==0){
+    const unsigned char *header;
     int headerbytes,i;
     if(bytes<27)return(0); /* not enough for a header */
 
     /* verify capture pattern */
-    if(memcmp(page,"OggS",4))goto sync_fail;
+    header=_ogg_sync_view(oy,tmp,27);
+    if(memcmp(header,"OggS",4))goto sync_fail;
+    /* a stray "OggS" in the junk is caught here most of the time, rather
+       than after buffering the page it claims to be for a checksum */
+    if(header[4]!=0)goto sync_fail; /* unknown version */
 
-    headerbytes=page[26]+27;
+    headerbytes=header[26]+27;
     if(bytes<headerbytes)return(0); /* not enough for header + seg table */
 
     /* count up body length in the segment table */
 
-    for(i=0;i<page[26];i++)
-      oy->bodybytes+=page[27+i];
+    header=_ogg_sync_view(oy,tmp,headerbytes);
+    for(i=0;i<header[26];i++)
+      oy->bodybytes+=header[27+i];
     oy->headerbytes=headerbytes;
   }
 
   if(oy->bodybytes+oy->headerbytes>bytes)return(0);
 
-  /* The whole test page is buffered.  Verify the checksum */
-  {
-    /* Grab the checksum bytes, set the header field to zero */
-    char chksum[4];
-    ogg_page log;
+  /* The whole test page is buffered.  If it straddles the wrap, it gets
+     copied out in one piece */
+  bytes=oy->headerbytes+oy->bodybytes;
+  if(_ogg_sync_contig(oy)<bytes){
+    if(oy->scratch_storage<bytes){
+      void *ret=_ogg_realloc(oy->scratch,bytes);
+      if(!ret){
+        ogg_sync_clear(oy);
+        return 0;
+      }
+      oy->scratch=ret;
+      oy->scratch_storage=bytes;
+    }
+    _ogg_sync_read(oy,0,oy->scratch,bytes);
+    page=oy->scratch;
+  }
 
-    memcpy(chksum,page+22,4);
-    memset(page+22,0,4);
+  /* Verify the checksum, unless the caller does it as it copies the
+     page (ogg_stream_pagein_checked), or this page's turn hasn't come
+     (ogg_sync_set_verify) */
+  verify=0;
+  if(check){
+    oy->verify_count++;
+    if(oy->unsynced || (oy->verify_interval>=0 &&
+                        oy->verify_count>=oy->verify_interval)){
+      verify=1;
+      oy->verify_count=0;
+    }
+  }
+  if(verify){
+    ogg_page log;
 
     /* set up a temp page struct and recompute the checksum */
     log.header=page;
     log.header_len=oy->headerbytes;
     log.body=page+oy->headerbytes;
     log.body_len=oy->bodybytes;
-    ogg_page_checksum_set(&log);
 
     /* Compare */
-    if(memcmp(chksum,page+22,4)){
+    if(_ogg_page_crc(&log)!=_ogg_page_checksum(page)){
       /* D'oh.  Mismatch! Corrupt page (or miscapture and not a page
-         at all) */
-      /* replace the computed checksum with the one actually read in */
-      memcpy(page+22,chksum,4);
-
-      /* Bad checksum. Lose sync */
+         at all).  Bad checksum. Lose sync */
       goto sync_fail;
     }
   }
 
   /* yes, have a whole page all ready to go */
-  {
-    unsigned char *page=oy->data+oy->returned;
-    long bytes;
-
-    if(og){
-      og->header=page;
-      og->header_len=oy->headerbytes;
-      og->body=page+oy->headerbytes;
-      og->body_len=oy->bodybytes;
-    }
-
-    oy->unsynced=0;
-    oy->returned+=(bytes=oy->headerbytes+oy->bodybytes);
-    oy->headerbytes=0;
-    oy->bodybytes=0;
-    return(bytes);
+  if(verify)oy->pages_verified++;
+  else if(check)oy->pages_skipped++;
+  if(og){
+    og->header=page;
+    og->header_len=oy->headerbytes;
+    og->body=page+oy->headerbytes;
+    og->body_len=oy->bodybytes;
   }
 
+  /* an unchecked page may still get rejected, which mustn't report
+     a second hole when we were already out of sync: 2 remembers that
+     until the next page */
+  oy->unsynced=(!check && oy->unsynced==1)?2:0;
+  oy->lastpage=oy->returned;
+  oy->lastwrap=oy->wrap;
+  _ogg_sync_advance(oy,bytes);
+  oy->headerbytes=0;
+  oy->bodybytes=0;
+  return(bytes);
+
  sync_fail:
 
   oy->headerbytes=0;
   oy->bodybytes=0;
 
   /* search for possible capture */
-  next=memchr(page+1,'O',bytes-1);
-  if(!next)
-    next=oy->data+oy->fill;
+  skip=_ogg_sync_capture(oy);
+  _ogg_sync_advance(oy,skip);
+  return(-skip);
+}
 
-  oy->returned=(int)(next-oy->data);
-  return((long)-(next-page));
+long ogg_sync_pageseek(ogg_sync_state *oy,ogg_page *og){
+  return _ogg_sync_pageseek(oy,og,1);
 }
 
 /* sync the stream and get a page.  Keep trying until we find a page.
@@ -754,7 +1704,7 @@ long ogg_sync_pageseek(ogg_sync_state *oy,ogg_page *og){
    Returns pointers into buffered data; invalidated by next call to
    _stream, _clear, _init, or _buffer */
 
-int ogg_sync_pageout(ogg_sync_state *oy, ogg_page *og){
+static int _ogg_sync_pageout(ogg_sync_state *oy, ogg_page *og, int check){
 
   if(ogg_sync_check(oy))return 0;
 
@@ -763,7 +1713,7 @@ int ogg_sync_pageout(ogg_sync_state *oy, ogg_page *og){
      frame */
 
   for(;;){
-    long ret=ogg_sync_pageseek(oy,og);
+    long ret=_ogg_sync_pageseek(oy,og,check);
     if(ret>0){
       /* have a page */
       return(1);
@@ -774,7 +1724,7 @@ int ogg_sync_pageout(ogg_sync_state *oy, ogg_page *og){
     }
 
     /* head did not start a synced page... skipped some bytes */
-    if(!oy->unsynced){
+    if(oy->unsynced!=1){
       oy->unsynced=1;
       return(-1);
     }
@@ -784,63 +1734,83 @@ int ogg_sync_pageout(ogg_sync_state *oy, ogg_page *og){
   }
 }
 
+int ogg_sync_pageout(ogg_sync_state *oy, ogg_page *og){
+  return _ogg_sync_pageout(oy,og,1);
+}
+
+/* Like ogg_sync_pageout(), but leaves verifying the page checksum to the
+   caller, so that it can be done while copying the page anyway (see
+   ogg_stream_pagein_checked()).  A page that fails the check must be
+   handed back with ogg_sync_pagereject() before anything else is done
+   with the ogg_sync_state. */
+
+int ogg_sync_pageout_unchecked(ogg_sync_state *oy, ogg_page *og){
+  return _ogg_sync_pageout(oy,og,0);
+}
+
+/* Puts back the page the last ogg_sync_pageout_unchecked() returned,
+   after it failed its checksum, and looks for the next capture within
+   it, just like ogg_sync_pageout() would have done.
+
+   return values:
+   -1) recapture (hole in data)
+    0) otherwise */
+
+int ogg_sync_pagereject(ogg_sync_state *oy, const ogg_page *og){
+  if(ogg_sync_check(oy))return 0;
+  (void)og;
+
+  oy->returned=oy->lastpage;
+  oy->wrap=oy->lastwrap;
+  oy->headerbytes=0;
+  oy->bodybytes=0;
+
+  /* search for possible capture */
+  _ogg_sync_advance(oy,_ogg_sync_capture(oy));
+
+  if(oy->unsynced!=2){
+    oy->unsynced=1;
+    return(-1);
+  }
+  oy->unsynced=1;
+  return(0);
+}
+
 /* add the incoming page to the stream state; we decompose the page
    into packet segments here as well. */
 
-int ogg_stream_pagein(ogg_stream_state *os, ogg_page *og){
+static int _os_pagein(ogg_stream_state *os, ogg_page *og,
+                      const ogg_page_desc *desc, int check){
   unsigned char *header=og->header;
   unsigned char *body=og->body;
   long           bodysize=og->body_len;
   int            segptr=0;
 
-  int version=ogg_page_version(og);
-  int continued=ogg_page_continued(og);
-  int bos=ogg_page_bos(og);
-  int eos=ogg_page_eos(og);
-  ogg_int64_t granulepos=ogg_page_granulepos(og);
-  int serialno=ogg_page_serialno(og);
-  long pageno=ogg_page_pageno(og);
-  int segments=header[26];
+  int bos=desc->bos;
+  int segments=desc->segments;
 
   if(ogg_stream_check(os)) return -1;
 
-  /* clean up 'returned data' */
-  {
-    long lr=os->lacing_returned;
-    long br=os->body_returned;
-
-    /* body data */
-    if(br){
-      os->body_fill-=br;
-      if(os->body_fill)
-        memmove(os->body_data,os->body_data+br,os->body_fill);
-      os->body_returned=0;
-    }
-
-    if(lr){
-      /* segment table */
-      if(os->lacing_fill-lr){
-        memmove(os->lacing_vals,os->lacing_vals+lr,
-                (os->lacing_fill-lr)*sizeof(*os->lacing_vals));
-        memmove(os->granule_vals,os->granule_vals+lr,
-                (os->lacing_fill-lr)*sizeof(*os->granule_vals));
-      }
-      os->lacing_fill-=lr;
-      os->lacing_packet-=lr;
-      os->lacing_returned=0;
-    }
-  }
-
   /* check the serial number */
-  if(serialno!=os->serialno)return(-1);
-  if(version>0)return(-1);
+  if(desc->serialno!=os->serialno || desc->version>0){
+    /* an unchecked page may not even be a page */
+    if(check && ogg_page_checksum_check(og))return(-2);
+    return(-1);
+  }
 
   if(_os_lacing_expand(os,segments+1)) return -1;
 
   /* are we in sequence? */
-  if(pageno!=os->pageno){
+  if(desc->pageno!=os->pageno){
     int i;
 
+    /* we're about to drop data on behalf of this page, so it had better
+       be a real one; checking it in one go is fine in this rare case */
+    if(check){
+      if(ogg_page_checksum_check(og))return(-2);
+      check=0;
+    }
+
     /* unroll previous partial packet (if any) */
     for(i=os->lacing_packet;i<os->lacing_fill;i++)
       os->body_fill-=os->lacing_vals[i]&0xff;
@@ -855,25 +1825,37 @@ int ogg_stream_pagein(ogg_stream_state *os, ogg_page *og){
 
   /* are we a 'continued packet' page?  If so, we may need to skip
      some segments */
-  if(continued){
-    if(os->lacing_fill<1 ||
+  if(desc->continued){
+    if(os->lacing_fill<=os->lacing_returned ||
        os->lacing_vals[os->lacing_fill-1]==0x400){
       bos=0;
-      for(;segptr<segments;segptr++){
-        int val=header[27+segptr];
-        body+=val;
-        bodysize-=val;
-        if(val<255){
-          segptr++;
-          break;
-        }
-      }
+      body+=desc->lead;
+      bodysize-=desc->lead;
+      segptr=desc->packets?desc->lead/255+1:segments;
     }
   }
 
-  if(bodysize){
-    if(_os_body_expand(os,bodysize)) return -1;
-    memcpy(os->body_data+os->body_fill,body,bodysize);
+  /* Nothing visible has changed so far.  Verify the checksum while
+     copying the body in, and bail before accepting it if it's off; the
+     data past the fill mark doesn't matter */
+  {
+    ogg_uint32_t crc_reg=0;
+
+    if(check){
+      crc_reg=_ogg_page_header_crc(header,og->header_len);
+      crc_reg=_ogg_crc_update(crc_reg,og->body,og->body_len-bodysize);
+    }
+
+    if(bodysize){
+      if(_os_body_expand(os,bodysize)) return -1;
+      if(check)
+        crc_reg=_ogg_crc_copy(crc_reg,os->body_data+os->body_fill,
+                              body,bodysize);
+      else
+        memcpy(os->body_data+os->body_fill,body,bodysize);
+    }
+
+    if(check && crc_reg!=_ogg_page_checksum(header))return(-2);
     os->body_fill+=bodysize;
   }
 
@@ -899,28 +1881,54 @@ int ogg_stream_pagein(ogg_stream_state *os, ogg_page *og){
 
     /* set the granulepos on the last granuleval of the last full packet */
     if(saved!=-1){
-      os->granule_vals[saved]=granulepos;
+      os->granule_vals[saved]=desc->granulepos;
     }
 
   }
 
-  if(eos){
+  if(desc->eos){
     os->e_o_s=1;
-    if(os->lacing_fill>0)
+    if(os->lacing_fill>os->lacing_returned)
       os->lacing_vals[os->lacing_fill-1]|=0x200;
   }
 
-  os->pageno=pageno+1;
+  os->pageno=desc->pageno+1;
 
   return(0);
 }
 
+int ogg_stream_pagein(ogg_stream_state *os, ogg_page *og){
+  ogg_page_desc desc;
+  if(ogg_page_describe(og,&desc)) return -1;
+  return _os_pagein(os,og,&desc,0);
+}
+
+/* Like ogg_stream_pagein(), for pages from ogg_sync_pageout_unchecked():
+   verifies the page checksum as its body gets copied in.  Returns -2,
+   leaving the stream as it was, when the page fails it. */
+
+int ogg_stream_pagein_checked(ogg_stream_state *os, ogg_page *og){
+  ogg_page_desc desc;
+  if(ogg_page_describe(og,&desc)) return -1;
+  return _os_pagein(os,og,&desc,1);
+}
+
+/* Either of the above (check selecting ogg_stream_pagein_checked()), for
+   a page that ogg_page_describe() has been through already */
+
+int ogg_stream_pagein_desc(ogg_stream_state *os, ogg_page *og,
+                           const ogg_page_desc *desc, int check){
+  if(!desc) return -1;
+  return _os_pagein(os,og,desc,check);
+}
+
 /* clear things to an initial state.  Good to call, eg, before seeking */
 int ogg_sync_reset(ogg_sync_state *oy){
   if(ogg_sync_check(oy))return -1;
 
   oy->fill=0;
   oy->returned=0;
+  oy->wrap=0;
   oy->unsynced=0;
   oy->headerbytes=0;
   oy->bodybytes=0;
@@ -933,6 +1941,11 @@ int ogg_stream_reset(ogg_stream_state *os){
   os->body_fill=0;
   os->body_returned=0;
 
+  os->ref_fill=0;
+  os->ref_returned=0;
+  os->ref_offset=0;
+  os->body_refs=0;
+
   os->lacing_fill=0;
   os->lacing_packet=0;
   os->lacing_returned=0;
@@ -1653,12 +2666,757 @@ void test_pack(const int *pl, const int **headers, int byteskip,
   fprintf(stderr,"ok.\n");
 }
 
+/* check the CRC kernels against the plain table-driven one, on random
+   data of every length around the block sizes and some longer ones,
+   with random alignment and initial register values, both checksumming
+   in place and copying */
+void test_crc(void){
+  unsigned char *data=_ogg_malloc(70016);
+  unsigned char *copy=_ogg_malloc(70016);
+  long lengths[]={65536,4096+15,255*255+27,1000,4097,70000};
+  int i,j;
+
+  for(i=0;i<70016;i++)data[i]=rand();
+
+  for(i=0;i<300+6;i++){
+    long len=i<300?i:lengths[i-300];
+    for(j=0;j<8;j++){
+      const unsigned char *p=data+(rand()&15);
+      unsigned char *dst=(j&1)?copy+(rand()&15):NULL;
+      ogg_uint32_t init=(j&2)?((ogg_uint32_t)rand()<<16)^rand():0;
+      ogg_uint32_t want=_ogg_crc_bytewise(init,NULL,p,len);
+
+      if(_ogg_crc_slice8(init,dst,p,len)!=want){
+        fprintf(stderr,"slicing-by-8 CRC mismatch at length %ld!\n",len);
+        exit(1);
+      }
+#ifdef OGG_CRC_CLMUL
+      if(_ogg_crc_have_clmul() && _ogg_crc_clmul(init,dst,p,len)!=want){
+        fprintf(stderr,"PCLMULQDQ CRC mismatch at length %ld!\n",len);
+        exit(1);
+      }
+#endif
+#ifdef OGG_CRC_PMULL
+      if(_ogg_crc_have_pmull() && _ogg_crc_pmull(init,dst,p,len)!=want){
+        fprintf(stderr,"PMULL CRC mismatch at length %ld!\n",len);
+        exit(1);
+      }
+#endif
+      if(_ogg_crc_kernel(init,dst,p,len)!=want){
+        fprintf(stderr,"dispatched CRC mismatch at length %ld!\n",len);
+        exit(1);
+      }
+      if(dst && memcmp(dst,p,len)){
+        fprintf(stderr,"CRC copy mismatch at length %ld!\n",len);
+        exit(1);
+      }
+    }
+  }
+
+  /* appending the CRC of a separate segment */
+  for(i=0;i<1000;i++){
+    long a=rand()%300;
+    int b=rand()%256;
+    ogg_uint32_t want=_ogg_crc_update(0,data,a+b);
+    ogg_uint32_t crc_reg=_ogg_crc_combine(_ogg_crc_update(0,data,a),
+                                          _ogg_crc_update(0,data+a,b),b);
+    if(crc_reg!=want){
+      fprintf(stderr,"combined CRC mismatch at %ld+%d!\n",a,b);
+      exit(1);
+    }
+  }
+
+  _ogg_free(copy);
+  _ogg_free(data);
+  fprintf(stderr,"ok.\n");
+}
+
+/* the capture pattern search, against a plain loop; then resyncing
+   through junk that's full of near misses */
+void test_scan(void){
+  static const char alphabet[]="OggSx";
+  unsigned char *junk=_ogg_malloc(70000);
+  unsigned char *page;
+  ogg_stream_state os;
+  ogg_packet op;
+  ogg_page og;
+  long page_len;
+  int i,j;
+
+  for(i=0;i<70000;i++)junk[i]=alphabet[rand()%5];
+
+  for(i=0;i<300+3;i++){
+    long len=i<300?3+i:65536+i;
+    for(j=0;j<8;j++){
+      const unsigned char *p=junk+(rand()&31);
+      long want;
+      for(want=0;want<len-3;want++)
+        if(!memcmp(p+want,"OggS",4))break;
+
+      if(_ogg_scan_bytewise(p,len)!=want){
+        fprintf(stderr,"bytewise capture search mismatch at length %ld!\n",
+                len);
+        exit(1);
+      }
+#ifdef OGG_SCAN_SSE2
+      if(_ogg_scan_sse2(p,len)!=want){
+        fprintf(stderr,"SSE2 capture search mismatch at length %ld!\n",len);
+        exit(1);
+      }
+#endif
+#ifdef OGG_SCAN_AVX2
+      if(_ogg_scan_have_avx2() && _ogg_scan_avx2(p,len)!=want){
+        fprintf(stderr,"AVX2 capture search mismatch at length %ld!\n",len);
+        exit(1);
+      }
+#endif
+#ifdef OGG_SCAN_NEON
+      if(_ogg_scan_neon(p,len)!=want){
+        fprintf(stderr,"NEON capture search mismatch at length %ld!\n",len);
+        exit(1);
+      }
+#endif
+      if(_ogg_scan_kernel(p,len)!=want){
+        fprintf(stderr,"dispatched capture search mismatch at length %ld!\n",
+                len);
+        exit(1);
+      }
+    }
+  }
+
+  /* a page to find */
+  ogg_stream_init(&os,0x12345678);
+  op.packet=junk;
+  op.bytes=1000;
+  op.b_o_s=1;
+  op.e_o_s=0;
+  op.granulepos=0;
+  op.packetno=0;
+  ogg_stream_packetin(&os,&op);
+  ogg_stream_flush(&os,&og);
+  page_len=og.header_len+og.body_len;
+  page=_ogg_malloc(page_len);
+  memcpy(page,og.header,og.header_len);
+  memcpy(page+og.header_len,og.body,og.body_len);
+  ogg_stream_clear(&os);
+
+  /* behind junk whose stray "OggS" (none of them version 0) each cost
+     a call, as may a pattern cut short by the end of a write */
+  for(i=0;i<40;i++){
+    ogg_sync_state oy;
+    long len=rand()%20000;
+    long fed=0,skipped=0,ret=0;
+    int calls=0,stray=0,writes=0;
+
+    for(j=0;j+3<len;j++)
+      if(!memcmp(junk+j,"OggS",4))stray++;
+    if(i&1)ogg_sync_init_ring(&oy);
+    else ogg_sync_init(&oy);
+    while(ret<=0){
+      if(!(ret=ogg_sync_pageseek(&oy,&og))){
+        long chunk=rand()%1000+1;
+        char *buffer=ogg_sync_buffer(&oy,chunk);
+        for(j=0;j<chunk && fed<len+page_len;j++,fed++)
+          buffer[j]=fed<len?junk[fed]:page[fed-len];
+        ogg_sync_wrote(&oy,j);
+        writes++;
+      }else if(ret<0){
+        skipped-=ret;
+        calls++;
+      }
+    }
+    if(skipped!=len || calls>stray+writes || ret!=page_len ||
+       memcmp(og.header,page,og.header_len) ||
+       memcmp(og.body,page+og.header_len,og.body_len)){
+      fprintf(stderr,"resync through %ld bytes of junk failed "
+              "(%ld skipped in %d calls)!\n",len,skipped,calls);
+      exit(1);
+    }
+    ogg_sync_clear(&oy);
+  }
+
+  _ogg_free(page);
+  _ogg_free(junk);
+  fprintf(stderr,"ok.\n");
+}
+
+#define DECODE_UNCHECKED 1 /* leave checksums to ogg_stream_pagein_checked() */
+#define DECODE_RING 2      /* use ogg_sync_init_ring() */
+
+/* pages that came out of the scratch buffer of a ring */
+long ring_straddles=0;
+
+/* decodes len bytes of a physical stream, in random chunks, into a
+   transcript of everything the framing reports */
+ogg_uint32_t decode_transcript(const unsigned char *data,long len,
+                               int serialno,int flags,
+                               unsigned int seed,long *packets){
+  int unchecked=flags&DECODE_UNCHECKED;
+  ogg_sync_state y;
+  ogg_stream_state s;
+  ogg_page og;
+  ogg_packet op;
+  ogg_uint32_t transcript=0;
+  long pos=0;
+  int r;
+
+  if(flags&DECODE_RING)
+    ogg_sync_init_ring(&y);
+  else
+    ogg_sync_init(&y);
+  ogg_stream_init(&s,serialno);
+  srand(seed);
+  *packets=0;
+
+#define LOG(v) \
+  do{ \
+    long log_v=(v); \
+    transcript=_ogg_crc_update(transcript,(unsigned char *)&log_v, \
+                               sizeof(log_v)); \
+  }while(0)
+
+  while(pos<len){
+    long chunk=rand()%5000+1;
+    /* ask for more than gets written, now and then */
+    long extra=rand()%4?0:rand()%3000;
+    if(chunk>len-pos)chunk=len-pos;
+    memcpy(ogg_sync_buffer(&y,chunk+extra),data+pos,chunk);
+    if(ogg_sync_wrote(&y,chunk)){
+      fprintf(stderr,"ogg_sync_wrote() failed!\n");
+      exit(1);
+    }
+    pos+=chunk;
+
+    for(;;){
+      r=unchecked?ogg_sync_pageout_unchecked(&y,&og):ogg_sync_pageout(&y,&og);
+      if(r==0)break;
+      if(r<0){
+        LOG(-100);
+        continue;
+      }
+      if(ogg_page_serialno(&og)!=serialno){
+        /* only a checksum failure can get us here */
+        if(!unchecked || !ogg_page_checksum_check(&og)){
+          fprintf(stderr,"unexpected serialno!\n");
+          exit(1);
+        }
+        if(ogg_sync_pagereject(&y,&og))LOG(-100);
+        continue;
+      }
+
+      r=unchecked?ogg_stream_pagein_checked(&s,&og):ogg_stream_pagein(&s,&og);
+      if(r==-2){
+        if(ogg_sync_pagereject(&y,&og))LOG(-100);
+        continue;
+      }
+      LOG(r);
+      LOG(ogg_page_pageno(&og));
+      if(y.scratch && og.header==y.scratch)ring_straddles++;
+
+      while((r=ogg_stream_packetout(&s,&op))!=0){
+        LOG(r);
+        if(r<0)continue;
+        LOG(op.bytes);
+        LOG(op.granulepos);
+        LOG(op.packetno);
+        transcript=_ogg_crc_update(transcript,op.packet,op.bytes);
+        (*packets)++;
+      }
+    }
+  }
+
+#undef LOG
+
+  ogg_stream_clear(&s);
+  ogg_sync_clear(&y);
+  return transcript;
+}
+
+/* corrupts random bytes of an encoded stream and checks that checking
+   the pages in ogg_stream_pagein_checked(), and buffering them in a ring,
+   finds exactly the same pages, holes and packets as the plain
+   ogg_sync_pageout() */
+void test_decode_variants(void){
+  ogg_stream_state s;
+  ogg_page og;
+  unsigned char *packet=_ogg_malloc(20000);
+  unsigned char *data=_ogg_malloc(2*1024*1024);
+  long len=0;
+  int i,j;
+
+  ogg_stream_init(&s,0x12345678);
+  for(i=0;i<20000;i++)packet[i]=rand();
+  for(i=0;i<400;i++){
+    ogg_packet op;
+    op.packet=packet+rand()%100;
+    op.bytes=i%50==49?rand()%19000:rand()%600;
+    op.b_o_s=i==0;
+    op.e_o_s=i==399;
+    op.granulepos=i*1024;
+    op.packetno=i;
+    ogg_stream_packetin(&s,&op);
+    while(ogg_stream_pageout(&s,&og)){
+      memcpy(data+len,og.header,og.header_len);
+      memcpy(data+len+og.header_len,og.body,og.body_len);
+      len+=og.header_len+og.body_len;
+    }
+  }
+  while(ogg_stream_flush(&s,&og)){
+    memcpy(data+len,og.header,og.header_len);
+    memcpy(data+len+og.header_len,og.body,og.body_len);
+    len+=og.header_len+og.body_len;
+  }
+  ogg_stream_clear(&s);
+
+  for(i=0;i<4;i++){
+    long packets;
+    decode_transcript(data,len,0x12345678,i,0,&packets);
+    if(packets!=400){
+      fprintf(stderr,"lost packets decoding an intact stream (%d)!\n",i);
+      exit(1);
+    }
+  }
+
+  for(i=0;i<200;i++){
+    unsigned char *bad=_ogg_malloc(len);
+    unsigned int seed=rand();
+    long packets1,packets2;
+    ogg_uint32_t t1,t2;
+
+    memcpy(bad,data,len);
+    /* a few stray bytes anywhere, or in the first header */
+    for(j=0;j<i%4;j++)bad[rand()%len]=rand();
+    if(i%5==0)bad[rand()%300]^=1<<(rand()%8);
+
+    t1=decode_transcript(bad,len,0x12345678,0,seed,&packets1);
+    for(j=1;j<4;j++){
+      t2=decode_transcript(bad,len,0x12345678,j,seed,&packets2);
+      if(t1!=t2 || packets1!=packets2){
+        fprintf(stderr,"decode variant %d disagrees with sync (trial %d)!\n",
+                j,i);
+        exit(1);
+      }
+    }
+    _ogg_free(bad);
+  }
+
+  if(!ring_straddles){
+    fprintf(stderr,"no page straddled the ring buffer wrap!\n");
+    exit(1);
+  }
+
+  _ogg_free(data);
+  _ogg_free(packet);
+  fprintf(stderr,"ok.\n");
+}
+
+/* sampled and skipped checksum verification */
+void test_verify(void){
+  static const int intervals[]={1,3,0};
+  ogg_stream_state os;
+  ogg_packet op;
+  ogg_page og;
+  unsigned char *data=_ogg_malloc(200000);
+  long len=100,pages=0;
+  int i,j;
+
+  /* 100 bytes of junk, then 50 pages */
+  for(i=0;i<len;i++)data[i]='O';
+  ogg_stream_init(&os,0x12345678);
+  for(i=0;i<50;i++){
+    op.packet=data;
+    op.bytes=1000+i;
+    op.b_o_s=i==0;
+    op.e_o_s=i==49;
+    op.granulepos=i;
+    op.packetno=i;
+    ogg_stream_packetin(&os,&op);
+    while(ogg_stream_flush(&os,&og)){
+      memcpy(data+len,og.header,og.header_len);
+      memcpy(data+len+og.header_len,og.body,og.body_len);
+      len+=og.header_len+og.body_len;
+      pages++;
+    }
+  }
+  ogg_stream_clear(&os);
+  /* corrupt the body of the last page */
+  data[len-1]^=1;
+
+  for(i=0;i<3;i++){
+    ogg_sync_state oy;
+    long got=0;
+    char *buffer;
+
+    ogg_sync_init(&oy);
+    ogg_sync_set_verify(&oy,intervals[i]);
+    buffer=ogg_sync_buffer(&oy,len);
+    memcpy(buffer,data,len);
+    ogg_sync_wrote(&oy,len);
+    while((j=ogg_sync_pageout(&oy,&og))!=0)
+      if(j>0)got++;
+
+    /* the first page is always verified, coming after the junk; the
+       corrupt one gets through unless it's verified */
+    if(got!=oy.pages_verified+oy.pages_skipped ||
+       oy.pages_verified!=(i==0?pages-1:i==1?1+(pages-1)/3:1) ||
+       got!=(i==0 || (i==1 && (pages-1)%3==0)?pages-1:pages)){
+      fprintf(stderr,"verifying 1 in %d pages: %ld verified, %ld skipped "
+              "of %ld!\n",intervals[i],oy.pages_verified,oy.pages_skipped,
+              got);
+      exit(1);
+    }
+    ogg_sync_clear(&oy);
+  }
+
+  _ogg_free(data);
+  fprintf(stderr,"ok.\n");
+}
+
+void test_growth(void){
+  ogg_stream_state en,de;
+  ogg_packet op;
+  ogg_page og;
+  unsigned char *packet=_ogg_malloc(1<<20);
+  unsigned char **pages=_ogg_malloc(2048*sizeof(*pages));
+  long *lens=_ogg_malloc(2048*sizeof(*lens));
+  int npages=0,reallocs,i,j;
+
+  /* a megabyte in 2048 packets, a page each */
+  for(i=0;i<1<<20;i++)packet[i]=rand();
+  ogg_stream_init(&en,0x12345678);
+  for(i=0;i<2048;i++){
+    op.packet=packet+i*512;
+    op.bytes=512;
+    op.b_o_s=i==0;
+    op.e_o_s=i==2047;
+    op.granulepos=i;
+    op.packetno=i;
+    ogg_stream_packetin(&en,&op);
+    while(ogg_stream_flush(&en,&og)){
+      pages[npages]=_ogg_malloc(og.header_len+og.body_len);
+      memcpy(pages[npages],og.header,og.header_len);
+      memcpy(pages[npages]+og.header_len,og.body,og.body_len);
+      lens[npages++]=og.header_len+og.body_len;
+    }
+  }
+  ogg_stream_clear(&en);
+
+  /* buffered all at once; first into a stream that finds out as it
+     goes, then into one that was told how much is coming */
+  for(j=0;j<2;j++){
+    long body_storage;
+
+    ogg_stream_init(&de,0x12345678);
+    if(j && ogg_stream_reserve(&de,1<<20)){
+      fprintf(stderr,"ogg_stream_reserve failed!\n");
+      exit(1);
+    }
+    body_storage=de.body_storage;
+    reallocs=0;
+    for(i=0;i<npages;i++){
+      og.header=pages[i];
+      og.header_len=27+pages[i][26];
+      og.body=pages[i]+og.header_len;
+      og.body_len=lens[i]-og.header_len;
+      if(ogg_stream_pagein(&de,&og)){
+        fprintf(stderr,"pagein failed!\n");
+        exit(1);
+      }
+      if(de.body_storage!=body_storage)reallocs++;
+      body_storage=de.body_storage;
+    }
+    if(j?reallocs!=0:reallocs>16){
+      fprintf(stderr,"%d reallocations buffering %d pages%s!\n",reallocs,
+              npages,j?" after reserving":"");
+      exit(1);
+    }
+    for(i=0;i<2048;i++){
+      if(ogg_stream_packetout(&de,&op)!=1 || op.bytes!=512 ||
+         memcmp(op.packet,packet+i*512,512)){
+        fprintf(stderr,"packet %d mismatch!\n",i);
+        exit(1);
+      }
+    }
+    ogg_stream_clear(&de);
+  }
+
+  for(i=0;i<npages;i++)_ogg_free(pages[i]);
+  _ogg_free(lens);
+  _ogg_free(pages);
+  _ogg_free(packet);
+  fprintf(stderr,"ok.\n");
+}
+
+/* encodes 300 packets of varying sizes, some in several fragments, into
+   out: copied in and paged out (mode 0), by reference and paged out as
+   slices, which have to point into the packets themselves (1), or by
+   reference and gathered by ogg_stream_pageout() (2) */
+static long encode_refs(unsigned char *packets,unsigned char *out,int mode){
+  ogg_stream_state en;
+  ogg_page og;
+  ogg_page_iov ov;
+  ogg_iovec_t iov[3];
+  long off=0,len=0;
+  int i,j,r;
+
+  ogg_stream_init(&en,0x0badcafe);
+  for(i=0;i<300;i++){
+    long bytes=i%7==3?0:(i*7919)%5000;
+    int count=1+i%3;
+    for(j=0;j<count;j++){
+      long n=j<count-1?bytes/count:bytes-bytes/count*(count-1);
+      iov[j].iov_base=packets+off;
+      iov[j].iov_len=n;
+      off+=n;
+    }
+    if(mode)
+      r=ogg_stream_iovecin_ref(&en,iov,count,i==299,i);
+    else
+      r=ogg_stream_iovecin(&en,iov,count,i==299,i);
+    if(r){
+      fprintf(stderr,"packetin %d failed!\n",i);
+      exit(1);
+    }
+
+    for(;;){
+      if(mode==1){
+        if(!(i==299?ogg_stream_flush_iov(&en,&ov):ogg_stream_pageout_iov(&en,&ov)))
+          break;
+        memcpy(out+len,ov.header,ov.header_len);
+        len+=ov.header_len;
+        for(j=0;j<ov.body_count;j++){
+          unsigned char *base=ov.body[j].iov_base;
+          if(base<packets || base+ov.body[j].iov_len>packets+off){
+            fprintf(stderr,"page body slice outside the packets!\n");
+            exit(1);
+          }
+          memcpy(out+len,base,ov.body[j].iov_len);
+          len+=(long)ov.body[j].iov_len;
+        }
+      }else{
+        if(!(i==299?ogg_stream_flush(&en,&og):ogg_stream_pageout(&en,&og)))
+          break;
+        memcpy(out+len,og.header,og.header_len);
+        memcpy(out+len+og.header_len,og.body,og.body_len);
+        len+=og.header_len+og.body_len;
+      }
+    }
+  }
+
+  /* everything's out, so the stream can go back to copying */
+  if(mode && (ogg_stream_iovecin(&en,iov,1,0,0) ||
+              ogg_stream_iovecin_ref(&en,iov,1,0,0)!=-1)){
+    fprintf(stderr,"switching out of by-reference mode failed!\n");
+    exit(1);
+  }
+  ogg_stream_clear(&en);
+  return len;
+}
+
+void test_refs(void){
+  unsigned char *packets=_ogg_malloc(300*5000);
+  unsigned char *out[3];
+  long len[3];
+  int i;
+
+  for(i=0;i<300*5000;i++)packets[i]=rand();
+  for(i=0;i<3;i++){
+    out[i]=_ogg_malloc(300*5000*2);
+    len[i]=encode_refs(packets,out[i],i);
+  }
+  for(i=1;i<3;i++){
+    if(len[i]!=len[0] || memcmp(out[i],out[0],len[0])){
+      fprintf(stderr,"by-reference encoding (%d) differs from copying!\n",i);
+      exit(1);
+    }
+  }
+
+  for(i=0;i<3;i++)_ogg_free(out[i]);
+  _ogg_free(packets);
+  fprintf(stderr,"ok.\n");
+}
+
+/* describes every page of the stream encode_refs() makes, and feeds
+   them back in with ogg_stream_pagein_desc() */
+void test_describe(void){
+  unsigned char *packets=_ogg_malloc(300*5000);
+  unsigned char *out=_ogg_malloc(300*5000*2);
+  long len,at=0;
+  int npackets=0,npages=0,i;
+  ogg_sync_state sy;
+  ogg_stream_state de;
+  ogg_page og;
+  ogg_packet op;
+  ogg_page_desc desc;
+
+  for(i=0;i<300*5000;i++)packets[i]=rand();
+  len=encode_refs(packets,out,0);
+
+  ogg_sync_init(&sy);
+  ogg_stream_init(&de,0x0badcafe);
+  memcpy(ogg_sync_buffer(&sy,len),out,len);
+  ogg_sync_wrote(&sy,len);
+
+  while(ogg_sync_pageout(&sy,&og)==1){
+    int last=og.header[26]?og.header[27+og.header[26]-1]:0;
+    npages++;
+    if(ogg_page_describe(&og,&desc)){
+      fprintf(stderr,"ogg_page_describe failed!\n");
+      exit(1);
+    }
+    if(desc.granulepos!=ogg_page_granulepos(&og) ||
+       desc.serialno!=ogg_page_serialno(&og) ||
+       desc.pageno!=ogg_page_pageno(&og) ||
+       desc.version!=ogg_page_version(&og) ||
+       desc.continued!=(ogg_page_continued(&og)!=0) ||
+       desc.bos!=(ogg_page_bos(&og)!=0) ||
+       desc.eos!=(ogg_page_eos(&og)!=0) ||
+       desc.packets!=ogg_page_packets(&og) ||
+       desc.segments!=og.header[26] ||
+       desc.header_len!=og.header_len || desc.body_len!=og.body_len){
+      fprintf(stderr,"page %d described wrong!\n",npages);
+      exit(1);
+    }
+    if((!desc.continued && desc.lead) || (last==255)!=(desc.tail>0) ||
+       (!desc.packets && desc.tail!=desc.body_len) ||
+       (desc.continued && !desc.packets && desc.lead!=desc.body_len) ||
+       (desc.packets && desc.lead+desc.tail>desc.body_len)){
+      fprintf(stderr,"page %d lead/tail wrong!\n",npages);
+      exit(1);
+    }
+
+    if(ogg_stream_pagein_desc(&de,&og,&desc,npages%2)){
+      fprintf(stderr,"ogg_stream_pagein_desc failed!\n");
+      exit(1);
+    }
+    while(ogg_stream_packetout(&de,&op)==1){
+      if(memcmp(op.packet,packets+at,op.bytes)){
+        fprintf(stderr,"packet %d mismatch!\n",npackets);
+        exit(1);
+      }
+      at+=op.bytes;
+      npackets++;
+    }
+  }
+  if(npackets!=300 || npages<10){
+    fprintf(stderr,"got %d packets in %d pages!\n",npackets,npages);
+    exit(1);
+  }
+
+  ogg_stream_clear(&de);
+  ogg_sync_clear(&sy);
+  _ogg_free(out);
+  _ogg_free(packets);
+  fprintf(stderr,"ok.\n");
+}
+
+/* a counting allocator, swapped in and out while nothing's allocated */
+static long alloc_blocks;
+static long alloc_calls;
+
+static void *counting_malloc(size_t size){
+  alloc_blocks++;
+  alloc_calls++;
+  return malloc(size);
+}
+
+static void *counting_calloc(size_t count,size_t size){
+  alloc_blocks++;
+  alloc_calls++;
+  return calloc(count,size);
+}
+
+static void *counting_realloc(void *ptr,size_t size){
+  if(!ptr)alloc_blocks++;
+  alloc_calls++;
+  return realloc(ptr,size);
+}
+
+static void counting_free(void *ptr){
+  if(ptr)alloc_blocks--;
+  free(ptr);
+}
+
+void test_alloc(void){
+  ogg_stream_state os;
+  ogg_sync_state oy;
+  ogg_packet op;
+  ogg_page og;
+  unsigned char packet[5000];
+  char *buffer;
+
+  if(ogg_set_allocator(counting_malloc,NULL,NULL,NULL)!=-1 ||
+     ogg_set_allocator(counting_malloc,counting_calloc,counting_realloc,
+                       counting_free)){
+    fprintf(stderr,"ogg_set_allocator misreported!\n");
+    exit(1);
+  }
+
+  memset(packet,0x55,sizeof(packet));
+  ogg_stream_init(&os,0x12345678);
+  ogg_sync_init(&oy);
+  op.packet=packet;
+  op.bytes=sizeof(packet);
+  op.b_o_s=1;
+  op.e_o_s=1;
+  op.granulepos=0;
+  op.packetno=0;
+  ogg_stream_packetin(&os,&op);
+  while(ogg_stream_flush(&os,&og)){
+    buffer=ogg_sync_buffer(&oy,og.header_len+og.body_len);
+    memcpy(buffer,og.header,og.header_len);
+    memcpy(buffer+og.header_len,og.body,og.body_len);
+    ogg_sync_wrote(&oy,og.header_len+og.body_len);
+  }
+  ogg_stream_reset(&os);
+  while(ogg_sync_pageout(&oy,&og)>0)ogg_stream_pagein(&os,&og);
+  if(ogg_stream_packetout(&os,&op)!=1 || op.bytes!=sizeof(packet)){
+    fprintf(stderr,"packet lost with the allocator swapped!\n");
+    exit(1);
+  }
+  ogg_stream_clear(&os);
+  ogg_sync_clear(&oy);
+
+  ogg_set_allocator(NULL,NULL,NULL,NULL);
+  if(!alloc_calls || alloc_blocks){
+    fprintf(stderr,"allocator made %ld calls, leaving %ld blocks!\n",
+            alloc_calls,alloc_blocks);
+    exit(1);
+  }
+  fprintf(stderr,"ok.\n");
+}
+
 int main(void){
 
+  /* first, while nothing is allocated yet */
+  fprintf(stderr,"testing allocator hooks... ");
+  test_alloc();
+
   ogg_stream_init(&os_en,0x04030201);
   ogg_stream_init(&os_de,0x04030201);
   ogg_sync_init(&oy);
 
+  fprintf(stderr,"testing CRC kernels... ");
+  test_crc();
+
+  fprintf(stderr,"testing capture pattern search... ");
+  test_scan();
+
+  fprintf(stderr,"testing checked pagein and ring buffer sync... ");
+  test_decode_variants();
+
+  fprintf(stderr,"testing sampled checksum verification... ");
+  test_verify();
+
+  fprintf(stderr,"testing by-reference packets and page slices... ");
+  test_refs();
+
+  fprintf(stderr,"testing page descriptors... ");
+  test_describe();
+
+  fprintf(stderr,"testing buffer growth and capacity hints... ");
+  test_growth();
+
   /* Exercise each code path in the framing code.  Also verify that
      the checksums are working.  */
 
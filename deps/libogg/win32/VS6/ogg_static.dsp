@@ -85,6 +85,10 @@ LIB32=link.exe -lib
 # PROP Default_Filter "cpp;c;cxx;rc;def;r;odl;idl;hpj;bat"
 # Begin Source File
 
+SOURCE=..\..\src\alloc.c
+# End Source File
+# Begin Source File
+
 SOURCE=..\..\src\bitwise.c
 # End Source File
 # Begin Source File
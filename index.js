@@ -1,3 +1,86 @@
+var binding = require('./lib/binding');
+
 exports.ogg_packet = exports.packet = require('./lib/packet');
 exports.Decoder = require('./lib/decoder');
+exports.FileDecoder = require('./lib/file-decoder');
+exports.PageIndex = require('./lib/page-index');
+exports.Skeleton = require('./lib/skeleton');
 exports.Encoder = require('./lib/encoder');
+
+/**
+ * libogg calls touching fewer bytes than this skip the thread pool.
+ * See `binding.dispatch()`.
+ */
+
+Object.defineProperty(exports, 'syncThreshold', {
+  get: function () {
+    return binding.syncThreshold;
+  },
+  set: function (threshold) {
+    binding.syncThreshold = threshold;
+  },
+  enumerable: true
+});
+
+/**
+ * Number of threads in the binding's own thread pool, which runs the libogg
+ * calls instead of the libuv thread pool. Defaults to $OGG_THREADPOOL_SIZE,
+ * or 4. Shared by all the Decoders and Encoders in the process.
+ */
+
+Object.defineProperty(exports, 'threads', {
+  get: function () {
+    return binding.threadpool_stats().size;
+  },
+  set: function (n) {
+    binding.threadpool_resize(n);
+  },
+  enumerable: true
+});
+
+/**
+ * Returns the thread pool's counters: `size`, the number of `threads` started,
+ * tasks `queued` (including those waiting for their stream's previous call to
+ * finish), tasks `running`, and tasks `completed` so far.
+ *
+ * @return {Object}
+ * @api public
+ */
+
+exports.threadPoolStats = function () {
+  return binding.threadpool_stats();
+};
+
+/**
+ * Returns the counters of the allocator libogg's buffers come from: bytes
+ * currently `allocated` to streams, bytes `cached` for reuse after their
+ * stream went away, and how many allocations were served from the cache
+ * (`hits`) or from libc (`misses`). All zeros when $OGG_ARENA is "0", which
+ * leaves libogg on plain malloc().
+ *
+ * @return {Object}
+ * @api public
+ */
+
+exports.memoryStats = function () {
+  return binding.arena_stats();
+};
+
+/**
+ * Finds out the streams of the ogg file at `path` and their extent without
+ * reading through it: the BOS pages at the start of the file name the streams,
+ * and their last pages are looked for from the end of the file backwards. For
+ * each stream, `fn` gets its `serialno`, `firstGranulepos` and
+ * `lastGranulepos`, the number of `pages` according to their page numbers,
+ * the `bytes` from its first page to the end of its last one, and whether the
+ * last page seen was the `eos` one. Along with the file's `size` and the
+ * number of bytes it took (`bytesRead`).
+ *
+ * @param {String} path ogg file
+ * @param {Function} fn callback function
+ * @api public
+ */
+
+exports.probe = function (path, fn) {
+  binding.probe(path, fn);
+};
@@ -1 +1,44 @@
-module.exports = require('bindings')('ogg');
+var binding = module.exports = require('bindings')('ogg');
+
+/**
+ * libogg calls involving fewer than this many bytes get run synchronously on
+ * the main thread, since the trip to the thread pool costs more than the call
+ * itself. Set to 0 to always use the thread pool.
+ *
+ * @api public
+ */
+
+binding.syncThreshold = 8192;
+
+/**
+ * Returns the "_sync" variant of the binding function `name` when `bytes` is
+ * below `threshold` (defaults to `binding.syncThreshold`), or the thread pool
+ * variant otherwise. Both variants take the same arguments and callback.
+ *
+ * @param {String} name binding function name, i.e. "ogg_stream_packetout"
+ * @param {Number} bytes number of bytes the call is expected to touch
+ * @param {Number} threshold (optional) overrides `binding.syncThreshold`
+ * @return {Function} the binding function to invoke
+ * @api private
+ */
+
+binding.dispatch = function (name, bytes, threshold) {
+  if (null == threshold) threshold = binding.syncThreshold;
+  return bytes < threshold ? binding[name + '_sync'] : binding[name];
+};
+
+/**
+ * Returns the number of bytes to `dispatch()` a single `ogg_sync_pageout()`,
+ * `ogg_stream_pageout()` or the like on: it only touches about one page's
+ * worth, however many more bytes are `buffered`. `last` is the size of the
+ * previous page, and libogg's 4096 byte target until there is one.
+ *
+ * @param {Number} buffered number of bytes buffered in the state
+ * @param {Number} last (optional) size of the last page read out
+ * @return {Number}
+ * @api private
+ */
+
+binding.pageBytes = function (buffered, last) {
+  return Math.min(buffered, last || 4096);
+};
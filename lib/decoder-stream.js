@@ -26,8 +26,8 @@ module.exports = DecoderStream;
  * @api private
  */
 
-function DecoderStream (serialno) {
-  if (!(this instanceof DecoderStream)) return new DecoderStream(serialno);
+function DecoderStream (serialno, os) {
+  if (!(this instanceof DecoderStream)) return new DecoderStream(serialno, os);
   Readable.call(this, { objectMode: true, highWaterMark: 0 });
 
   // array of `ogg_packet` instances to output for the _read() function
@@ -35,14 +35,33 @@ function DecoderStream (serialno) {
 
   this.serialno = serialno;
 
-  this.os = new Buffer(binding.sizeof_ogg_stream_state);
-  var r = binding.ogg_stream_init(this.os, serialno);
-  if (0 !== r) {
-    throw new Error('ogg_stream_init() failed: ' + r);
-  }
+  // set by the `Decoder`, see `binding.dispatch()`
+  this._syncThreshold = null;
+
+  // `os` was already initialized by the Decoder's demux call
+  this.os = os || new binding.OggStreamState(serialno);
+
+  // set once the EOS packet was pushed, nothing more goes into this stream
+  this.ended = false;
+
+  // all the packets have been copied out by the time the stream ends
+  this.once('end', function () {
+    this.os.destroy();
+  });
 }
 inherits(DecoderStream, Readable);
 
+/**
+ * `stream.destroy()` hook, frees the `ogg_stream_state`.
+ *
+ * @api private
+ */
+
+DecoderStream.prototype._destroy = function (err, fn) {
+  this.os.destroy();
+  fn(err);
+};
+
 /**
  * We have to overwrite the "on()" function to reinterpret "packet" event names as
  * "data" event names. Attaching a "packet" event listener will put the stream
@@ -89,31 +108,41 @@ DecoderStream.prototype.removeListener = function (ev, fn) {
 DecoderStream.prototype.pagein = function (page, packets, fn) {
   debug('pagein(%d packets)', packets);
 
+  if (page.recycled) {
+    return fn(new Error('pagein() called with an `ogg_page` that was recycled'));
+  }
+
   var os = this.os;
   var self = this;
   var packet;
 
-  binding.ogg_stream_pagein(os, page, afterPagein);
+  // the packets are read out of the page's body, so its size decides whether
+  // the calls are worth a trip to the thread pool
+  var pagein = binding.dispatch('ogg_stream_pagein', page.bytes, this._syncThreshold);
+  var packetout = binding.dispatch('ogg_stream_packetout', page.bytes, this._syncThreshold);
+
+  // the header was already decoded into `page.desc` by the Decoder
+  pagein(os, page, page.desc || null, afterPagein);
   function afterPagein (r) {
     if (0 === r) {
       // `ogg_page` has been submitted, now emit a "page" event
       self.emit('page', page);
 
       // now read out the packets and push them onto this Readable stream
-      packetout();
+      next();
     } else {
       fn(new Error('ogg_stream_pagein() error: ' + r));
     }
   }
 
-  function packetout () {
+  function next () {
     debug('packetout(), %d packets left', packets);
     if (0 === packets) {
       // no more packets to read out, we're done...
       fn();
     } else {
       packet = new ogg_packet();
-      binding.ogg_stream_packetout(os, packet, afterPacketout);
+      packetout(os, packet, afterPacketout);
     }
   }
 
@@ -127,31 +156,81 @@ DecoderStream.prototype.pagein = function (page, packets, fn) {
       // the `packet` Buffer is *completely* managed by the JS garbage collector
       packet.replace();
 
-      if (b_o_s) {
-        self.emit('bos');
-      }
-      packet._callback = afterPacketRead;
-      self.packets.push(packet);
-      self.emit('_packet');
+      self._packet(packet, afterPacketRead);
     } else if (-1 === rtn) {
       // libogg issued a sync warning, usually recoverable, try it again.
       // http://xiph.org/ogg/doc/libogg/ogg_stream_packetout.html
-      packetout();
+      next();
     } else { // libogg returned an unrecoverable error
       fn(new Error('ogg_stream_packetout() error: ' + rtn));
     }
   }
 
+  function afterPacketRead (err) {
+    if (err) return fn(err);
+    --packets;
+    // read out the next packet from the stream
+    next();
+  }
+};
+
+/**
+ * Emits a "page" event for `page`, and then pushes the given `ogg_packet`
+ * instances onto this Readable stream one at a time. The packets were already
+ * read out of the `ogg_stream_state` by the Decoder's demux call.
+ * Internal function used by the `Decoder` class.
+ *
+ * @param {Buffer} page `ogg_page` instance
+ * @param {Array} packets `ogg_packet` Buffer instances that were in the page
+ * @param {Function} fn callback function
+ * @api private
+ */
+
+DecoderStream.prototype.deliver = function (page, packets, fn) {
+  debug('deliver(%d packets)', packets.length);
+
+  var self = this;
+  var index = 0;
+
+  this.emit('page', page);
+  next();
+
+  function next (err) {
+    if (err) return fn(err);
+    if (index === packets.length) return fn();
+    self._packet(ogg_packet(packets[index++]), next);
+  }
+};
+
+/**
+ * Queues `packet` up to be output by the `_read()` function, emitting the
+ * "bos" and "eos" events as appropriate. `fn` is called once the packet has
+ * been read.
+ *
+ * @param {Buffer} packet `ogg_packet` instance
+ * @param {Function} fn callback function
+ * @api private
+ */
+
+DecoderStream.prototype._packet = function (packet, fn) {
+  var self = this;
+
+  if (packet.b_o_s) {
+    this.emit('bos');
+  }
+  packet._callback = afterPacketRead;
+  this.packets.push(packet);
+  this.emit('_packet');
+
   function afterPacketRead (err) {
     debug('afterPacketRead(%s)', err);
     if (err) return fn(err);
     if (packet.e_o_s) {
       self.emit('eos');
+      self.ended = true;
       self.push(null); // emit "end"
     }
-    --packets;
-    // read out the next packet from the stream
-    packetout();
+    fn();
   }
 };
 
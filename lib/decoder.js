@@ -8,6 +8,8 @@ var binding = require('./binding');
 var inherits = require('util').inherits;
 var Writable = require('stream').Writable;
 var DecoderStream = require('./decoder-stream');
+var ogg_page_desc = require('./page-desc');
+var StructPool = require('./struct-pool');
 
 // node v0.8.x compat
 if (!Writable) Writable = require('readable-stream/writable');
@@ -24,6 +26,30 @@ module.exports = Decoder;
  * "packet" events with the raw `ogg_packet` instance to send to an ogg stream
  * decoder (like Vorbis, Theora, etc.).
  *
+ * "page" events hand out each `ogg_page` struct along with its `desc`. Both are
+ * only valid during the event: the struct points into the `ogg_sync_state`'s
+ * buffer, which the next write reuses and "finish" frees, and the structs
+ * themselves get recycled. Copy out whatever is needed before returning.
+ *
+ * Options:
+ *
+ *   - `batch` - when `false`, every libogg call makes its own trip to the thread
+ *               pool, rather than demuxing each written chunk in one (default `true`)
+ *   - `syncThreshold` - libogg calls touching fewer bytes than this are run
+ *                       synchronously (default `ogg.syncThreshold`)
+ *   - `slabs` - when `true`, the data of packets contained in a single page
+ *               points into a shared copy of the page body instead of each
+ *               packet getting its own copy. Note that holding on to any of
+ *               them keeps the whole page in memory (default `false`)
+ *   - `maxPacketSize` - size of the largest packet the streams are expected to
+ *                       hold, so that their buffers can be sized for it up
+ *                       front rather than grown as the packet arrives
+ *   - `verify` - which page checksums get verified: `true` for all of them,
+ *                a Number `n` for 1 in every `n` pages, or `false` for none.
+ *                Only for input that's known to be intact, such as files we
+ *                wrote ourselves; the first page after a hole is verified
+ *                regardless (default `true`)
+ *
  * @param {Object} opts Writable stream options
  * @api public
  */
@@ -32,11 +58,44 @@ function Decoder (opts) {
   if (!(this instanceof Decoder)) return new Decoder(opts);
   Writable.call(this, opts);
 
-  this.oy = new Buffer(binding.sizeof_ogg_sync_state);
-  var r = binding.ogg_sync_init(this.oy);
-  if (0 !== r) {
-    throw new Error('ogg_sync_init() failed: ' + r);
+  this.oy = new binding.OggSyncState();
+
+  // array of `DecoderStream` instances, in the order they were encountered
+  this._streams = [];
+
+  this._batch = !(opts && false === opts.batch);
+  this._syncThreshold = opts ? opts.syncThreshold : null;
+  this._slabs = !!(opts && opts.slabs);
+  this._maxPacketSize = opts && opts.maxPacketSize || 0;
+
+  var verify = opts && null != opts.verify ? opts.verify : true;
+  if (true !== verify) {
+    var r = binding.ogg_sync_set_verify(this.oy, false === verify ? 0 : verify);
+    if (0 !== r) throw new Error('ogg_sync_set_verify() error: ' + r);
   }
+  // checksum counters, once the `ogg_sync_state` is gone
+  this._checksums = null;
+
+  // whether a chunk (or `wrote()`) is being demuxed, whether `buffer()` handed
+  // out the fill mark of the `ogg_sync_state`, which writing would move, and
+  // the writes waiting for both to be over
+  this._writing = false;
+  this._reserved = false;
+  this._waiting = [];
+
+  // size of the last page read out, and the bytes `_writeEach()` left in the
+  // `ogg_sync_state`, which decide whether a pageout is worth a trip to the
+  // thread pool
+  this._pageBytes = 0;
+  this._buffered = 0;
+
+  // recycled `ogg_page` and `ogg_page_desc` structs for `_writeEach()`
+  this._pages = new StructPool(binding.sizeof_ogg_page);
+  this._descs = new StructPool(binding.sizeof_ogg_page_desc);
+
+  // nothing gets written after "finish", so free the `ogg_sync_state` right away
+  // rather than waiting for the GC to get to it
+  this.once('finish', this._free);
 }
 inherits(Decoder, Writable);
 
@@ -54,21 +113,210 @@ Decoder.prototype._write = function (chunk, encoding, done) {
   // XXX: compat for old Writable API... remove at some point...
   if ('function' == typeof encoding) done = encoding;
 
-  // allocate space for 1 `ogg_page`
-  // XXX: we could do this at the per-decoder level, since only 1 ogg_page is
-  // active (being processed by an ogg decoder) at a time
+  var self = this;
+  this._exclusive(function (release) {
+    function fn (err) {
+      release();
+      done(err);
+    }
+    if (self._batch) {
+      self._demux(chunk, chunk.length, fn);
+    } else {
+      self._writeEach(chunk, fn);
+    }
+  });
+};
+
+/**
+ * Runs `task` once no other write is using the `ogg_sync_state`, and no
+ * `buffer()` is waiting for its `wrote()`, or queues it until then. `task` gets
+ * a function to call when it's done with the `ogg_sync_state`.
+ *
+ * @param {Function} task
+ * @api private
+ */
+
+Decoder.prototype._exclusive = function (task) {
+  if (this._writing || this._reserved) {
+    debug('_exclusive(): waiting');
+    this._waiting.push(task);
+    return;
+  }
+  var self = this;
+  this._writing = true;
+  task(function () {
+    self._writing = false;
+    self._next();
+  });
+};
+
+/**
+ * Runs the next task `_exclusive()` queued up, if it can run now.
+ *
+ * @api private
+ */
+
+Decoder.prototype._next = function () {
+  if (this._writing || this._reserved || !this._waiting.length) return;
+  this._exclusive(this._waiting.shift());
+};
+
+/**
+ * Returns a writable Buffer of `size` bytes that points directly into the
+ * `ogg_sync_state`'s internal buffer, so that `fs.read()` and friends can land
+ * data there without it having to be copied again. Call `wrote()` with the
+ * number of bytes actually read to submit them.
+ *
+ * Throws while a write is still in progress. Writes made between `buffer()`
+ * and `wrote()` (or `unbuffer()`) wait for the latter, and the returned Buffer
+ * is only valid until then.
+ *
+ * @param {Number} size number of bytes to make room for
+ * @return {Buffer} view over the `ogg_sync_state`'s buffer
+ * @api public
+ */
+
+Decoder.prototype.buffer = function (size) {
+  debug('buffer(%d bytes)', size);
+  if (this._writing) throw new Error('buffer() called while a write is in progress');
+  var buffer = binding.ogg_sync_buffer(this.oy, size);
+  this._reserved = true;
+  return buffer;
+};
+
+/**
+ * Submits `bytes` bytes that were written into the Buffer returned by
+ * `buffer()`, and demuxes them the same way `write()` would, after any write
+ * still in progress.
+ *
+ * @param {Number} bytes number of bytes written into the `buffer()` Buffer
+ * @param {Function} fn callback function
+ * @api public
+ */
+
+Decoder.prototype.wrote = function (bytes, fn) {
+  debug('wrote(%d bytes)', bytes);
+  var self = this;
+  this._reserved = false;
+  this._exclusive(function (release) {
+    var r = binding.ogg_sync_wrote(self.oy, bytes);
+    if (0 !== r) {
+      release();
+      return fn(new Error('ogg_sync_wrote() error: ' + r));
+    }
+    self._demux(null, bytes, function (err) {
+      release();
+      fn(err);
+    });
+  });
+};
+
+/**
+ * Gives up on the Buffer returned by `buffer()` without submitting anything,
+ * letting the writes that were waiting for `wrote()` go ahead.
+ *
+ * @api public
+ */
+
+Decoder.prototype.unbuffer = function () {
+  debug('unbuffer()');
+  this._reserved = false;
+  this._next();
+};
+
+/**
+ * Writes `chunk` to the `ogg_sync_state` and reads out all the resulting pages
+ * and packets with a single native call. The pages are then handed to their
+ * DecoderStreams one by one. `chunk` may be `null` when the data was already
+ * submitted through `wrote()`.
+ *
+ * @param {Buffer} chunk
+ * @param {Number} length number of new bytes
+ * @param {Function} done
+ * @api private
+ */
+
+Decoder.prototype._demux = function (chunk, length, done) {
+  debug('_demux(%d bytes)', length);
+
+  var self = this;
+  var serialnos = [];
+  var states = [];
+  for (var i = 0; i < this._streams.length; i++) {
+    // streams that have already ended take no more pages, and may not even
+    // have an `ogg_stream_state` anymore
+    if (this._streams[i].ended || this._streams[i].os.destroyed) continue;
+    serialnos.push(this._streams[i].serialno);
+    states.push(this._streams[i].os);
+  }
+
+  var demux = binding.dispatch('ogg_sync_demux', length, this._syncThreshold);
+  demux(this.oy, chunk, chunk ? length : 0, serialnos, states, this._slabs,
+    this._maxPacketSize, afterDemux);
+  function afterDemux (rtn, failed, pages) {
+    debug('afterDemux(%d, %s, %d pages)', rtn, failed, pages.length);
+    var index = 0;
+    next();
+
+    function next (err) {
+      if (err) return done(err);
+      if (index === pages.length) {
+        if (failed) {
+          done(new Error(failed + '() error: ' + rtn));
+        } else {
+          done();
+        }
+        return;
+      }
+
+      var p = pages[index++];
+      var page = p.page;
+      var desc = page.desc = ogg_page_desc(p.desc);
+      page.serialno = desc.serialno;
+      page.packets = desc.packets;
+      self.emit('page', page);
+      var stream = self._stream(desc.serialno, p.os);
+
+      if (index === pages.length && 'ogg_stream_pagein' === failed) {
+        // the last page never made it into the `ogg_stream_state`
+        return next();
+      }
+      stream.deliver(page, p.out, next);
+    }
+  }
+};
+
+/**
+ * Writes `chunk` to the `ogg_sync_state`, and then reads out the pages one by
+ * one, each libogg call being its own trip to the thread pool.
+ *
+ * @param {Buffer} chunk
+ * @param {Function} done
+ * @api private
+ */
+
+Decoder.prototype._writeEach = function (chunk, done) {
+  debug('_writeEach(%d bytes)', chunk.length);
+
+  // only 1 `ogg_page` is active (being processed by an ogg decoder) at a time,
+  // and it goes back to the pool once this chunk is done. "page" event
+  // listeners must not hold on to it
   var stream;
   var self = this;
   var oy = this.oy;
-  var page = new Buffer(binding.sizeof_ogg_page);
+  var pages = this._pages;
+  var page = pages.acquire();
+  var desc = ogg_page_desc(this._descs.acquire());
+  var threshold = this._syncThreshold;
+  this._buffered += chunk.length;
 
-  binding.ogg_sync_write(oy, chunk, chunk.length, afterWrite);
+  binding.dispatch('ogg_sync_write', chunk.length, threshold)(oy, chunk, chunk.length, afterWrite);
   function afterWrite (rtn) {
     debug('after _write(%d)', rtn);
     if (0 === rtn) {
       pageout();
     } else {
-      done(new Error('ogg_sync_write() error: ' + rtn));
+      finish(new Error('ogg_sync_write() error: ' + rtn));
     }
   }
 
@@ -76,50 +324,124 @@ Decoder.prototype._write = function (chunk, encoding, done) {
     debug('pageout()');
     page.serialno = null;
     page.packets = null;
-    binding.ogg_sync_pageout(oy, page, afterPageout);
+    page.bytes = null;
+    page.desc = null;
+    var bytes = binding.pageBytes(self._buffered, self._pageBytes);
+    binding.dispatch('ogg_sync_pageout', bytes, threshold)(oy, page, desc, afterPageout);
   }
 
-  function afterPageout (rtn, serialno, packets) {
-    debug('afterPageout(%d, %d, %d)', rtn, serialno, packets);
+  function afterPageout (rtn, serialno, packets, bytes, buffered) {
+    debug('afterPageout(%d, %d, %d, %d, %d)', rtn, serialno, packets, bytes, buffered);
+    self._buffered = buffered;
     if (1 === rtn) {
+      self._pageBytes = bytes;
+
       // got a page, now write it to the appropriate DecoderStream
       page.serialno = serialno;
       page.packets = packets;
+      page.bytes = bytes;
+      page.desc = desc;
       self.emit('page', page);
       stream = self._stream(serialno);
       stream.pagein(page, packets, afterPagein);
     } else if (0 === rtn) {
       // need more data
-      done();
+      finish();
     } else {
       // something bad...
-      done(new Error('ogg_sync_pageout() error: ' + rtn));
+      finish(new Error('ogg_sync_pageout() error: ' + rtn));
     }
   }
 
   function afterPagein (err) {
     debug('afterPagein(%s)', err);
-    if (err) return done(err);
+    if (err) return finish(err);
     // attempt to read out the next page from the `ogg_sync_state`
     pageout();
   }
+
+  function finish (err) {
+    page.desc = null;
+    pages.release(page);
+    self._descs.release(desc);
+    done(err);
+  }
+};
+
+/**
+ * Returns the number of pages whose checksum was verified, and the number of
+ * pages that were let through without it (see the `verify` option), as
+ * `verified` and `skipped`. Must not be called while a write is in progress.
+ *
+ * @return {Object} checksum counters
+ * @api public
+ */
+
+Decoder.prototype.checksums = function () {
+  return this._checksums || binding.ogg_sync_stats(this.oy);
+};
+
+/**
+ * Frees the `ogg_sync_state`, along with the `ogg_stream_state` of every
+ * DecoderStream. Any libogg call still in progress finishes first. The
+ * `ogg_page` structs "page" events handed out point into freed memory after
+ * this.
+ *
+ * @api private
+ */
+
+Decoder.prototype._free = function () {
+  debug('_free()');
+  if (!this.oy.destroyed) this._checksums = binding.ogg_sync_stats(this.oy);
+  this.oy.destroy();
+  for (var i = 0; i < this._streams.length; i++) {
+    this._streams[i].os.destroy();
+  }
+};
+
+/**
+ * `stream.destroy()` hook, frees the libogg state.
+ *
+ * @api private
+ */
+
+Decoder.prototype._destroy = function (err, fn) {
+  this._free();
+  fn(err);
 };
 
 /**
  * Gets an DecoderStream instance for the given "serialno".
- * Creates one if necessary, and then emits a "stream" event.
+ * Creates one if necessary, or if the one it had has ended, and then emits a
+ * "stream" event.
  *
  * @param {Number} serialno The serial number of the ogg_stream.
+ * @param {OggStreamState} os (optional) already initialized `ogg_stream_state` to use
  * @return {DecoderStream} an DecoderStream for the given serial number.
  * @api private
  */
 
-Decoder.prototype._stream = function (serialno) {
+Decoder.prototype._stream = function (serialno, os) {
   debug('_stream(%d)', serialno);
   var stream = this[serialno];
+  if (stream && stream.ended) {
+    // a new stream reusing the serial number of one that ended, i.e. the next
+    // link of a chained file. All of the old one's packets were copied out
+    debug('_stream(%d): replacing ended stream', serialno);
+    this._streams.splice(this._streams.indexOf(stream), 1);
+    stream.os.destroy();
+    stream = null;
+  }
   if (!stream) {
-    stream = new DecoderStream(serialno);
+    stream = new DecoderStream(serialno, os);
+    stream._syncThreshold = this._syncThreshold;
+    // a state made by the demux call has been sized already. Should this run
+    // out of memory, the state is unusable and the next pagein reports it
+    if (!os && this._maxPacketSize) {
+      binding.ogg_stream_reserve(stream.os, this._maxPacketSize);
+    }
     this[serialno] = stream;
+    this._streams.push(stream);
     this.emit('stream', stream);
   }
   return stream;
@@ -5,6 +5,8 @@
 
 var debug = require('debug')('ogg:encoder-stream');
 var binding = require('./binding');
+var ogg_packet = require('./packet');
+var StructPool = require('./struct-pool');
 var inherits = require('util').inherits;
 var Writable = require('stream').Writable;
 
@@ -23,27 +25,77 @@ module.exports = EncoderStream;
  * `EncoderStream` manually, instead, instances are returned from the
  * `Encoder#stream()` function.
  *
+ * Options:
+ *
+ *   - `syncThreshold` - libogg calls touching fewer bytes than this are run
+ *                       synchronously (default `ogg.syncThreshold`)
+ *
+ *   - `maxPacketSize` - size of the largest packet that is going to be written,
+ *                       so that the stream's buffers can be sized for it up
+ *                       front rather than grown as packets come in
+ *
+ *   - `zeroCopy` - reference the packet Buffers instead of copying them into
+ *                  libogg, and output each page as its header followed by
+ *                  slices of those Buffers. They must not be modified once
+ *                  written (default `false`)
+ *
+ * @param {Number} serialno The serial number of the stream, null/undefined means random.
+ * @param {Object} opts (optional) options object
  * @api private
  */
 
-function EncoderStream (serialno) {
-  if (!(this instanceof EncoderStream)) return new EncoderStream(serialno);
+function EncoderStream (serialno, opts) {
+  if (!(this instanceof EncoderStream)) return new EncoderStream(serialno, opts);
   Writable.call(this, { objectMode: true, highWaterMark: 0 });
 
+  this._syncThreshold = opts ? opts.syncThreshold : null;
+  this._zeroCopy = !!(opts && opts.zeroCopy);
+
+  // with `zeroCopy`, the packet Buffers libogg references that haven't been
+  // paged out yet, oldest first, and how much of the first one has been
+  this._refs = [];
+  this._refOffset = 0;
+
+  // number of packet bytes submitted that haven't been output in a page yet,
+  // and the size of the last page output
+  this._buffered = 0;
+  this._pageBytes = 0;
+
+  // recycled `ogg_page` structs for `_pageout()` and `_flush()`. "page" event
+  // listeners must be done with the page by the time they return
+  this._pages = new StructPool(binding.sizeof_ogg_page);
+
   if (null == serialno) {
     // TODO: better random serial number algo
     serialno = Math.random() * 1000000 | 0;
     debug('generated random serial number: %d', serialno);
   }
   this.serialno = serialno;
-  this.os = new Buffer(binding.sizeof_ogg_stream_state);
-  var r = binding.ogg_stream_init(this.os, serialno);
-  if (0 !== r) {
-    throw new Error('ogg_stream_init() failed: ' + r);
+  this.os = new binding.OggStreamState(serialno);
+  if (opts && opts.maxPacketSize) {
+    var r = binding.ogg_stream_reserve(this.os, opts.maxPacketSize);
+    if (0 !== r) throw new Error('ogg_stream_reserve() error: ' + r);
   }
+
+  // free the `ogg_stream_state` once `end()` has been called and every write is
+  // done, rather than waiting for the GC to get to it
+  this.once('finish', function () {
+    this.os.destroy();
+  });
 }
 inherits(EncoderStream, Writable);
 
+/**
+ * `stream.destroy()` hook, frees the `ogg_stream_state`.
+ *
+ * @api private
+ */
+
+EncoderStream.prototype._destroy = function (err, fn) {
+  this.os.destroy();
+  fn(err);
+};
+
 /**
  * Overwrite the default .write() function to allow for `ogg_packet` ref-struct
  * instances to be passed in directly.
@@ -64,6 +116,28 @@ EncoderStream.prototype.write = function (packet) {
 };
 EncoderStream.prototype.packetin = EncoderStream.prototype.write;
 
+/**
+ * Submits an Array of packets followed by an `ogg_stream_pageout()` request,
+ * all of which are handled in a single call to libogg. Each packet is either an
+ * `ogg_packet` Buffer, or an object with a `packet` Buffer (or an Array of
+ * Buffer fragments, which get concatenated by libogg without a copy in JS),
+ * and `e_o_s` and `granulepos` fields.
+ *
+ * @param {Array} packets Array of packets to submit
+ * @param {Function} fn callback function
+ * @api public
+ */
+
+EncoderStream.prototype.packetinMany = function (packets, fn) {
+  debug('packetinMany(%d packets)', packets.length);
+  packets = packets.map(function (packet) {
+    // meh... hacky check for ref-struct instance
+    if (!Buffer.isBuffer(packet) && packet.ref && 'e_o_s' in packet) return packet.ref();
+    return packet;
+  });
+  return this.write.call(this, { packets: packets, pageout: true }, fn);
+};
+
 /**
  * Request that `ogg_stream_pageout()` be called on this stream.
  *
@@ -106,7 +180,14 @@ EncoderStream.prototype._write = function (packet, encoding, fn) {
   if ('function' == typeof encoding) fn = encoding;
 
   var self = this;
-  if (Buffer.isBuffer(packet)) {
+  if (this._zeroCopy) {
+    // everything goes through `ogg_stream_iovecin()`, which can reference
+    var packets = packet.packets || (Buffer.isBuffer(packet) ? [ packet ] : []);
+    this._packetinMany(packets, mode(packet), fn);
+  } else if (packet.packets) {
+    // batch from `packetinMany()`
+    this._packetinMany(packet.packets, mode(packet), fn);
+  } else if (Buffer.isBuffer(packet)) {
     // assumed to be an `ogg_packet` Buffer instance
     this._packetin(packet, checkCommand);
   } else {
@@ -126,6 +207,147 @@ EncoderStream.prototype._write = function (packet, encoding, fn) {
   }
 };
 
+/**
+ * Writable stream _writev() callback function.
+ * Packets queued up while a previous write was in progress are submitted to
+ * libogg in batches, each batch ending at a "pageout"/"flush" command.
+ *
+ * @param {Array} chunks Array of `{ chunk: packet }` objects
+ * @param {Function} fn callback function
+ * @api private
+ */
+
+EncoderStream.prototype._writev = function (chunks, fn) {
+  debug('_writev(%d chunks)', chunks.length);
+  var self = this;
+  var i = 0;
+  next();
+  function next (err) {
+    if (err) return fn(err);
+    if (i === chunks.length) return fn();
+    var packets = [];
+    var command = null;
+    while (i < chunks.length) {
+      var chunk = chunks[i++].chunk;
+      if (chunk.packets) {
+        packets.push.apply(packets, chunk.packets);
+      } else if (Buffer.isBuffer(chunk)) {
+        packets.push(chunk);
+      }
+      if (chunk.flush || chunk.pageout) {
+        command = chunk;
+        break;
+      }
+    }
+    self._packetinMany(packets, mode(command), next);
+  }
+};
+
+/**
+ * Returns the `ogg_stream_iovecin()` binding mode for the "pageout"/"flush"
+ * command in `packet`.
+ *
+ * @api private
+ */
+
+function mode (packet) {
+  if (packet && packet.flush) return binding.IOVECIN_FLUSH;
+  if (packet && packet.pageout) return binding.IOVECIN_PAGEOUT;
+  return binding.IOVECIN_NONE;
+}
+
+/**
+ * Returns the number of packet bytes in `packet`, which is either an
+ * `ogg_packet` Buffer or a `packetinMany()` packet object.
+ *
+ * @api private
+ */
+
+function packetBytes (packet) {
+  if (Buffer.isBuffer(packet)) return ogg_packet.bytes(packet);
+  var data = packet.packet;
+  if (!Array.isArray(data)) return data.length;
+  var bytes = 0;
+  for (var i = 0; i < data.length; i++) bytes += data[i].length;
+  return bytes;
+}
+
+/**
+ * Calls `ogg_stream_iovecin()` for each packet in `packets`, followed by the
+ * `ogg_stream_pageout()` or `ogg_stream_flush()` loop requested by `mode`,
+ * in a single binding call.
+ *
+ * @api private
+ */
+
+EncoderStream.prototype._packetinMany = function (packets, mode, fn) {
+  debug('_packetinMany(%d packets, mode=%d)', packets.length, mode);
+  if (this._zeroCopy) {
+    packets = packets.map(this._reference, this);
+    mode |= binding.IOVECIN_REF;
+  }
+  for (var i = 0; i < packets.length; i++) {
+    this._buffered += packetBytes(packets[i]);
+  }
+  var self = this;
+  var iovecin = binding.dispatch('ogg_stream_iovecin', this._buffered, this._syncThreshold);
+  iovecin(this.os, packets, mode, function (rtn, pages, e_o_s, bytes, lengths) {
+    debug('ogg_stream_iovecin() return = %d (pages=%d) (eos=%s)', rtn, pages.length, e_o_s);
+    self._buffered -= bytes;
+    if (self._zeroCopy) pages = self._slice(pages, lengths);
+    if (pages.length) self.emit('pages', self, pages, e_o_s);
+    if (0 === rtn) {
+      fn();
+    } else {
+      fn(new Error(rtn));
+    }
+  });
+};
+
+/**
+ * Turns `packet` into a `packetinMany()` object whose Buffers libogg can
+ * reference, and queues them up to be sliced into page bodies.
+ *
+ * @api private
+ */
+
+EncoderStream.prototype._reference = function (packet) {
+  if (Buffer.isBuffer(packet)) packet = ogg_packet.detach(packet);
+  var data = Array.isArray(packet.packet) ? packet.packet : [ packet.packet ];
+  for (var i = 0; i < data.length; i++) {
+    if (data[i].length) this._refs.push(data[i]);
+  }
+  return packet;
+};
+
+/**
+ * Splices the page `headers` from a `zeroCopy` call to `ogg_stream_iovecin()`
+ * with the slices of the referenced packet Buffers making up their bodies,
+ * which are `lengths` bytes long. Returns the flat Array of Buffers.
+ *
+ * @api private
+ */
+
+EncoderStream.prototype._slice = function (headers, lengths) {
+  var out = [];
+  for (var i = 0; i < headers.length; i++) {
+    out.push(headers[i]);
+    var left = lengths[i];
+    while (left > 0) {
+      var buf = this._refs[0];
+      var end = Math.min(buf.length, this._refOffset + left);
+      out.push(buf.slice(this._refOffset, end));
+      left -= end - this._refOffset;
+      this._refOffset = end;
+      if (end === buf.length) {
+        this._refs.shift();
+        this._refOffset = 0;
+      }
+    }
+  }
+  return out;
+};
+
 /**
  * Calls `ogg_stream_packetin()`.
  *
@@ -134,7 +356,12 @@ EncoderStream.prototype._write = function (packet, encoding, fn) {
 
 EncoderStream.prototype._packetin = function (packet, fn) {
   debug('_packetin()');
-  binding.ogg_stream_packetin(this.os, packet, function (rtn) {
+  // `packet` may be a plain Buffer (i.e. from `ref-struct`), so it might not
+  // have the `ogg_packet` getters
+  var bytes = ogg_packet.bytes(packet);
+  this._buffered += bytes;
+  var packetin = binding.dispatch('ogg_stream_packetin', bytes, this._syncThreshold);
+  packetin(this.os, packet, function (rtn) {
     debug('ogg_stream_packetin() return = %d', rtn);
     if (0 === rtn) {
       fn();
@@ -153,14 +380,21 @@ EncoderStream.prototype._packetin = function (packet, fn) {
 EncoderStream.prototype._pageout = function (fn) {
   debug('_pageout()');
   var os = this.os;
-  var og = new Buffer(binding.sizeof_ogg_page);
+  var og = this._pages.acquire();
   var self = this;
-  binding.ogg_stream_pageout(os, og, function (rtn, hlen, blen, e_o_s) {
+  var bytes = binding.pageBytes(this._buffered, this._pageBytes);
+  var pageout = binding.dispatch('ogg_stream_pageout', bytes, this._syncThreshold);
+  pageout(os, og, function (rtn, hlen, blen, e_o_s) {
     debug('ogg_stream_pageout() return = %d (hlen=%s) (blen=%s) (eos=%s)', rtn, hlen, blen, e_o_s);
+    if (0 !== rtn) {
+      self._buffered -= blen;
+      self._pageBytes = hlen + blen;
+      self.emit('page', self, og, hlen, blen, e_o_s);
+    }
+    self._pages.release(og);
     if (0 === rtn) {
       fn();
     } else {
-      self.emit('page', self, og, hlen, blen, e_o_s);
       self._pageout(fn);
     }
   });
@@ -175,14 +409,21 @@ EncoderStream.prototype._pageout = function (fn) {
 EncoderStream.prototype._flush = function (fn) {
   debug('_flush()');
   var os = this.os;
-  var og = new Buffer(binding.sizeof_ogg_page);
+  var og = this._pages.acquire();
   var self = this;
-  binding.ogg_stream_flush(os, og, function (rtn, hlen, blen, e_o_s) {
+  var bytes = binding.pageBytes(this._buffered, this._pageBytes);
+  var flush = binding.dispatch('ogg_stream_flush', bytes, this._syncThreshold);
+  flush(os, og, function (rtn, hlen, blen, e_o_s) {
     debug('ogg_stream_flush() return = %d (hlen=%s) (blen=%s) (eos=%s)', rtn, hlen, blen, e_o_s);
+    if (0 !== rtn) {
+      self._buffered -= blen;
+      self._pageBytes = hlen + blen;
+      self.emit('page', self, og, hlen, blen, e_o_s);
+    }
+    self._pages.release(og);
     if (0 === rtn) {
       fn();
     } else {
-      self.emit('page', self, og, hlen, blen, e_o_s);
       self._flush(fn);
     }
   });
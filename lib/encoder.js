@@ -3,9 +3,11 @@
  * Module dependencies.
  */
 
+var fs = require('fs');
 var debug = require('debug')('ogg:encoder');
 var binding = require('./binding');
 var EncoderStream = require('./encoder-stream');
+var SkeletonWriter = require('./skeleton-writer');
 var inherits = require('util').inherits;
 var Readable = require('stream').Readable;
 
@@ -21,6 +23,28 @@ module.exports = Encoder;
 /**
  * The `Encoder` class.
  * Welds one or more `EncoderStream` instances into a single bitstream.
+ *
+ * Options:
+ *
+ *   - `syncThreshold` - libogg calls touching fewer bytes than this are run
+ *                       synchronously (default `ogg.syncThreshold`)
+ *
+ *   - `maxPacketSize` - passed on to every `EncoderStream`
+ *
+ *   - `zeroCopy` - passed on to every `EncoderStream`. The output is then made
+ *                  of the page headers and slices of the packet Buffers, as
+ *                  separate chunks, rather than one Buffer per read, so that a
+ *                  destination implementing `_writev()` (sockets, files)
+ *                  writes them out without them ever being copied
+ *
+ *   - `skeleton` - `true`, or the options of a `SkeletonWriter`, to start the
+ *                  output with an Ogg Skeleton 4.0 stream indexing the
+ *                  keyframes of the streams given a track with `stream()`. The
+ *                  index is only complete once `writeSkeleton()` was called on
+ *                  the output file
+ *
+ * @param {Object} opts Readable stream options
+ * @api public
  */
 
 function Encoder (opts) {
@@ -39,6 +63,18 @@ function Encoder (opts) {
   // binded _onpage() call so that we can use it as an event
   // callback function on EncoderStream instances
   this._onpage = this._onpage.bind(this);
+  this._onpages = this._onpages.bind(this);
+
+  this._syncThreshold = opts ? opts.syncThreshold : null;
+  this._maxPacketSize = opts ? opts.maxPacketSize : null;
+  this._zeroCopy = !!(opts && opts.zeroCopy);
+
+  // the Skeleton being added to the output, and its final pages, to be written
+  // over those that went out, once known
+  this._skeleton = opts && opts.skeleton
+    ? new SkeletonWriter('object' == typeof opts.skeleton ? opts.skeleton : null)
+    : null;
+  this._skeletonPages = null;
 }
 inherits(Encoder, Readable);
 
@@ -46,18 +82,33 @@ inherits(Encoder, Readable);
  * Creates a new EncoderStream instance and returns it for the user to begin
  * submitting `ogg_packet` instances to it.
  *
+ * With the `skeleton` option, `track` gives the `fisbone` fields of the stream
+ * (see `Skeleton.parse()`): `granulerateNum`, `granulerateDen` and
+ * `granuleshift`, along with `headerPackets`, `basegranule`, `preroll` and
+ * `messageHeaders` if need be. The number of header packets defaults to the
+ * number of packets on the pages with a granulepos of 0. Streams without a
+ * track are left out of the Skeleton, as are those whose BOS page comes after
+ * a page that isn't one.
+ *
  * @param {Number} serialno The serial number of the stream, null/undefined means random.
+ * @param {Object} track (optional) Skeleton track of the stream
  * @return {EncoderStream} The newly created EncoderStream instance. Call `.packetin()` on it.
  * @api public
  */
 
-Encoder.prototype.stream = function (serialno) {
+Encoder.prototype.stream = function (serialno, track) {
   debug('stream(%d)', serialno);
   var s = this.streams[serialno];
   if (!s) {
-    s = new EncoderStream(serialno);
+    s = new EncoderStream(serialno, {
+      syncThreshold: this._syncThreshold,
+      maxPacketSize: this._maxPacketSize,
+      zeroCopy: this._zeroCopy
+    });
     s.on('page', this._onpage);
+    s.on('pages', this._onpages);
     this.streams[s.serialno] = s;
+    if (this._skeleton && track) this._skeleton.track(s.serialno, track);
   }
   return s;
 };
@@ -86,18 +137,75 @@ Encoder.prototype.use = function (stream) {
 Encoder.prototype._onpage = function (stream, page, header_len, body_len, e_o_s) {
   debug('_onpage()');
 
+  // got a page!
+  var data = new Buffer(header_len + body_len);
+  binding.ogg_page_to_buffer(page, data);
+  this._onpages(stream, [ data ], e_o_s);
+};
+
+/**
+ * Called for each "pages" event from every substream EncoderStream instance,
+ * with pages that have already been flattened into regular node.js Buffers
+ * (or, with `zeroCopy`, split into their header and body slices).
+ *
+ * @api private
+ */
+
+Encoder.prototype._onpages = function (stream, pages, e_o_s) {
+  debug('_onpages(%d pages)', pages.length);
+
   if (e_o_s) {
     // stream is done...
     delete this.streams[stream.serialno];
   }
 
-  // got a page!
-  var data = new Buffer(header_len + body_len);
-  binding.ogg_page_to_buffer(page, data);
-  this._queue.push(data);
+  if (this._skeleton) pages = this._skeleton.write(pages);
+  this._queue.push.apply(this._queue, pages);
   this.emit('_page');
 };
 
+/**
+ * Writes the final Skeleton headers, with the complete keyframe index, over
+ * those at the start of the ogg file at `path` (or behind the file descriptor
+ * `path`), which has to be all of the Encoder's output. Call it once the
+ * output has been written out, i.e. after the Encoder's "end" event, when
+ * the "skeleton" event has handed over the same pages.
+ *
+ * @param {String|Number} path the ogg file, or its file descriptor
+ * @param {Function} fn callback function
+ * @api public
+ */
+
+Encoder.prototype.writeSkeleton = function (path, fn) {
+  debug('writeSkeleton(%j)', path);
+  var pages = this._skeletonPages;
+  if (!pages) {
+    return process.nextTick(function () {
+      fn(new Error('writeSkeleton() called before the end of the output, or without the `skeleton` option'));
+    });
+  }
+  if ('number' == typeof path) return write(path, fn);
+
+  fs.open(path, 'r+', function (err, fd) {
+    if (err) return fn(err);
+    write(fd, function (err) {
+      fs.close(fd, function (e) {
+        fn(err || e);
+      });
+    });
+  });
+
+  function write (fd, fn) {
+    var i = 0;
+    next();
+    function next (err) {
+      if (err || i === pages.length) return fn(err);
+      var page = pages[i++];
+      fs.write(fd, page.data, 0, page.data.length, page.offset, next);
+    }
+  }
+};
+
 /**
  * Readable stream base class `_read()` callback function.
  * Processes the _queue array and attempts to read out any available
@@ -123,16 +231,37 @@ Encoder.prototype._read = function (bytes, done) {
 
   function output () {
     debug('flushing "_queue" (%d entries)', this._queue.length);
-    var buf = Buffer.concat(this._queue);
-    this._queue.splice(0); // empty queue
-
     // check if there's any more streams being processed
     var n = Object.keys(this.streams).length;
     if (n === 0) {
       this._needsEnd = true;
+      if (this._skeleton) this._endSkeleton();
     }
 
-    if (this.push) this.push(buf); // emit "end"
-    else done(null, buf); // XXX: compat for old Readable API... remove soon...
+    var queue = this._queue.splice(0); // empty queue
+
+    if (this.push && this._zeroCopy) {
+      // the pieces go out as they are, for `_writev()` to gather
+      for (var i = 0; i < queue.length; i++) this.push(queue[i]);
+    } else if (this.push) {
+      this.push(Buffer.concat(queue));
+    } else {
+      done(null, Buffer.concat(queue)); // XXX: compat for old Readable API... remove soon...
+    }
   }
 };
+
+/**
+ * Called once every stream is done. Builds the final Skeleton pages, and
+ * emits a "skeleton" event with them, as `{ offset, data }` objects, before
+ * the output ends.
+ *
+ * @api private
+ */
+
+Encoder.prototype._endSkeleton = function () {
+  debug('_endSkeleton()');
+  this._skeletonPages = this._skeleton.end(this._queue);
+  this._skeleton = null;
+  if (this._skeletonPages) this.emit('skeleton', this._skeletonPages);
+};
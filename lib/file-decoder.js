@@ -0,0 +1,352 @@
+/**
+ * Module dependencies.
+ */
+
+var fs = require('fs');
+var debug = require('debug')('ogg:file-decoder');
+var binding = require('./binding');
+var inherits = require('util').inherits;
+var Decoder = require('./decoder');
+var ogg_page_desc = require('./page-desc');
+var skeleton = require('./skeleton');
+
+/**
+ * Module exports.
+ */
+
+module.exports = FileDecoder;
+
+/**
+ * A `Decoder` that reads the ogg file behind the file descriptor `fd` by
+ * itself, rather than having it written to it, so that it can jump around in
+ * the file with `seek()`. Reading starts on the next tick, and the decoder
+ * ends once the end of the file is reached. `fd` is left open.
+ *
+ * Options, on top of those of `Decoder`:
+ *
+ *   - `chunkSize` - number of bytes read at a time (default 65536)
+ *   - `index` - `PageIndex` of the file, which `seek()` looks the page up in
+ *               instead of bisecting the file. Ignored when the file's size
+ *               no longer matches the one it was indexed at
+ *   - `skeleton` - when `false`, `seek()` doesn't look for the keyframe index
+ *                  of an Ogg Skeleton 4.0 stream (default `true`)
+ *
+ * @param {Number} fd file descriptor of the ogg file
+ * @param {Object} opts Decoder options
+ * @api public
+ */
+
+function FileDecoder (fd, opts) {
+  if (!(this instanceof FileDecoder)) return new FileDecoder(fd, opts);
+  Decoder.call(this, opts);
+
+  this.fd = fd;
+
+  // file offset of the next byte to read
+  this.position = 0;
+
+  this._chunkSize = opts && opts.chunkSize || 65536;
+  this._index = opts && opts.index || null;
+
+  // the file's `Skeleton`, `null` if it has none, or `undefined` until looked for
+  this._skeleton = opts && false === opts.skeleton ? null : undefined;
+  this._reading = false;
+
+  // the `seek()` waiting for the current read to finish
+  this._seeking = null;
+
+  var self = this;
+  process.nextTick(function () {
+    self._pump();
+  });
+}
+inherits(FileDecoder, Decoder);
+
+/**
+ * Moves the decoder to the page of stream `serialno` that contains
+ * `granulepos`, i.e. the first one whose granulepos is at or past it. The page
+ * is looked up in the `index` when there is one, and found by bisecting the
+ * file otherwise, so the number of reads only grows with the log of its size.
+ * Every stream is then reset, and packet output resumes from that page: the
+ * first packet out of the stream is the first one to start on it, and may
+ * come a little before `granulepos`. Packets demuxed before the seek are still
+ * output first.
+ *
+ * When the file starts with an Ogg Skeleton 4.0 stream that has a keyframe
+ * index for the stream, the decoder goes straight to the page of the last
+ * keyframe at or before `granulepos` instead, which is where decoding has to
+ * start from anyway. The Skeleton headers are read on the first seek.
+ *
+ * Streams that had already ended are forgotten, and get a new "stream" event
+ * should they show up again.
+ *
+ * @param {Number} serialno serial number of the stream to seek in
+ * @param {Number} granulepos granule position to seek to
+ * @param {Function} fn callback function, gets the new file offset
+ * @api public
+ */
+
+FileDecoder.prototype.seek = function (serialno, granulepos, fn) {
+  debug('seek(%d, %d)', serialno, granulepos);
+  var err = null;
+  if (this._seeking) {
+    err = new Error('seek() called while another seek is in progress');
+  } else if (this.oy.destroyed) {
+    err = new Error('seek() called after the end of the file');
+  }
+  if (err) {
+    return process.nextTick(function () {
+      fn(err);
+    });
+  }
+  this._seeking = { serialno: serialno, granulepos: granulepos, fn: fn };
+  this._pump();
+};
+
+/**
+ * Reads the next chunk of the file straight into the `ogg_sync_state` and
+ * demuxes it, over and over, or runs the pending seek.
+ *
+ * @api private
+ */
+
+FileDecoder.prototype._pump = function () {
+  if (this._reading || this.oy.destroyed) return;
+  if (this._seeking) return this._bisect(this._seeking);
+  debug('_pump(%d)', this.position);
+
+  var self = this;
+  var buf = this.buffer(this._chunkSize);
+  this._reading = true;
+  fs.read(this.fd, buf, 0, buf.length, this.position, function (err, bytes) {
+    if (err) {
+      self._reading = false;
+      return self.emit('error', err);
+    }
+    if (self._seeking || 0 === bytes) {
+      // the `buffer()` goes unused
+      self.unbuffer();
+    }
+    if (self._seeking) {
+      // read from where we are about to leave, never mind it
+      self._reading = false;
+      return self._pump();
+    }
+    if (0 === bytes) {
+      // "finish" frees the libogg state, nothing gets read after this
+      return self.end();
+    }
+    self.position += bytes;
+    self.wrote(bytes, function (err) {
+      self._reading = false;
+      if (err) return self.emit('error', err);
+      self._pump();
+    });
+  });
+};
+
+/**
+ * Looks for the page `seek` is after, and restarts reading from it.
+ *
+ * Without an up to date `index` or a Skeleton keyframe index, the search keeps the pages found in [lo, hi)
+ * narrowing down: a page of the stream found at or past the granulepos moves
+ * `hi` down to where the search for it started, and one found before it moves
+ * `lo` past its end. Once the range fits in a single read, it gets scanned
+ * page by page.
+ *
+ * @param {Object} seek the `seek()` arguments
+ * @api private
+ */
+
+FileDecoder.prototype._bisect = function (seek) {
+  var self = this;
+  var serialno = seek.serialno;
+  var target = seek.granulepos;
+  this._reading = true;
+
+  fs.fstat(this.fd, function (err, stat) {
+    if (err) return done(err);
+    var index = self._index;
+    if (index && index.mediaSize === stat.size) {
+      var entry = index.find(serialno, target);
+      if (!entry) return done(past());
+      return done(null, entry.offset);
+    }
+    self._readSkeleton(function (skeleton) {
+      var keypoint = skeleton && skeleton.keypoint(serialno, target);
+      if (keypoint) return done(null, keypoint.offset);
+      bisect(stat.size);
+    });
+  });
+
+  function bisect (size) {
+    var lo = 0;
+    var hi = size;
+    var best = null;
+    step();
+
+    function step () {
+      debug('_bisect(): [%d, %d)', lo, hi);
+      if (hi - lo <= self._chunkSize) {
+        var limit = best ? best.offset + 1 : size;
+        return self._probe(lo, limit, serialno, reached, function (err, p) {
+          if (err) return done(err);
+          p = p || best;
+          if (!p) return done(past());
+          done(null, p.offset);
+        });
+      }
+      var mid = lo + Math.floor((hi - lo) / 2);
+      self._probe(mid, hi, serialno, timed, function (err, p) {
+        if (err) return done(err);
+        if (!p) {
+          hi = mid;
+        } else if (p.granulepos >= target) {
+          best = p;
+          hi = mid;
+        } else {
+          lo = p.end;
+        }
+        step();
+      });
+    }
+  }
+
+  function past () {
+    return new Error('granulepos ' + target + ' is past the end of stream ' + serialno);
+  }
+
+  // pages where no packet ends have a granulepos of -1, and tell us nothing
+  function timed (desc) {
+    return -1 !== desc.granulepos;
+  }
+
+  function reached (desc) {
+    return timed(desc) && desc.granulepos >= target;
+  }
+
+  function done (err, offset) {
+    debug('_bisect(): %s, offset %d', err, offset);
+    self._seeking = null;
+    self._restart(err ? self.position : offset);
+    self._reading = false;
+    seek.fn(err, offset);
+    self._pump();
+  }
+};
+
+/**
+ * Reads the Skeleton headers at the start of the file, the first time around.
+ * A file whose Skeleton can't be read is simply bisected.
+ *
+ * @param {Function} fn callback function, gets the `Skeleton` or `null`
+ * @api private
+ */
+
+FileDecoder.prototype._readSkeleton = function (fn) {
+  if (undefined !== this._skeleton) return fn(this._skeleton);
+  var self = this;
+  skeleton.read(this.fd, function (err, s) {
+    debug('_readSkeleton(): %s, %j', err, !!s);
+    self._skeleton = err ? null : s;
+    fn(self._skeleton);
+  });
+};
+
+/**
+ * Reads the file from `offset` on, looking for the first page of stream
+ * `serialno` starting before `limit` that `match()` accepts. Calls back with
+ * its `offset`, `end` offset and `granulepos`, or with `null` when there's
+ * none. Leaves the `ogg_sync_state` in the middle of the file.
+ *
+ * @param {Number} offset file offset to start reading at
+ * @param {Number} limit file offset the page has to start before
+ * @param {Number} serialno serial number of the stream
+ * @param {Function} match called with the `ogg_page_desc` of each page
+ * @param {Function} fn callback function
+ * @api private
+ */
+
+FileDecoder.prototype._probe = function (offset, limit, serialno, match, fn) {
+  debug('_probe(%d, %d)', offset, limit);
+  var self = this;
+  var oy = this.oy;
+  var page = this._pages.acquire();
+  var desc = ogg_page_desc(this._descs.acquire());
+
+  // file offsets of what `ogg_sync_pageseek()` looks at next, and of the next
+  // byte to read into the `ogg_sync_state`
+  var pos = offset;
+  var end = offset;
+
+  binding.ogg_sync_reset(oy);
+  read();
+
+  function read () {
+    var buf = binding.ogg_sync_buffer(oy, self._chunkSize);
+    fs.read(self.fd, buf, 0, buf.length, end, function (err, bytes) {
+      if (err) return finish(err);
+      if (0 === bytes) return finish(null, null);
+      end += bytes;
+      var r = binding.ogg_sync_wrote(oy, bytes);
+      if (0 !== r) return finish(new Error('ogg_sync_wrote() error: ' + r));
+      pageseek();
+    });
+  }
+
+  function pageseek () {
+    var bytes = binding.pageBytes(end - pos, self._pageBytes);
+    binding.dispatch('ogg_sync_pageseek', bytes, self._syncThreshold)(oy, page, desc, afterPageseek);
+  }
+
+  function afterPageseek (rtn) {
+    if (0 === rtn) {
+      // need more data
+      return pos >= limit ? finish(null, null) : read();
+    }
+    if (rtn < 0) {
+      // skipped garbage, or the tail of a page that started before `offset`
+      pos -= rtn;
+      return pageseek();
+    }
+    var start = pos;
+    pos += rtn;
+    self._pageBytes = rtn;
+    if (start >= limit) return finish(null, null);
+    if (serialno === desc.serialno && match(desc)) {
+      return finish(null, { offset: start, end: pos, granulepos: desc.granulepos });
+    }
+    pageseek();
+  }
+
+  function finish (err, p) {
+    self._pages.release(page);
+    self._descs.release(desc);
+    fn(err, p);
+  }
+};
+
+/**
+ * Drops whatever was buffered in the `ogg_sync_state` and the streams, and
+ * carries on reading from `offset`.
+ *
+ * @param {Number} offset file offset to read from next
+ * @api private
+ */
+
+FileDecoder.prototype._restart = function (offset) {
+  debug('_restart(%d)', offset);
+  binding.ogg_sync_reset(this.oy);
+  var streams = this._streams;
+  this._streams = [];
+  for (var i = 0; i < streams.length; i++) {
+    var stream = streams[i];
+    if (stream.os.destroyed) {
+      delete this[stream.serialno];
+      continue;
+    }
+    binding.ogg_stream_reset(stream.os);
+    this._streams.push(stream);
+  }
+  this.position = offset;
+};
@@ -4,6 +4,7 @@
  */
 
 var binding = require('./binding');
+var struct = require('./struct');
 var inherits = require('util').inherits;
 
 /**
@@ -31,15 +32,40 @@ function ogg_packet (buffer) {
 }
 inherits(ogg_packet, Buffer);
 
+/**
+ * The `ogg_packet` fields are read straight out of the struct's bytes.
+ */
+
+var readLong = struct.readLong;
+var readInt64 = struct.readInt64;
+
+/**
+ * Returns packet->bytes of any `ogg_packet` struct Buffer, i.e. one that came
+ * from `ref-struct` and hasn't been turned into an `ogg_packet` instance.
+ *
+ * @param {Buffer} buffer `ogg_packet` struct
+ * @return {Number}
+ * @api private
+ */
+
+ogg_packet.bytes = function (buffer) {
+  return readLong(buffer, binding.offsetof_ogg_packet_bytes);
+};
+
 /**
  * packet->packet
  */
 
 Object.defineProperty(ogg_packet.prototype, 'packet', {
   get: function () {
+    // `replace()` and the Decoder's packets keep the backing Buffer around
+    var packet = this._packet;
+    if (packet && packet.length === this.bytes) return packet;
     return binding.ogg_packet_get_packet(this);
   },
   set: function (packet) {
+    // keep a reference to "packet" so it doesn't get GC'd
+    this._packet = packet;
     return binding.ogg_packet_set_packet(this, packet);
   },
   enumerable: true,
@@ -52,7 +78,7 @@ Object.defineProperty(ogg_packet.prototype, 'packet', {
 
 Object.defineProperty(ogg_packet.prototype, 'bytes', {
   get: function () {
-    return binding.ogg_packet_bytes(this);
+    return readLong(this, binding.offsetof_ogg_packet_bytes);
   },
   enumerable: true,
   configurable: true
@@ -64,7 +90,7 @@ Object.defineProperty(ogg_packet.prototype, 'bytes', {
 
 Object.defineProperty(ogg_packet.prototype, 'e_o_s', {
   get: function () {
-    return binding.ogg_packet_e_o_s(this);
+    return readLong(this, binding.offsetof_ogg_packet_e_o_s);
   },
   enumerable: true,
   configurable: true
@@ -76,7 +102,7 @@ Object.defineProperty(ogg_packet.prototype, 'e_o_s', {
 
 Object.defineProperty(ogg_packet.prototype, 'b_o_s', {
   get: function () {
-    return binding.ogg_packet_b_o_s(this);
+    return readLong(this, binding.offsetof_ogg_packet_b_o_s);
   },
   enumerable: true,
   configurable: true
@@ -88,7 +114,7 @@ Object.defineProperty(ogg_packet.prototype, 'b_o_s', {
 
 Object.defineProperty(ogg_packet.prototype, 'granulepos', {
   get: function () {
-    return binding.ogg_packet_granulepos(this);
+    return readInt64(this, binding.offsetof_ogg_packet_granulepos);
   },
   enumerable: true,
   configurable: true
@@ -100,12 +126,38 @@ Object.defineProperty(ogg_packet.prototype, 'granulepos', {
 
 Object.defineProperty(ogg_packet.prototype, 'packetno', {
   get: function () {
-    return binding.ogg_packet_packetno(this);
+    return readInt64(this, binding.offsetof_ogg_packet_packetno);
   },
   enumerable: true,
   configurable: true
 });
 
+/**
+ * Returns the contents of any `ogg_packet` struct Buffer as a plain
+ * `{ packet, e_o_s, granulepos }` object, for an `EncoderStream` that
+ * references its packets rather than copying them. The bytes are copied
+ * unless they're already backed by a Buffer (see `replace()`), since whatever
+ * filled the struct is free to reuse its memory once it's been written.
+ *
+ * @param {Buffer} buffer `ogg_packet` struct
+ * @return {Object}
+ * @api private
+ */
+
+ogg_packet.detach = function (buffer) {
+  var bytes = ogg_packet.bytes(buffer);
+  var data = buffer._packet;
+  if (!data || data.length !== bytes) {
+    data = new Buffer(bytes);
+    if (bytes > 0) binding.ogg_packet_get_packet(buffer).copy(data);
+  }
+  return {
+    packet: data,
+    e_o_s: readLong(buffer, binding.offsetof_ogg_packet_e_o_s),
+    granulepos: readInt64(buffer, binding.offsetof_ogg_packet_granulepos)
+  };
+};
+
 /**
  * Creates a new Buffer instance to back this `ogg_packet` instance.
  * Typically this function is used to take control over the bytes backing the
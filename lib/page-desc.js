@@ -0,0 +1,100 @@
+/**
+ * Module dependencies.
+ */
+
+var binding = require('./binding');
+var struct = require('./struct');
+var inherits = require('util').inherits;
+
+/**
+ * Module exports.
+ */
+
+module.exports = ogg_page_desc;
+
+/**
+ * Encapsulates an `ogg_page_desc` C struct instance: every field of a page
+ * header, decoded by `ogg_page_describe()` in one pass, along with a summary of
+ * its segment table. The `Decoder` attaches one to each page as `page.desc`.
+ * Like the `ogg_page` it describes, it is only good during the "page" event.
+ *
+ * @api public
+ */
+
+function ogg_page_desc (buffer) {
+  if (!Buffer.isBuffer(buffer)) {
+    buffer = new Buffer(binding.sizeof_ogg_page_desc);
+  }
+  if (buffer.length != binding.sizeof_ogg_page_desc) {
+    throw new Error('"buffer.length" = ' + buffer.length + ', expected ' + binding.sizeof_ogg_page_desc);
+  }
+  buffer.__proto__ = ogg_page_desc.prototype;
+  return buffer;
+}
+inherits(ogg_page_desc, Buffer);
+
+/**
+ * Defines a getter for the struct field `name`, read with `read()`.
+ *
+ * @api private
+ */
+
+function field (name, read) {
+  var offset = binding['offsetof_ogg_page_desc_' + name];
+  Object.defineProperty(ogg_page_desc.prototype, name, {
+    get: function () {
+      return read(this, offset);
+    },
+    enumerable: true,
+    configurable: true
+  });
+}
+
+/**
+ * Reads a flag of the struct as a Boolean.
+ *
+ * @api private
+ */
+
+function flag (buffer, offset) {
+  return 0 !== struct.readInt(buffer, offset);
+}
+
+/**
+ * desc->granulepos, desc->serialno, desc->pageno
+ */
+
+field('granulepos', struct.readInt64);
+field('serialno', struct.readInt);
+field('pageno', struct.readLong);
+
+/**
+ * desc->version, and the header flags as Booleans
+ */
+
+field('version', struct.readInt);
+field('continued', flag);
+field('bos', flag);
+field('eos', flag);
+
+/**
+ * desc->header_len, desc->body_len, desc->segments
+ */
+
+field('header_len', struct.readLong);
+field('body_len', struct.readLong);
+field('segments', struct.readInt);
+
+/**
+ * desc->packets, the number of packets completed on the page
+ */
+
+field('packets', struct.readInt);
+
+/**
+ * desc->lead, the body bytes ending a packet begun on an earlier page, and
+ * desc->tail, the body bytes of a packet ending on a later page
+ */
+
+field('lead', struct.readLong);
+field('tail', struct.readLong);
@@ -0,0 +1,165 @@
+/**
+ * Module dependencies.
+ */
+
+var debug = require('debug')('ogg:page-index');
+var binding = require('./binding');
+var struct = require('./struct');
+
+/**
+ * Module exports.
+ */
+
+module.exports = PageIndex;
+
+/**
+ * An index of every page of an ogg file, as built by `PageIndex.build()`,
+ * mapped into memory by `PageIndex.open()`. Lookups binary-search the mapped
+ * file in native code, so seeking, getting the duration of a stream, or the
+ * byte range between two granule positions never reads the ogg file itself.
+ *
+ * @param {Buffer} buffer the mapped index file
+ * @api public
+ */
+
+function PageIndex (buffer) {
+  if (!(this instanceof PageIndex)) return new PageIndex(buffer);
+  this.buffer = buffer;
+
+  // number of pages, and size of the ogg file when it was indexed
+  this.count = struct.readInt64(buffer, binding.offsetof_page_index_header_count);
+  this.mediaSize = struct.readInt64(buffer, binding.offsetof_page_index_header_media_size);
+}
+
+/**
+ * Walks the ogg file at `path` once, and writes the index of its pages to
+ * `indexPath`. Runs on the binding's thread pool.
+ *
+ * @param {String} path ogg file to index
+ * @param {String} indexPath index file to write
+ * @param {Function} fn callback function, gets the number of pages indexed
+ * @api public
+ */
+
+PageIndex.build = function (path, indexPath, fn) {
+  debug('build(%j, %j)', path, indexPath);
+  binding.page_index_build(path, indexPath, fn);
+};
+
+/**
+ * Maps the index file at `indexPath` into memory. Throws when it isn't a page
+ * index, or one of a version or byte order this build doesn't read. The file
+ * gets unmapped once the PageIndex is garbage collected.
+ *
+ * @param {String} indexPath index file to open
+ * @return {PageIndex}
+ * @api public
+ */
+
+PageIndex.open = function (indexPath) {
+  debug('open(%j)', indexPath);
+  return new PageIndex(binding.page_index_map(indexPath));
+};
+
+/**
+ * Returns entry `i` of the index: the `offset` of the page in the ogg file,
+ * its size in `bytes`, its `serialno`, `pageno` and `granulepos`, and its
+ * `continued`, `bos` and `eos` flags.
+ *
+ * @param {Number} i entry number
+ * @return {Object}
+ * @api public
+ */
+
+PageIndex.prototype.entry = function (i) {
+  var base = binding.sizeof_page_index_header + i * binding.sizeof_page_index_entry;
+  var buffer = this.buffer;
+  var flags = struct.readInt(buffer, base + binding.offsetof_page_index_entry_flags);
+  return {
+    offset: struct.readInt64(buffer, base + binding.offsetof_page_index_entry_offset),
+    bytes: struct.readInt(buffer, base + binding.offsetof_page_index_entry_bytes),
+    serialno: struct.readInt(buffer, base + binding.offsetof_page_index_entry_serialno),
+    pageno: struct.readInt(buffer, base + binding.offsetof_page_index_entry_pageno),
+    granulepos: struct.readInt64(buffer, base + binding.offsetof_page_index_entry_granulepos),
+    continued: 0 !== (flags & binding.PAGE_INDEX_CONTINUED),
+    bos: 0 !== (flags & binding.PAGE_INDEX_BOS),
+    eos: 0 !== (flags & binding.PAGE_INDEX_EOS)
+  };
+};
+
+/**
+ * Returns the serial numbers of the streams in the ogg file.
+ *
+ * @return {Array}
+ * @api public
+ */
+
+PageIndex.prototype.serialnos = function () {
+  var serialnos = [];
+  var i = 0;
+  while (i < this.count) {
+    var serialno = this.entry(i).serialno;
+    serialnos.push(serialno);
+    i = binding.page_index_stream(this.buffer, serialno)[1];
+  }
+  return serialnos;
+};
+
+/**
+ * Returns the entry of the first page of stream `serialno` whose granulepos
+ * is at or past `granulepos`, i.e. the page to start decoding from to get
+ * there, or `null` when there's none.
+ *
+ * @param {Number} serialno serial number of the stream
+ * @param {Number} granulepos granule position to look for
+ * @return {Object} see `entry()`
+ * @api public
+ */
+
+PageIndex.prototype.find = function (serialno, granulepos) {
+  var i = binding.page_index_find(this.buffer, serialno, granulepos);
+  return -1 === i ? null : this.entry(i);
+};
+
+/**
+ * Returns the last granulepos of stream `serialno`, or -1 when the stream
+ * isn't in the file or none of its pages has one. How that maps to time is up
+ * to the codec.
+ *
+ * @param {Number} serialno serial number of the stream
+ * @return {Number}
+ * @api public
+ */
+
+PageIndex.prototype.duration = function (serialno) {
+  var range = binding.page_index_stream(this.buffer, serialno);
+  for (var i = range[1] - 1; i >= range[0]; i--) {
+    var granulepos = this.entry(i).granulepos;
+    if (-1 !== granulepos) return granulepos;
+  }
+  return -1;
+};
+
+/**
+ * Returns the `start` and `end` offsets of the bytes of the ogg file holding
+ * stream `serialno` from granule position `from` up to `to`: from the page
+ * `find(serialno, from)` returns, to the end of the one `find(serialno, to)`
+ * does, or of the file. Pages of the other streams in between are included.
+ * Returns `null` when `from` is past the end of the stream.
+ *
+ * @param {Number} serialno serial number of the stream
+ * @param {Number} from first granule position
+ * @param {Number} to last granule position
+ * @return {Object}
+ * @api public
+ */
+
+PageIndex.prototype.range = function (serialno, from, to) {
+  var first = this.find(serialno, from);
+  if (!first) return null;
+  var last = this.find(serialno, to);
+  return {
+    start: first.offset,
+    end: last ? last.offset + last.bytes : this.mediaSize
+  };
+};
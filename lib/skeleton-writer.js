@@ -0,0 +1,367 @@
+
+/**
+ * Module dependencies.
+ */
+
+var debug = require('debug')('ogg:skeleton-writer');
+var binding = require('./binding');
+var skeleton = require('./skeleton');
+
+/**
+ * Module exports.
+ */
+
+module.exports = SkeletonWriter;
+
+/**
+ * Keypoint times are in milliseconds.
+ */
+
+var TIME_DEN = 1000;
+
+/**
+ * Adds an Ogg Skeleton 4.0 stream to the pages an `Encoder` outputs, and
+ * builds a keyframe index of its tracks as their pages go by. You should not
+ * need to create instances of `SkeletonWriter` manually, see the `skeleton`
+ * option of `Encoder`.
+ *
+ * The Skeleton headers have to come before the pages they index, so they go out
+ * with room left for the keypoints (`reserve` bytes per track), and `end()`
+ * builds pages of the same size holding the real thing, to be written over
+ * them once the output is a file (see `Encoder#writeSkeleton()`).
+ *
+ * Options:
+ *
+ *   - `serialno` - serial number of the Skeleton stream (default random)
+ *   - `reserve` - bytes of keypoints per track (default 32768). When a
+ *                 track has more, every other one is dropped until they fit
+ *   - `interval` - milliseconds between the keypoints of tracks without
+ *                  keyframes, i.e. a `granuleshift` of 0 (default 1000)
+ *
+ * @param {Object} opts options object
+ * @api private
+ */
+
+function SkeletonWriter (opts) {
+  if (!(this instanceof SkeletonWriter)) return new SkeletonWriter(opts);
+
+  var serialno = opts && opts.serialno;
+  if (null == serialno) serialno = Math.random() * 1000000 | 0;
+  this.serialno = serialno;
+  this._reserve = opts && opts.reserve || 32768;
+  this._interval = opts && opts.interval || 1000;
+
+  // tracks keyed by serial number, and those that made it into the headers
+  this._tracks = Object.create(null);
+  this._indexed = [];
+
+  // offset in the output of the next byte, and of the first page past the
+  // headers, i.e. the first one with a positive granulepos: header pages have
+  // one of 0, or -1 when a header packet carries on to the next page
+  this.offset = 0;
+  this._contentOffset = 0;
+
+  // offsets and sizes of the pages of the `fishead` packet, and of the other
+  // Skeleton headers, once they're out
+  this._head = null;
+  this._bones = null;
+}
+
+/**
+ * Registers the stream `serialno` as a track of the Skeleton. `info` gives its
+ * `fisbone` fields, as `Skeleton.parse()` returns them: `granulerateNum` and
+ * `granulerateDen`, `granuleshift`, and optionally `headerPackets`,
+ * `basegranule`, `preroll` and `messageHeaders`. Tracks without a granulerate
+ * get no keyframe index.
+ *
+ * @param {Number} serialno serial number of the stream
+ * @param {Object} info `fisbone` fields
+ * @api private
+ */
+
+SkeletonWriter.prototype.track = function (serialno, info) {
+  debug('track(%d)', serialno);
+  var track = Object.create(null);
+  for (var key in info) track[key] = info[key];
+  track.serialno = serialno;
+  track.granuleshift = track.granuleshift || 0;
+  track.indexed = track.granulerateNum > 0;
+
+  // whether its BOS page came before the Skeleton headers went out
+  track.started = false;
+  track.headers = 0;
+
+  // where the packet left unfinished by the last page begins, and the last
+  // granulepos and keyframe number
+  track.pending = 0;
+  track.granulepos = 0;
+  track.keyframe = 0;
+  track.keypoints = [];
+  this._tracks[serialno] = track;
+};
+
+/**
+ * Takes the Buffers of an Encoder "pages" event, and returns them with the
+ * Skeleton's pages spliced in where they go: the `fishead` before any other
+ * page, and the rest of the headers before the first page that isn't a BOS one.
+ *
+ * @param {Array} pieces Buffers of whole pages, or page headers and body slices
+ * @return {Array}
+ * @api private
+ */
+
+SkeletonWriter.prototype.write = function (pieces) {
+  var out = [];
+  var i = 0;
+  while (i < pieces.length) {
+    var header = pieces[i];
+    var segments = header[26];
+    var bytes = 27 + segments;
+    for (var s = 0; s < segments; s++) bytes += header[27 + s];
+
+    if (!this._head) {
+      this._head = this._emit(out, [ skeleton.fishead({}) ], 0);
+    }
+    if (!this._bones && !(header[5] & 0x02)) {
+      this._bones = this._emit(out, this._headers(false), 1);
+    }
+    this._page(header, bytes);
+    this.offset += bytes;
+
+    for (var left = bytes; left > 0; i++) {
+      left -= pieces[i].length;
+      out.push(pieces[i]);
+    }
+  }
+  return out;
+};
+
+/**
+ * Called once the last page went through `write()`. Returns the Skeleton
+ * headers still to be output, if no page but BOS ones ever came, and builds
+ * their final version: an Array of `{ offset, data }` Buffers to write over
+ * the output, or `null` when nothing was output at all.
+ *
+ * @param {Array} out Array to append the last Skeleton pages to
+ * @return {Array}
+ * @api private
+ */
+
+SkeletonWriter.prototype.end = function (out) {
+  debug('end(%d bytes)', this.offset);
+  if (!this._head) return null;
+  if (!this._bones) this._bones = this._emit(out, this._headers(false), 1);
+  if (!this._contentOffset) this._contentOffset = this.offset;
+
+  var head = skeleton.fishead({
+    segmentLength: this.offset,
+    contentOffset: this._contentOffset
+  });
+  var os = new binding.OggStreamState(this.serialno);
+  var patches = [
+    this._patch(os, [ head ], 0, this._head),
+    this._patch(os, this._headers(true), 1, this._bones)
+  ];
+  os.destroy();
+  return patches;
+};
+
+/**
+ * Builds the Skeleton headers following the `fishead`: a `fisbone` per
+ * track, an `index` per track with a granulerate, and the empty EOS packet.
+ * With `final` unset, the indexes are empty and padded to `reserve` bytes of
+ * keypoints.
+ *
+ * @api private
+ */
+
+SkeletonWriter.prototype._headers = function (final) {
+  if (!final) {
+    for (var serialno in this._tracks) {
+      var t = this._tracks[serialno];
+      if (t.started) this._indexed.push(t);
+    }
+  }
+  var packets = [];
+  var tracks = this._indexed;
+  for (var i = 0; i < tracks.length; i++) {
+    var track = tracks[i];
+    packets.push(skeleton.fisbone({
+      serialno: track.serialno,
+      headerPackets: null == track.headerPackets ? track.headers : track.headerPackets,
+      granulerateNum: track.granulerateNum,
+      granulerateDen: track.granulerateDen,
+      basegranule: track.basegranule,
+      preroll: track.preroll,
+      granuleshift: track.granuleshift,
+      messageHeaders: track.messageHeaders
+    }));
+  }
+  var reserve = 42 + this._reserve;
+  for (i = 0; i < tracks.length; i++) {
+    if (!tracks[i].indexed) continue;
+    packets.push(final
+      ? this._index(tracks[i], reserve)
+      : skeleton.index({ serialno: tracks[i].serialno, timeDen: TIME_DEN }, reserve));
+  }
+  packets.push(new Buffer(0));
+  return packets;
+};
+
+/**
+ * Builds the final `index` packet of `track`, thinning out its keypoints
+ * until they fit in `bytes`.
+ *
+ * @api private
+ */
+
+SkeletonWriter.prototype._index = function (track, bytes) {
+  var keypoints = track.keypoints;
+  for (;;) {
+    var data = skeleton.index({
+      serialno: track.serialno,
+      keypoints: keypoints,
+      timeDen: TIME_DEN,
+      firstTime: keypoints.length ? keypoints[0].time : 0,
+      lastTime: this._time(track, track.granulepos)
+    }, bytes);
+    if (data) return data;
+    debug('dropping half of %d keypoints of track %d', keypoints.length, track.serialno);
+    keypoints = keypoints.length > 1 ? keypoints.filter(function (k, i) {
+      return 0 === i % 2;
+    }) : [];
+  }
+};
+
+/**
+ * Flushes `packets` into Skeleton pages appended to `out`. The last packet
+ * is the EOS one when `e_o_s` is set. Returns their offset and size.
+ *
+ * @api private
+ */
+
+SkeletonWriter.prototype._emit = function (out, packets, e_o_s) {
+  var os = this._os || (this._os = new binding.OggStreamState(this.serialno));
+  var pages = flush(os, packets, e_o_s);
+  if (e_o_s) os.destroy();
+  var run = { offset: this.offset, bytes: 0 };
+  for (var i = 0; i < pages.length; i++) {
+    out.push(pages[i]);
+    run.bytes += pages[i].length;
+  }
+  this.offset += run.bytes;
+  debug('_emit(%d packets): %d bytes at %d', packets.length, run.bytes, run.offset);
+  return run;
+};
+
+/**
+ * Flushes the final version of some Skeleton headers into pages, which take
+ * the same room as the `run` that went out, since the packets are of the same
+ * sizes, and returns them as one Buffer to write at its offset.
+ *
+ * @api private
+ */
+
+SkeletonWriter.prototype._patch = function (os, packets, e_o_s, run) {
+  var data = Buffer.concat(flush(os, packets, e_o_s));
+  if (data.length !== run.bytes) {
+    throw new Error('Skeleton headers changed size: ' + data.length + ', expected ' + run.bytes);
+  }
+  return { offset: run.offset, data: data };
+};
+
+/**
+ * Records what the page with the given `header`, `bytes` long, at the
+ * current offset, says about its stream, i.e. its keypoint if a keyframe ends
+ * on it. That's the page the keyframe begins on: the frames since the last
+ * keyframe, in the low bits of the granulepos, count back from the last
+ * packet ending on the page to the keyframe, codecs with a granuleshift having
+ * a packet per frame. Tracks without keyframes get one every `interval`, at
+ * the page the first packet ending on it begins, which is where decoding
+ * picks up at the time the previous page left off.
+ *
+ * @api private
+ */
+
+SkeletonWriter.prototype._page = function (header, bytes) {
+  var granulepos = header.readInt32LE(10) * 4294967296 + header.readUInt32LE(6);
+  if (!this._contentOffset && this._bones && granulepos > 0) {
+    this._contentOffset = this.offset;
+  }
+
+  var track = this._tracks[header.readUInt32LE(14)];
+  if (!track) return;
+  var continued = 0 !== (header[5] & 0x01);
+  if (header[5] & 0x02) track.started = !this._bones;
+
+  var segments = header[26];
+  var ends = 0;
+  for (var s = 0; s < segments; s++) {
+    if (255 !== header[27 + s]) ends++;
+  }
+  var first = continued ? track.pending : this.offset;
+  if (segments && 255 === header[26 + segments]) {
+    // a packet carries on past this page, and begins here unless this page is
+    // a part of a packet that began earlier
+    if (ends || !continued) track.pending = this.offset;
+  }
+  if (0 === ends || -1 === granulepos) return;
+  if (0 === granulepos) {
+    track.headers += ends;
+    return;
+  }
+
+  if (track.indexed) {
+    var time;
+    if (track.granuleshift) {
+      var shift = Math.pow(2, track.granuleshift);
+      var keyframe = Math.floor(granulepos / shift);
+      if (keyframe !== track.keyframe) {
+        track.keyframe = keyframe;
+        time = this._time(track, shift * keyframe);
+        // unless the keyframe is the first packet ending here, it begins here
+        if (ends - 1 - granulepos % shift > 0) first = this.offset;
+      }
+    } else {
+      // the first packet ending here begins where the last page left off
+      var start = this._time(track, track.granulepos);
+      var last = track.keypoints[track.keypoints.length - 1];
+      if (!last || start - last.time >= this._interval) time = start;
+    }
+    if (null != time) track.keypoints.push({ offset: first, time: time });
+  }
+  track.granulepos = granulepos;
+};
+
+/**
+ * Turns a granulepos of `track` into milliseconds, the same way
+ * `Skeleton#keypoint()` does.
+ *
+ * @api private
+ */
+
+SkeletonWriter.prototype._time = function (track, granulepos) {
+  var shift = Math.pow(2, track.granuleshift);
+  var units = Math.floor(granulepos / shift) + granulepos % shift;
+  return Math.floor(units * track.granulerateDen * TIME_DEN / track.granulerateNum);
+};
+
+/**
+ * Runs `packets` through `ogg_stream_iovecin()` and `ogg_stream_flush()`
+ * synchronously, returning the pages as Buffers.
+ *
+ * @api private
+ */
+
+function flush (os, packets, e_o_s) {
+  var r, out;
+  packets = packets.map(function (data, i) {
+    return { packet: data, e_o_s: e_o_s && i === packets.length - 1 ? 1 : 0, granulepos: 0 };
+  });
+  binding.ogg_stream_iovecin_sync(os, packets, binding.IOVECIN_FLUSH, function (rtn, pages) {
+    r = rtn;
+    out = pages;
+  });
+  if (0 !== r) throw new Error('ogg_stream_iovecin() error: ' + r);
+  return out;
+}
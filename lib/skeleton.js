@@ -0,0 +1,268 @@
+/**
+ * Module dependencies.
+ */
+
+var debug = require('debug')('ogg:skeleton');
+var binding = require('./binding');
+
+/**
+ * Module exports.
+ */
+
+exports = module.exports = Skeleton;
+
+/**
+ * The headers of an Ogg Skeleton stream: the fields of its `fishead` packet,
+ * and in `tracks`, what its `fisbone` and Skeleton 4.0 `index` packets say
+ * about the other streams of the file (see `parse()`).
+ *
+ * @param {Object} head the parsed `fishead` packet, along with the `tracks`
+ * @api public
+ */
+
+function Skeleton (head) {
+  if (!(this instanceof Skeleton)) return new Skeleton(head);
+  for (var key in head) {
+    if ('type' !== key) this[key] = head[key];
+  }
+  if (!this.tracks) this.tracks = [];
+}
+
+/**
+ * Parses a single packet of a Skeleton stream, i.e. one a `DecoderStream`
+ * output. Returns `null` for anything that isn't a Skeleton packet. Otherwise
+ * returns its fields, and its `type`:
+ *
+ *   - "fishead" - `versionMajor`, `versionMinor`, `presentationNum`,
+ *                 `presentationDen`, `basetimeNum`, `basetimeDen`, and for
+ *                 Skeleton 4.0, `segmentLength` and `contentOffset`
+ *   - "fisbone" - `serialno`, `headerPackets`, `granulerateNum`,
+ *                 `granulerateDen`, `basegranule`, `preroll`, `granuleshift`
+ *   - "index" - `serialno`, `timeDen`, `firstTime`, `lastTime`, and the packed
+ *               `keypoints` Buffer, which `find()` searches
+ *
+ * @param {Buffer} data the packet data
+ * @return {Object}
+ * @api public
+ */
+
+exports.parse = function (data) {
+  return binding.skeleton_parse(data);
+};
+
+/**
+ * Reads the Skeleton headers at the start of the ogg file behind the file
+ * descriptor `fd`, on the binding's thread pool. `fn` gets a `Skeleton`, or
+ * `null` if the file doesn't start with a Skeleton stream.
+ *
+ * @param {Number} fd file descriptor of the ogg file
+ * @param {Function} fn callback function
+ * @api public
+ */
+
+exports.read = function (fd, fn) {
+  debug('read(%d)', fd);
+  binding.skeleton_read(fd, function (err, head) {
+    if (err) return fn(err);
+    fn(null, head ? new Skeleton(head) : null);
+  });
+};
+
+/**
+ * Returns the last keypoint at or before `time` in a `keypoints` Buffer, as
+ * its `offset` in the file and its `time`, or `null` if there's none. Times
+ * are in units of the `timeDen` of the `index` packet.
+ *
+ * @param {Buffer} keypoints `keypoints` of an `index` packet
+ * @param {Number} time time to look for
+ * @return {Object}
+ * @api public
+ */
+
+exports.find = function (keypoints, time) {
+  return binding.skeleton_find(keypoints, time);
+};
+
+/**
+ * Returns the track of stream `serialno`, or `null`.
+ *
+ * @param {Number} serialno serial number of the stream
+ * @return {Object}
+ * @api public
+ */
+
+Skeleton.prototype.track = function (serialno) {
+  for (var i = 0; i < this.tracks.length; i++) {
+    if (serialno === this.tracks[i].serialno) return this.tracks[i];
+  }
+  return null;
+};
+
+/**
+ * Returns the keypoint of stream `serialno` to start decoding from to get to
+ * `granulepos`, or `null` when the stream has no keyframe index. The
+ * granulepos is turned into a time with the stream's `fisbone`: its upper
+ * bits, above `granuleshift`, count up to the last keyframe, and its lower
+ * ones the frames since.
+ *
+ * @param {Number} serialno serial number of the stream
+ * @param {Number} granulepos granule position to get to
+ * @return {Object} see `find()`
+ * @api public
+ */
+
+Skeleton.prototype.keypoint = function (serialno, granulepos) {
+  var track = this.track(serialno);
+  if (!track || !track.keypoints || !track.granulerateNum || !track.timeDen) return null;
+  var shift = Math.pow(2, track.granuleshift);
+  var units = Math.floor(granulepos / shift) + granulepos % shift;
+  var time = Math.floor(units * track.granulerateDen * track.timeDen / track.granulerateNum);
+  return exports.find(track.keypoints, time);
+};
+
+/**
+ * Builds a Skeleton 4.0 `fishead` packet out of the fields `parse()` returns
+ * for one. Times default to milliseconds from 0.
+ *
+ * @param {Object} head `fishead` fields
+ * @return {Buffer}
+ * @api public
+ */
+
+exports.fishead = function (head) {
+  var data = packet('fishead\0', 80);
+  data.writeUInt16LE(4, 8);
+  data.writeUInt16LE(0, 10);
+  writeInt64(data, head.presentationNum || 0, 12);
+  writeInt64(data, head.presentationDen || 1000, 20);
+  writeInt64(data, head.basetimeNum || 0, 28);
+  writeInt64(data, head.basetimeDen || 1000, 36);
+  // bytes 44 to 63 are the UTC time, left unset
+  writeInt64(data, head.segmentLength || 0, 64);
+  writeInt64(data, head.contentOffset || 0, 72);
+  return data;
+};
+
+/**
+ * Builds a `fisbone` packet out of the fields `parse()` returns for one, along
+ * with `messageHeaders`, an object of message header fields such as
+ * "Content-Type".
+ *
+ * @param {Object} track `fisbone` fields
+ * @return {Buffer}
+ * @api public
+ */
+
+exports.fisbone = function (track) {
+  var headers = '';
+  for (var name in track.messageHeaders) {
+    headers += name + ': ' + track.messageHeaders[name] + '\r\n';
+  }
+  var data = packet('fisbone\0', 52 + Buffer.byteLength(headers));
+  // offset of the message headers, from the field itself
+  data.writeUInt32LE(44, 8);
+  data.writeUInt32LE(track.serialno, 12);
+  data.writeUInt32LE(track.headerPackets || 0, 16);
+  writeInt64(data, track.granulerateNum || 0, 20);
+  writeInt64(data, track.granulerateDen || 1, 28);
+  writeInt64(data, track.basegranule || 0, 36);
+  data.writeUInt32LE(track.preroll || 0, 44);
+  data[48] = track.granuleshift || 0;
+  data.write(headers, 52);
+  return data;
+};
+
+/**
+ * Builds a Skeleton 4.0 `index` packet out of the fields `parse()` returns
+ * for one, with `keypoints` as an Array of `{ offset, time }` objects in
+ * order. The packet is zero-padded up to `bytes` when given, the padding
+ * being ignored by readers, so that it can later be replaced by one with more
+ * keypoints without moving anything else. Returns `null` when the keypoints
+ * don't fit.
+ *
+ * @param {Object} track `index` fields
+ * @param {Number} bytes (optional) size of the packet
+ * @return {Buffer}
+ * @api public
+ */
+
+exports.index = function (track, bytes) {
+  var keypoints = track.keypoints || [];
+  var varints = [];
+  var offset = 0;
+  var time = 0;
+  var size = 42;
+  for (var i = 0; i < keypoints.length; i++) {
+    varints.push(keypoints[i].offset - offset, keypoints[i].time - time);
+    size += varintBytes(keypoints[i].offset - offset) + varintBytes(keypoints[i].time - time);
+    offset = keypoints[i].offset;
+    time = keypoints[i].time;
+  }
+  if (null == bytes) bytes = size;
+  if (size > bytes) return null;
+
+  var data = packet('index\0', bytes);
+  data.writeUInt32LE(track.serialno, 6);
+  writeInt64(data, keypoints.length, 10);
+  writeInt64(data, track.timeDen || 1000, 18);
+  writeInt64(data, track.firstTime || 0, 26);
+  writeInt64(data, track.lastTime || 0, 34);
+  var p = 42;
+  for (i = 0; i < varints.length; i++) p = writeVarint(data, varints[i], p);
+  return data;
+};
+
+/**
+ * Returns a zero-filled packet of `bytes` bytes starting with `magic`.
+ *
+ * @api private
+ */
+
+function packet (magic, bytes) {
+  var data = new Buffer(bytes);
+  data.fill(0);
+  data.write(magic, 0, 'binary');
+  return data;
+}
+
+/**
+ * Writes the non-negative Number `n` as a little-endian 64-bit integer.
+ *
+ * @api private
+ */
+
+function writeInt64 (data, n, offset) {
+  data.writeUInt32LE(n % 4294967296, offset);
+  data.writeUInt32LE(Math.floor(n / 4294967296), offset + 4);
+}
+
+/**
+ * Number of bytes `writeVarint()` takes for `n`.
+ *
+ * @api private
+ */
+
+function varintBytes (n) {
+  var bytes = 1;
+  while (n >= 128) {
+    n = Math.floor(n / 128);
+    bytes++;
+  }
+  return bytes;
+}
+
+/**
+ * Writes `n` the way keypoints are: 7 bits per byte, least significant first,
+ * the last byte having its top bit set. Returns the offset past it.
+ *
+ * @api private
+ */
+
+function writeVarint (data, n, offset) {
+  while (n >= 128) {
+    data[offset++] = n % 128;
+    n = Math.floor(n / 128);
+  }
+  data[offset++] = n | 0x80;
+  return offset;
+}
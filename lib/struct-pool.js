@@ -0,0 +1,73 @@
+
+/**
+ * Module dependencies.
+ */
+
+var debug = require('debug')('ogg:struct-pool');
+
+/**
+ * Module exports.
+ */
+
+module.exports = StructPool;
+
+/**
+ * Byte that released structs get filled with while debugging "ogg:struct-pool".
+ * The binding refuses `ogg_page` structs starting with it, since a pointer made
+ * of it can't be a legitimate one.
+ */
+
+var POISON = 0xdb;
+
+/**
+ * A free-list of C struct Buffers of `size` bytes, so that the libogg calls
+ * made over and over again don't allocate a fresh Buffer each time.
+ *
+ * When the "ogg:struct-pool" debug namespace is enabled, released structs are
+ * filled with poison bytes, and checked to still be intact when handed out
+ * again, which catches anything that holds on to a struct after releasing it.
+ *
+ * @param {Number} size sizeof the struct
+ * @api private
+ */
+
+function StructPool (size) {
+  if (!(this instanceof StructPool)) return new StructPool(size);
+  this.size = size;
+  this.free = [];
+}
+
+/**
+ * Returns a struct Buffer, recycled when possible.
+ *
+ * @return {Buffer}
+ * @api private
+ */
+
+StructPool.prototype.acquire = function () {
+  var buf = this.free.pop();
+  if (!buf) return new Buffer(this.size);
+  if (debug.enabled) {
+    for (var i = 0; i < buf.length; i++) {
+      if (POISON !== buf[i]) {
+        throw new Error('struct was written to after it was recycled');
+      }
+    }
+  }
+  buf.recycled = false;
+  return buf;
+};
+
+/**
+ * Hands `buf` back to the pool. It must not be used afterwards.
+ *
+ * @param {Buffer} buf struct Buffer from `acquire()`
+ * @api private
+ */
+
+StructPool.prototype.release = function (buf) {
+  if (buf.recycled) throw new Error('struct was released twice');
+  buf.recycled = true;
+  if (debug.enabled) buf.fill(POISON);
+  this.free.push(buf);
+};
@@ -0,0 +1,54 @@
+
+/**
+ * Module dependencies.
+ */
+
+var binding = require('./binding');
+
+/**
+ * Readers for the fields of the C structs the binding hands over as Buffers.
+ * They go straight to the struct's bytes, using the layout reported by the
+ * binding, so accessing a field never calls into C++.
+ */
+
+var LE = binding.little_endian;
+
+/**
+ * Reads the native `int` at `offset` of `buffer`.
+ *
+ * @api private
+ */
+
+exports.readInt = function (buffer, offset) {
+  return LE ? buffer.readInt32LE(offset, true) : buffer.readInt32BE(offset, true);
+};
+
+/**
+ * Reads the native `long` at `offset` of `buffer`.
+ *
+ * @api private
+ */
+
+exports.readLong = function (buffer, offset) {
+  if (8 === binding.sizeof_long) return exports.readInt64(buffer, offset);
+  return exports.readInt(buffer, offset);
+};
+
+/**
+ * Reads the native `ogg_int64_t` at `offset` of `buffer` as a Number. Values
+ * beyond 2^53 lose precision, just like they always have.
+ *
+ * @api private
+ */
+
+exports.readInt64 = function (buffer, offset) {
+  var hi, lo;
+  if (LE) {
+    lo = buffer.readUInt32LE(offset, true);
+    hi = buffer.readInt32LE(offset + 4, true);
+  } else {
+    hi = buffer.readInt32BE(offset, true);
+    lo = buffer.readUInt32BE(offset + 4, true);
+  }
+  return hi * 4294967296 + lo;
+};
@@ -0,0 +1,200 @@
+/*
+ * Copyright (c) 2012, Nathan Rajlich <nathan@tootallnate.net>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <uv.h>
+
+#include "arena.h"
+
+#include "ogg/ogg.h"
+
+namespace nodeogg {
+
+/* size classes go from 64 bytes up to 1MB */
+#define MIN_CLASS_SHIFT 6
+#define NUM_CLASSES 15
+#define LARGE -1
+
+/* Sits in front of every block, and keeps it 16-byte aligned. */
+union Header {
+  struct {
+    size_t capacity;
+    int klass;
+  } h;
+  double align[2];
+};
+
+/* A cached block, linked through its own (unused) payload. */
+struct FreeBlock {
+  FreeBlock *next;
+};
+
+static uv_once_t once = UV_ONCE_INIT;
+static uv_mutex_t mutex;
+static bool installed = false;
+
+static FreeBlock *free_lists[NUM_CLASSES];
+static size_t cache_limit = 8 * 1024 * 1024;
+static size_t cached = 0;
+static size_t allocated = 0;
+static double hits = 0;
+static double misses = 0;
+
+static inline Header *HeaderOf(const void *ptr) {
+  return reinterpret_cast<Header *>(const_cast<char *>(static_cast<const char *>(ptr))) - 1;
+}
+
+/* Returns the smallest class holding `size` bytes, or LARGE. */
+static inline int ClassOf(size_t size) {
+  int klass = 0;
+  size_t capacity = static_cast<size_t>(1) << MIN_CLASS_SHIFT;
+  while (capacity < size) {
+    if (++klass == NUM_CLASSES) return LARGE;
+    capacity <<= 1;
+  }
+  return klass;
+}
+
+void Arena::Init() {
+  const char *env = getenv("OGG_ARENA");
+  if (env != NULL && strcmp(env, "0") == 0) return;
+  env = getenv("OGG_ARENA_CACHE");
+  if (env != NULL) cache_limit = static_cast<size_t>(strtoul(env, NULL, 10));
+
+  uv_mutex_init(&mutex);
+  if (ogg_set_allocator(Malloc, Calloc, Realloc, Free) == 0) installed = true;
+}
+
+/* Hands the allocator to libogg. Has to happen before anything gets allocated
+ * through it, i.e. when the addon is first loaded. */
+void Arena::Install() {
+  uv_once(&once, Init);
+}
+
+/* Returns the number of bytes actually reserved for `ptr`, which libogg
+ * requested `requested` bytes for. */
+size_t Arena::Size(const void *ptr, size_t requested) {
+  if (!installed) return requested;
+  if (ptr == NULL) return 0;
+  return HeaderOf(ptr)->h.capacity;
+}
+
+void Arena::GetStats(ArenaStats *stats) {
+  memset(stats, 0, sizeof(*stats));
+  if (!installed) return;
+  uv_mutex_lock(&mutex);
+  stats->allocated = static_cast<double>(allocated);
+  stats->cached = static_cast<double>(cached);
+  stats->hits = hits;
+  stats->misses = misses;
+  uv_mutex_unlock(&mutex);
+}
+
+void *Arena::Malloc(size_t size) {
+  int klass = ClassOf(size);
+  size_t capacity;
+  Header *header = NULL;
+
+  if (klass == LARGE) {
+    capacity = size;
+    if (capacity > (size_t)-1 - sizeof(Header)) return NULL;
+  } else {
+    capacity = static_cast<size_t>(1) << (klass + MIN_CLASS_SHIFT);
+    uv_mutex_lock(&mutex);
+    FreeBlock *block = free_lists[klass];
+    if (block != NULL) {
+      free_lists[klass] = block->next;
+      cached -= capacity;
+      allocated += capacity;
+      hits++;
+      header = HeaderOf(block);
+    } else {
+      misses++;
+    }
+    uv_mutex_unlock(&mutex);
+    if (header != NULL) return header + 1;
+  }
+
+  header = static_cast<Header *>(malloc(sizeof(Header) + capacity));
+  if (header == NULL) return NULL;
+  header->h.capacity = capacity;
+  header->h.klass = klass;
+
+  uv_mutex_lock(&mutex);
+  allocated += capacity;
+  uv_mutex_unlock(&mutex);
+  return header + 1;
+}
+
+void *Arena::Calloc(size_t count, size_t size) {
+  if (size != 0 && count > (size_t)-1 / size) return NULL;
+  void *ptr = Malloc(count * size);
+  if (ptr != NULL) memset(ptr, 0, count * size);
+  return ptr;
+}
+
+void *Arena::Realloc(void *ptr, size_t size) {
+  if (ptr == NULL) return Malloc(size);
+  Header *header = HeaderOf(ptr);
+  size_t capacity = header->h.capacity;
+
+  /* libogg grows its buffers geometrically, so a block that still fits is
+   * simply kept */
+  if (size <= capacity && (header->h.klass != LARGE || size > capacity / 2)) {
+    return ptr;
+  }
+
+  if (header->h.klass == LARGE && ClassOf(size) == LARGE) {
+    if (size > (size_t)-1 - sizeof(Header)) return NULL;
+    Header *moved = static_cast<Header *>(realloc(header, sizeof(Header) + size));
+    if (moved == NULL) return NULL;
+    moved->h.capacity = size;
+    uv_mutex_lock(&mutex);
+    allocated += size;
+    allocated -= capacity;
+    uv_mutex_unlock(&mutex);
+    return moved + 1;
+  }
+
+  void *copy = Malloc(size);
+  if (copy == NULL) return NULL;
+  memcpy(copy, ptr, capacity < size ? capacity : size);
+  Free(ptr);
+  return copy;
+}
+
+void Arena::Free(void *ptr) {
+  if (ptr == NULL) return;
+  Header *header = HeaderOf(ptr);
+  size_t capacity = header->h.capacity;
+  int klass = header->h.klass;
+
+  uv_mutex_lock(&mutex);
+  allocated -= capacity;
+  if (klass != LARGE && cached + capacity <= cache_limit) {
+    FreeBlock *block = static_cast<FreeBlock *>(ptr);
+    block->next = free_lists[klass];
+    free_lists[klass] = block;
+    cached += capacity;
+    header = NULL;
+  }
+  uv_mutex_unlock(&mutex);
+
+  if (header != NULL) free(header);
+}
+
+} // nodeogg namespace
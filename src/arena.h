@@ -0,0 +1,58 @@
+/*
+ * Copyright (c) 2012, Nathan Rajlich <nathan@tootallnate.net>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef NODE_OGG_ARENA_H_
+#define NODE_OGG_ARENA_H_
+
+#include <stddef.h>
+
+namespace nodeogg {
+
+struct ArenaStats {
+  double allocated;
+  double cached;
+  double hits;
+  double misses;
+};
+
+/*
+ * Process-wide allocator installed into libogg through `ogg_set_allocator()`.
+ * Blocks are rounded up to a power-of-two size class, and freed blocks are
+ * kept on a free list per class, up to $OGG_ARENA_CACHE bytes in total, so
+ * that creating and tearing down lots of streams recycles the same buffers
+ * instead of fragmenting the heap. Blocks larger than the biggest class go
+ * straight to libc. Setting $OGG_ARENA=0 leaves libogg on libc altogether.
+ *
+ * Each `OggState` reports the rounded `Size()` of its buffers to V8, so GC
+ * pressure follows what was actually allocated for it.
+ */
+
+class Arena {
+ public:
+  static void Install();
+  static size_t Size(const void *ptr, size_t requested);
+  static void GetStats(ArenaStats *stats);
+ private:
+  static void Init();
+  static void *Malloc(size_t size);
+  static void *Calloc(size_t count, size_t size);
+  static void *Realloc(void *ptr, size_t size);
+  static void Free(void *ptr);
+};
+
+} // nodeogg namespace
+
+#endif // NODE_OGG_ARENA_H_
@@ -21,10 +21,20 @@
 
 #include <node.h>
 #include <nan.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <map>
+#include <vector>
 
+#include "arena.h"
 #include "node_buffer.h"
 #include "node_pointer.h"
+#include "ogg_state.h"
+#include "page_index.h"
+#include "probe.h"
+#include "skeleton.h"
 
 #include "ogg/ogg.h"
 
@@ -33,21 +43,176 @@ using namespace node;
 
 namespace nodeogg {
 
-NAN_METHOD(node_ogg_sync_init) {
+/* Runs `worker` right away on the main thread, invoking its callback before
+ * returning. For libogg calls that only touch a handful of bytes this is far
+ * cheaper than the round-trip through the thread pool. */
+static void RunSync(Nan::AsyncWorker *worker) {
+  worker->Execute();
+  worker->WorkComplete();
+  worker->Destroy();
+}
+
+/* Base class of the workers operating on `OggState` instances. The states
+ * passed to `Hold()` are kept alive, and their `destroy()` deferred, until the
+ * worker is deleted on the main thread, but they're done with before the
+ * callback runs, so that it may call straight back into them. The worker runs
+ * on the strand of the first one, which keeps the operations on a state in
+ * order. */
+class StateWorker : public Nan::AsyncWorker {
+ public:
+  explicit StateWorker(Nan::Callback *callback) : Nan::AsyncWorker(callback) { }
+  ~StateWorker () {
+    for (size_t i = 0; i < held.size(); i++) held[i]->Release();
+  }
+  void WorkComplete() {
+    for (size_t i = 0; i < held.size(); i++) held[i]->Done();
+    Nan::AsyncWorker::WorkComplete();
+  }
+  void Hold(OggState *state) {
+    SaveToPersistent(static_cast<uint32_t>(held.size()), state->handle());
+    state->Hold();
+    held.push_back(state);
+  }
+  Strand *GetStrand() {
+    return held.empty() ? NULL : held[0]->GetStrand();
+  }
+ private:
+  std::vector<OggState *> held;
+};
+
+/* Defines the `name` binding function, which queues the worker returned by
+ * `name_worker()` on the binding's thread pool, and its `name_sync` variant.
+ * The `name_worker()` functions return NULL after throwing on bad arguments. */
+#define WORKER_METHOD(name) \
+  NAN_METHOD(node_##name) { \
+    Nan::HandleScope scope; \
+    StateWorker *worker = name##_worker(info); \
+    if (worker != NULL) { \
+      AddonData::From(info)->completions->Queue(worker, worker->GetStrand()); \
+    } \
+  } \
+  NAN_METHOD(node_##name##_sync) { \
+    Nan::HandleScope scope; \
+    StateWorker *worker = name##_worker(info); \
+    if (worker != NULL) RunSync(worker); \
+  }
+
+/* Whether `page` was filled with the poison byte of lib/struct-pool.js, which
+ * it does to structs that were handed back to the pool while debugging. A
+ * pointer made of those bytes can't be a legitimate one. */
+static bool IsRecycled(const ogg_page *page) {
+  const unsigned char *bytes = reinterpret_cast<const unsigned char *>(&page->header);
+  for (size_t i = 0; i < sizeof(page->header); i++) {
+    if (bytes[i] != 0xdb) return false;
+  }
+  return true;
+}
+
+/* The `ogg_sync_state` calls below are made straight from JS, outside of the
+ * state's strand, so they must not run while a worker is still at the state:
+ * `ogg_sync_buffer()` may even move `oy.data` from under it. Throws if one
+ * is. Callbacks of workers on the state are fine, it's done with by then. */
+static bool IsBusy(OggState *state, const char *name) {
+  if (!state->IsBusy()) return false;
+  char message[128];
+  snprintf(message, sizeof(message), "%s() called while a write is in progress", name);
+  Nan::ThrowError(message);
+  return true;
+}
+
+/* Exposes the `size` bytes at the fill mark of the `ogg_sync_state` as a Buffer,
+ * so that data can be read directly into it. Only valid until the next call
+ * that touches the `ogg_sync_state`. */
+NAN_METHOD(node_ogg_sync_buffer) {
+  Nan::HandleScope scope;
+  AddonData *addon = AddonData::From(info);
+  OggSyncState *state = OggSyncState::From(addon, info[0]);
+  if (state == NULL || IsBusy(state, "ogg_sync_buffer")) return;
+  long size = static_cast<long>(Nan::To<double>(info[1]).FromJust());
+  char *buffer = ogg_sync_buffer(&state->oy, size);
+  state->Account();
+  if (buffer == NULL) {
+    return Nan::ThrowError("ogg_sync_buffer() failed");
+  }
+  info.GetReturnValue().Set(WrapPointer(buffer, size).ToLocalChecked());
+}
+
+NAN_METHOD(node_ogg_sync_wrote) {
+  Nan::HandleScope scope;
+  AddonData *addon = AddonData::From(info);
+  OggSyncState *state = OggSyncState::From(addon, info[0]);
+  if (state == NULL || IsBusy(state, "ogg_sync_wrote")) return;
+  long bytes = static_cast<long>(Nan::To<double>(info[1]).FromJust());
+  info.GetReturnValue().Set(Nan::New<Integer>(ogg_sync_wrote(&state->oy, bytes)));
+}
+
+/* Drops all the data buffered in the `ogg_sync_state`, i.e. before reading from
+ * another offset of the file. */
+NAN_METHOD(node_ogg_sync_reset) {
+  Nan::HandleScope scope;
+  AddonData *addon = AddonData::From(info);
+  OggSyncState *state = OggSyncState::From(addon, info[0]);
+  if (state == NULL || IsBusy(state, "ogg_sync_reset")) return;
+  info.GetReturnValue().Set(Nan::New<Integer>(ogg_sync_reset(&state->oy)));
+}
+
+/* Has the checksum of only 1 in every `interval` pages verified, or of none at
+ * all when `interval` is 0. */
+NAN_METHOD(node_ogg_sync_set_verify) {
+  Nan::HandleScope scope;
+  AddonData *addon = AddonData::From(info);
+  OggSyncState *state = OggSyncState::From(addon, info[0]);
+  if (state == NULL) return;
+  int interval = static_cast<int>(Nan::To<int32_t>(info[1]).FromJust());
+  info.GetReturnValue().Set(Nan::New<Integer>(ogg_sync_set_verify(&state->oy, interval)));
+}
+
+/* Returns the number of pages whose checksum was verified, and skipped. Not to
+ * be called while a write is in progress. */
+NAN_METHOD(node_ogg_sync_stats) {
+  Nan::HandleScope scope;
+  AddonData *addon = AddonData::From(info);
+  OggSyncState *state = OggSyncState::From(addon, info[0]);
+  if (state == NULL) return;
+  Local<Object> stats = Nan::New<Object>();
+  Nan::Set(stats, Nan::New<String>("verified").ToLocalChecked(),
+    Nan::New<Number>(static_cast<double>(state->oy.pages_verified)));
+  Nan::Set(stats, Nan::New<String>("skipped").ToLocalChecked(),
+    Nan::New<Number>(static_cast<double>(state->oy.pages_skipped)));
+  info.GetReturnValue().Set(stats);
+}
+
+/* Drops the pages and packets buffered in the `ogg_stream_state`, so that it
+ * picks up from whatever page gets submitted next. */
+NAN_METHOD(node_ogg_stream_reset) {
+  Nan::HandleScope scope;
+  AddonData *addon = AddonData::From(info);
+  OggStreamState *state = OggStreamState::From(addon, info[0]);
+  if (state == NULL) return;
+  info.GetReturnValue().Set(Nan::New<Integer>(ogg_stream_reset(&state->os)));
+}
+
+/* Makes room in the `ogg_stream_state` for a packet of `bytes` bytes ahead of
+ * time, so that it doesn't get there a reallocation at a time. */
+NAN_METHOD(node_ogg_stream_reserve) {
   Nan::HandleScope scope;
-  ogg_sync_state *oy = reinterpret_cast<ogg_sync_state *>(UnwrapPointer(info[0]));
-  Local<Value> rtn = Nan::New<Integer>(ogg_sync_init(oy));
-  info.GetReturnValue().Set(rtn);
+  AddonData *addon = AddonData::From(info);
+  OggStreamState *state = OggStreamState::From(addon, info[0]);
+  if (state == NULL) return;
+  long bytes = static_cast<long>(Nan::To<double>(info[1]).FromJust());
+  int r = ogg_stream_reserve(&state->os, bytes);
+  state->Account();
+  info.GetReturnValue().Set(Nan::New<Integer>(r));
 }
 
 /* combination of "ogg_sync_buffer", "memcpy", and "ogg_sync_wrote" on the thread
  * pool.
  */
-class OggSyncWriteWorker : public Nan::AsyncWorker {
+class OggSyncWriteWorker : public StateWorker {
  public:
   OggSyncWriteWorker(ogg_sync_state *oy, char *buffer, long size,
     Nan::Callback *callback)
-    : Nan::AsyncWorker(callback), oy(oy), buffer(buffer), size(size), rtn(0) { }
+    : StateWorker(callback), oy(oy), buffer(buffer), size(size), rtn(0) { }
   ~OggSyncWriteWorker () { }
   void Execute() {
     char *localBuffer = ogg_sync_buffer(oy, size);
@@ -68,75 +233,117 @@ class OggSyncWriteWorker : public Nan::AsyncWorker {
   int rtn;
 };
 
-NAN_METHOD(node_ogg_sync_write) {
-  Nan::HandleScope scope;
-
-  ogg_sync_state *oy = reinterpret_cast<ogg_sync_state *>(UnwrapPointer(info[0]));
+static StateWorker *ogg_sync_write_worker(Nan::NAN_METHOD_ARGS_TYPE info) {
+  AddonData *addon = AddonData::From(info);
+  OggSyncState *state = OggSyncState::From(addon, info[0]);
+  if (state == NULL) return NULL;
   char *buffer = reinterpret_cast<char *>(UnwrapPointer(info[1]));
-  long size = static_cast<long>(info[2]->NumberValue());
+  long size = static_cast<long>(Nan::To<double>(info[2]).FromJust());
   Nan::Callback *callback = new Nan::Callback(info[3].As<Function>());
 
-  Nan::AsyncQueueWorker(new OggSyncWriteWorker(oy, buffer, size, callback));
+  OggSyncWriteWorker *worker = new OggSyncWriteWorker(&state->oy, buffer, size, callback);
+  worker->Hold(state);
+  return worker;
 }
+WORKER_METHOD(ogg_sync_write)
 
-/* Reads out an `ogg_page` struct. */
-class OggSyncPageoutWorker : public Nan::AsyncWorker {
+/* Reads out an `ogg_page` struct. With `seek`, does so through
+ * `ogg_sync_pageseek()`, whose return value is the number of bytes that were
+ * skipped (negative) or that make up the page (positive). */
+class OggSyncPageoutWorker : public StateWorker {
  public:
-  OggSyncPageoutWorker (ogg_sync_state *oy, ogg_page *page, Nan::Callback *callback)
-    : Nan::AsyncWorker(callback), oy(oy), page(page), serialno(-1), packets(-1), rtn(0)
+  OggSyncPageoutWorker (ogg_sync_state *oy, ogg_page *page, ogg_page_desc *desc,
+      bool seek, Nan::Callback *callback)
+    : StateWorker(callback), oy(oy), page(page), desc(desc), seek(seek), serialno(-1),
+      packets(-1), bytes(-1), buffered(0), rtn(0)
     { }
   ~OggSyncPageoutWorker () { }
   void Execute () {
-    rtn = ogg_sync_pageout(oy, page);
-    if (rtn == 1) {
-      serialno = ogg_page_serialno(page);
-      packets = ogg_page_packets(page);
+    ogg_page_desc scratch;
+    ogg_page_desc *d = desc != NULL ? desc : &scratch;
+    rtn = seek ? ogg_sync_pageseek(oy, page) : ogg_sync_pageout(oy, page);
+    if (rtn > 0) {
+      /* can't fail on a page libogg has just synced to */
+      if (ogg_page_describe(page, d) != 0) rtn = -1;
+      serialno = d->serialno;
+      packets = d->packets;
+      bytes = d->header_len + d->body_len;
     }
+    buffered = oy->fill - oy->returned;
   }
   void HandleOKCallback () {
     Nan::HandleScope scope;
 
-    v8::Local<Value> argv[3] = {
-      Nan::New<Integer>(rtn),
+    v8::Local<Value> argv[5] = {
+      Nan::New<Number>(rtn),
       Nan::New<Integer>(serialno),
-      Nan::New<Integer>(packets)
+      Nan::New<Integer>(packets),
+      Nan::New<Number>(bytes),
+      Nan::New<Number>(buffered)
     };
 
-    callback->Call(3, argv);
+    callback->Call(5, argv);
   }
  private:
   ogg_sync_state *oy;
   ogg_page *page;
+  ogg_page_desc *desc;
+  bool seek;
   int serialno;
   int packets;
-  int rtn;
+  long bytes;
+  /* bytes left in the `ogg_sync_state` */
+  long buffered;
+  long rtn;
 };
 
-NAN_METHOD(node_ogg_sync_pageout) {
-  Nan::HandleScope scope;
-
-  ogg_sync_state *oy = reinterpret_cast<ogg_sync_state *>(UnwrapPointer(info[0]));
+/* Reads out an `ogg_page` struct, and describes it into an `ogg_page_desc`
+ * struct. */
+static StateWorker *ogg_sync_pageout_worker(Nan::NAN_METHOD_ARGS_TYPE info) {
+  AddonData *addon = AddonData::From(info);
+  OggSyncState *state = OggSyncState::From(addon, info[0]);
+  if (state == NULL) return NULL;
   ogg_page *page = reinterpret_cast<ogg_page *>(UnwrapPointer(info[1]));
-  Nan::Callback *callback = new Nan::Callback(info[2].As<Function>());
+  ogg_page_desc *desc = reinterpret_cast<ogg_page_desc *>(UnwrapPointer(info[2]));
+  Nan::Callback *callback = new Nan::Callback(info[3].As<Function>());
 
-  Nan::AsyncQueueWorker(new OggSyncPageoutWorker(oy, page, callback));
+  OggSyncPageoutWorker *worker = new OggSyncPageoutWorker(&state->oy, page, desc, false, callback);
+  worker->Hold(state);
+  return worker;
 }
+WORKER_METHOD(ogg_sync_pageout)
+
+/* Same as "ogg_sync_pageout", but without looking for the next capture
+ * pattern: the callback gets the byte count of what was skipped or read out,
+ * so that the caller can tell the page's offset in the file. */
+static StateWorker *ogg_sync_pageseek_worker(Nan::NAN_METHOD_ARGS_TYPE info) {
+  AddonData *addon = AddonData::From(info);
+  OggSyncState *state = OggSyncState::From(addon, info[0]);
+  if (state == NULL) return NULL;
+  ogg_page *page = reinterpret_cast<ogg_page *>(UnwrapPointer(info[1]));
+  ogg_page_desc *desc = reinterpret_cast<ogg_page_desc *>(UnwrapPointer(info[2]));
+  Nan::Callback *callback = new Nan::Callback(info[3].As<Function>());
 
-NAN_METHOD(node_ogg_stream_init) {
-  Nan::HandleScope scope;
-  ogg_stream_state *os = reinterpret_cast<ogg_stream_state *>(UnwrapPointer(info[0]));
-  int serialno = static_cast<int>(info[1]->IntegerValue());
-  info.GetReturnValue().Set(Nan::New<Integer>(ogg_stream_init(os, serialno)));
+  OggSyncPageoutWorker *worker = new OggSyncPageoutWorker(&state->oy, page, desc, true, callback);
+  worker->Hold(state);
+  return worker;
 }
+WORKER_METHOD(ogg_sync_pageseek)
 
 
 /* Writes a `ogg_page` struct into a `ogg_stream_state`. */
-class OggStreamPageinWorker : public Nan::AsyncWorker {
+class OggStreamPageinWorker : public StateWorker {
  public:
-  OggStreamPageinWorker(ogg_stream_state *os, ogg_page *page, Nan::Callback *callback)
-    : Nan::AsyncWorker(callback), os(os), page(page), rtn(0) { }
+  OggStreamPageinWorker(ogg_stream_state *os, ogg_page *page, const ogg_page_desc *desc,
+      Nan::Callback *callback)
+    : StateWorker(callback), os(os), page(page), desc(desc), rtn(0) { }
   void Execute () {
-    rtn = ogg_stream_pagein(os, page);
+    /* the header was decoded by "ogg_sync_pageout" already */
+    if (desc != NULL) {
+      rtn = ogg_stream_pagein_desc(os, page, desc, 0);
+    } else {
+      rtn = ogg_stream_pagein(os, page);
+    }
   }
   void HandleOKCallback () {
     Nan::HandleScope scope;
@@ -148,25 +355,34 @@ class OggStreamPageinWorker : public Nan::AsyncWorker {
  private:
   ogg_stream_state *os;
   ogg_page *page;
+  const ogg_page_desc *desc;
   int rtn;
 };
 
-NAN_METHOD(node_ogg_stream_pagein) {
-  Nan::HandleScope scope;
-
-  ogg_stream_state *os = reinterpret_cast<ogg_stream_state *>(UnwrapPointer(info[0]));
+static StateWorker *ogg_stream_pagein_worker(Nan::NAN_METHOD_ARGS_TYPE info) {
+  AddonData *addon = AddonData::From(info);
+  OggStreamState *state = OggStreamState::From(addon, info[0]);
+  if (state == NULL) return NULL;
   ogg_page *page = reinterpret_cast<ogg_page *>(UnwrapPointer(info[1]));
-  Nan::Callback *callback = new Nan::Callback(info[2].As<Function>());
+  if (IsRecycled(page)) {
+    Nan::ThrowError("ogg_stream_pagein() called with a recycled ogg_page");
+    return NULL;
+  }
+  const ogg_page_desc *desc = reinterpret_cast<ogg_page_desc *>(UnwrapPointer(info[2]));
+  Nan::Callback *callback = new Nan::Callback(info[3].As<Function>());
 
-  Nan::AsyncQueueWorker(new OggStreamPageinWorker(os, page, callback));
+  OggStreamPageinWorker *worker = new OggStreamPageinWorker(&state->os, page, desc, callback);
+  worker->Hold(state);
+  return worker;
 }
+WORKER_METHOD(ogg_stream_pagein)
 
 
 /* Reads a `ogg_packet` struct from a `ogg_stream_state`. */
-class OggStreamPacketoutWorker : public Nan::AsyncWorker {
+class OggStreamPacketoutWorker : public StateWorker {
  public:
   OggStreamPacketoutWorker (ogg_stream_state *os, ogg_packet *packet, Nan::Callback *callback)
-    : Nan::AsyncWorker(callback), os(os), packet(packet), rtn(0) { }
+    : StateWorker(callback), os(os), packet(packet), rtn(0) { }
   ~OggStreamPacketoutWorker () { }
   void Execute () {
     rtn = ogg_stream_packetout(os, packet);
@@ -198,22 +414,25 @@ class OggStreamPacketoutWorker : public Nan::AsyncWorker {
   int rtn;
 };
 
-NAN_METHOD(node_ogg_stream_packetout) {
-  Nan::HandleScope scope;
-
-  ogg_stream_state *os = reinterpret_cast<ogg_stream_state *>(UnwrapPointer(info[0]));
+static StateWorker *ogg_stream_packetout_worker(Nan::NAN_METHOD_ARGS_TYPE info) {
+  AddonData *addon = AddonData::From(info);
+  OggStreamState *state = OggStreamState::From(addon, info[0]);
+  if (state == NULL) return NULL;
   ogg_packet *packet = reinterpret_cast<ogg_packet *>(UnwrapPointer(info[1]));
   Nan::Callback *callback = new Nan::Callback(info[2].As<Function>());
 
-  Nan::AsyncQueueWorker(new OggStreamPacketoutWorker(os, packet, callback));
+  OggStreamPacketoutWorker *worker = new OggStreamPacketoutWorker(&state->os, packet, callback);
+  worker->Hold(state);
+  return worker;
 }
+WORKER_METHOD(ogg_stream_packetout)
 
 
 /* Writes a `ogg_packet` struct to a `ogg_stream_state`. */
-class OggStreamPacketinWorker : public Nan::AsyncWorker {
+class OggStreamPacketinWorker : public StateWorker {
  public:
   OggStreamPacketinWorker (ogg_stream_state *os, ogg_packet *packet, Nan::Callback *callback)
-    : Nan::AsyncWorker(callback), os(os), packet(packet), rtn(0) { }
+    : StateWorker(callback), os(os), packet(packet), rtn(0) { }
   ~OggStreamPacketinWorker () { }
   void Execute () {
     rtn = ogg_stream_packetin(os, packet);
@@ -231,22 +450,25 @@ class OggStreamPacketinWorker : public Nan::AsyncWorker {
   int rtn;
 };
 
-NAN_METHOD(node_ogg_stream_packetin) {
-  Nan::HandleScope scope;
-
-  ogg_stream_state *os = reinterpret_cast<ogg_stream_state *>(UnwrapPointer(info[0]));
+static StateWorker *ogg_stream_packetin_worker(Nan::NAN_METHOD_ARGS_TYPE info) {
+  AddonData *addon = AddonData::From(info);
+  OggStreamState *state = OggStreamState::From(addon, info[0]);
+  if (state == NULL) return NULL;
   ogg_packet *packet = reinterpret_cast<ogg_packet *>(UnwrapPointer(info[1]));
   Nan::Callback *callback = new Nan::Callback(info[2].As<Function>());
 
-  Nan::AsyncQueueWorker(new OggStreamPacketinWorker(os, packet, callback));
+  OggStreamPacketinWorker *worker = new OggStreamPacketinWorker(&state->os, packet, callback);
+  worker->Hold(state);
+  return worker;
 }
+WORKER_METHOD(ogg_stream_packetin)
 
 // Since both StreamPageout and StreamFlush have the same HandleOKCallback,
 // this base class deals with both.
-class StreamWorker : public Nan::AsyncWorker {
+class StreamWorker : public StateWorker {
  public:
   StreamWorker(ogg_stream_state *os, ogg_page *page, Nan::Callback *callback)
-      : Nan::AsyncWorker(callback), os(os), page(page), rtn(0) { }
+      : StateWorker(callback), os(os), page(page), rtn(0) { }
   void HandleOKCallback () {
     Nan::HandleScope scope;
 
@@ -283,16 +505,19 @@ class StreamPageoutWorker : public StreamWorker {
 };
 
 /* Reads out a `ogg_page` struct from an `ogg_stream_state`. */
-NAN_METHOD(node_ogg_stream_pageout) {
-  Nan::HandleScope scope;
+static StateWorker *ogg_stream_pageout_worker(Nan::NAN_METHOD_ARGS_TYPE info) {
+  AddonData *addon = AddonData::From(info);
+  OggStreamState *state = OggStreamState::From(addon, info[0]);
+  if (state == NULL) return NULL;
   Nan::Callback *callback = new Nan::Callback(info[2].As<Function>());
 
-  Nan::AsyncQueueWorker(
-    new StreamPageoutWorker(
-      reinterpret_cast<ogg_stream_state *>(UnwrapPointer(info[0])),
+  StreamPageoutWorker *worker = new StreamPageoutWorker(&state->os,
       reinterpret_cast<ogg_page *>(UnwrapPointer(info[1])),
-      callback));
+      callback);
+  worker->Hold(state);
+  return worker;
 }
+WORKER_METHOD(ogg_stream_pageout)
 
 class StreamFlushWorker : public StreamWorker {
  public:
@@ -305,22 +530,523 @@ class StreamFlushWorker : public StreamWorker {
 };
 
 /* Forces an `ogg_page` struct to be flushed from an `ogg_stream_state`. */
-NAN_METHOD(node_ogg_stream_flush) {
-  Nan::HandleScope scope;
+static StateWorker *ogg_stream_flush_worker(Nan::NAN_METHOD_ARGS_TYPE info) {
+  AddonData *addon = AddonData::From(info);
+  OggStreamState *state = OggStreamState::From(addon, info[0]);
+  if (state == NULL) return NULL;
   Nan::Callback *callback = new Nan::Callback(info[2].As<Function>());
 
-  Nan::AsyncQueueWorker(
-    new StreamFlushWorker(
-      reinterpret_cast<ogg_stream_state *>(UnwrapPointer(info[0])),
+  StreamFlushWorker *worker = new StreamFlushWorker(&state->os,
       reinterpret_cast<ogg_page *>(UnwrapPointer(info[1])),
-      callback));
+      callback);
+  worker->Hold(state);
+  return worker;
+}
+WORKER_METHOD(ogg_stream_flush)
+
+/* One packet for `OggStreamIovecinWorker`, made of `count` fragments starting
+ * at index `first` of the worker's `ogg_iovec_t` array. */
+struct IovecPacket {
+  size_t first;
+  int count;
+  long e_o_s;
+  ogg_int64_t granulepos;
+};
+
+enum IovecinMode { IOVECIN_NONE, IOVECIN_PAGEOUT, IOVECIN_FLUSH };
+
+/* or'ed into the mode: the packet Buffers are referenced rather than copied,
+ * see `ogg_stream_iovecin_ref()` */
+#define IOVECIN_REF 0x10
+
+/* combination of "ogg_stream_iovecin" for every packet in a batch, followed by
+ * "ogg_stream_pageout" (or "ogg_stream_flush") until no more pages come out,
+ * all in one trip to the thread pool. The pages are flattened into Buffers,
+ * since the `ogg_page` pointers are only good until the next call.
+ *
+ * With IOVECIN_REF, only the page headers are copied out, and the length of
+ * each page body is passed along instead. The bodies are made of the bytes of
+ * the packet Buffers, in order, which JS keeps around until they're paged out
+ * and slices itself.
+ */
+class OggStreamIovecinWorker : public StateWorker {
+ public:
+  OggStreamIovecinWorker(ogg_stream_state *os, int mode, Nan::Callback *callback)
+    : StateWorker(callback), os(os), mode(static_cast<IovecinMode>(mode & ~IOVECIN_REF)),
+      ref((mode & IOVECIN_REF) != 0), e_o_s(0), bytes(0), rtn(0) { }
+  ~OggStreamIovecinWorker () {
+    for (size_t i = 0; i < pages.size(); i++) free(pages[i].first);
+  }
+  void Execute () {
+    static ogg_iovec_t empty = { NULL, 0 };
+
+    for (size_t i = 0; i < packets.size(); i++) {
+      IovecPacket &p = packets[i];
+      ogg_iovec_t *v = p.count > 0 ? &iov[p.first] : &empty;
+      int count = p.count > 0 ? p.count : 1;
+      if (ref) {
+        rtn = ogg_stream_iovecin_ref(os, v, count, p.e_o_s, p.granulepos);
+      } else {
+        rtn = ogg_stream_iovecin(os, v, count, p.e_o_s, p.granulepos);
+      }
+      if (rtn != 0) return;
+    }
+
+    if (mode == IOVECIN_NONE) return;
+    if (ref) {
+      PageoutRefs();
+      return;
+    }
+    for (;;) {
+      ogg_page og;
+      int r = mode == IOVECIN_FLUSH ? ogg_stream_flush(os, &og) : ogg_stream_pageout(os, &og);
+      if (r == 0) break;
+
+      long size = og.header_len + og.body_len;
+      char *data = static_cast<char *>(malloc(size));
+      if (data == NULL) {
+        rtn = -1;
+        return;
+      }
+      memcpy(data, og.header, og.header_len);
+      memcpy(data + og.header_len, og.body, og.body_len);
+      pages.push_back(std::make_pair(data, size));
+      bytes += og.body_len;
+      if (ogg_page_eos(&og)) e_o_s = 1;
+    }
+  }
+  /* The IOVECIN_REF pageout loop: the bodies stay where they are. */
+  void PageoutRefs () {
+    for (;;) {
+      ogg_page_iov og;
+      int r = mode == IOVECIN_FLUSH ? ogg_stream_flush_iov(os, &og) : ogg_stream_pageout_iov(os, &og);
+      if (r == 0) break;
+
+      char *header = static_cast<char *>(malloc(og.header_len));
+      if (header == NULL) {
+        rtn = -1;
+        return;
+      }
+      memcpy(header, og.header, og.header_len);
+      pages.push_back(std::make_pair(header, og.header_len));
+      bodies.push_back(og.body_len);
+      bytes += og.body_len;
+      if (og.header[5] & 0x04) e_o_s = 1;
+    }
+  }
+  void HandleOKCallback () {
+    Nan::HandleScope scope;
+
+    Local<Array> out = Nan::New<Array>(static_cast<int>(pages.size()));
+    for (size_t i = 0; i < pages.size(); i++) {
+      Nan::Set(out, static_cast<uint32_t>(i),
+        Nan::NewBuffer(pages[i].first, pages[i].second).ToLocalChecked());
+    }
+    pages.clear();
+
+    Local<Array> lengths = Nan::New<Array>(static_cast<int>(bodies.size()));
+    for (size_t i = 0; i < bodies.size(); i++) {
+      Nan::Set(lengths, static_cast<uint32_t>(i), Nan::New<Number>(bodies[i]));
+    }
+
+    v8::Local<Value> argv[5] = {
+      Nan::New<Integer>(rtn),
+      out,
+      Nan::New<Integer>(e_o_s),
+      Nan::New<Number>(bytes),
+      lengths
+    };
+
+    callback->Call(5, argv);
+  }
+
+  /* Adds the packet `value` to the batch, either an `ogg_packet` struct
+   * Buffer, or an object with a "packet" Buffer (or Array of Buffer
+   * fragments), and "e_o_s" and "granulepos" fields. */
+  void AddPacket(Local<Value> value) {
+    IovecPacket p;
+    p.first = iov.size();
+    p.count = 0;
+
+    if (node::Buffer::HasInstance(value)) {
+      ogg_packet *op = UnwrapPointer<ogg_packet *>(value);
+      ogg_iovec_t fragment = { op->packet, static_cast<size_t>(op->bytes) };
+      iov.push_back(fragment);
+      p.count = 1;
+      p.e_o_s = op->e_o_s;
+      p.granulepos = op->granulepos;
+    } else {
+      Local<Object> obj = value.As<Object>();
+      Local<Value> data = Nan::Get(obj, Nan::New<String>("packet").ToLocalChecked()).ToLocalChecked();
+      if (data->IsArray()) {
+        Local<Array> fragments = data.As<Array>();
+        for (uint32_t i = 0; i < fragments->Length(); i++) {
+          AddFragment(Nan::Get(fragments, i).ToLocalChecked());
+          p.count++;
+        }
+      } else {
+        AddFragment(data);
+        p.count = 1;
+      }
+      p.e_o_s = static_cast<long>(Nan::To<int64_t>(
+        Nan::Get(obj, Nan::New<String>("e_o_s").ToLocalChecked()).ToLocalChecked()).FromJust());
+      p.granulepos = static_cast<ogg_int64_t>(Nan::To<double>(
+        Nan::Get(obj, Nan::New<String>("granulepos").ToLocalChecked()).ToLocalChecked()).FromJust());
+    }
+
+    packets.push_back(p);
+  }
+ private:
+  void AddFragment(Local<Value> buffer) {
+    ogg_iovec_t fragment = { UnwrapPointer(buffer), node::Buffer::Length(buffer) };
+    iov.push_back(fragment);
+  }
+
+  ogg_stream_state *os;
+  IovecinMode mode;
+  bool ref;
+  std::vector<ogg_iovec_t> iov;
+  std::vector<IovecPacket> packets;
+  std::vector<std::pair<char *, long> > pages;
+  std::vector<long> bodies;
+  int e_o_s;
+  long bytes;
+  int rtn;
+};
+
+static StateWorker *ogg_stream_iovecin_worker(Nan::NAN_METHOD_ARGS_TYPE info) {
+  AddonData *addon = AddonData::From(info);
+  OggStreamState *state = OggStreamState::From(addon, info[0]);
+  if (state == NULL) return NULL;
+  Local<Array> packets = info[1].As<Array>();
+  int mode = Nan::To<int32_t>(info[2]).FromJust();
+  Nan::Callback *callback = new Nan::Callback(info[3].As<Function>());
+
+  OggStreamIovecinWorker *worker = new OggStreamIovecinWorker(&state->os, mode, callback);
+  worker->Hold(state);
+  for (uint32_t i = 0; i < packets->Length(); i++) {
+    worker->AddPacket(Nan::Get(packets, i).ToLocalChecked());
+  }
+  /* keep the packet Buffers alive while the worker is reading from them */
+  worker->SaveToPersistent("packets", packets);
+  return worker;
+}
+WORKER_METHOD(ogg_stream_iovecin)
+
+/* Frees an `ogg_stream_state` created by the demux worker that never made it
+ * into an `OggStreamState`. */
+static void free_stream_state(ogg_stream_state *os) {
+  ogg_stream_clear(os);
+  free(os);
+}
+
+/* Immutable, ref-counted copy of a page body. Packets that lie entirely within
+ * the page get handed to JS as external Buffers pointing into it, each holding
+ * a reference, so the slab is freed once the last of them is garbage collected.
+ * References are only ever taken and dropped on the main thread. */
+struct PageSlab {
+  unsigned char *data;
+  long size;
+  long refs;
+};
+
+static PageSlab *slab_new(const unsigned char *body, long size) {
+  PageSlab *slab = static_cast<PageSlab *>(malloc(sizeof(PageSlab) + size));
+  if (slab == NULL) return NULL;
+  slab->data = reinterpret_cast<unsigned char *>(slab + 1);
+  slab->size = size;
+  slab->refs = 1;
+  memcpy(slab->data, body, size);
+  return slab;
+}
+
+static void slab_unref(PageSlab *slab) {
+  if (--slab->refs == 0) free(slab);
+}
+
+static bool slab_contains(PageSlab *slab, const unsigned char *data) {
+  return slab != NULL && data >= slab->data && data < slab->data + slab->size;
+}
+
+/* free callback of the packet Buffers pointing into a `PageSlab` */
+static void free_slab_ref(char *data, void *hint) {
+  slab_unref(static_cast<PageSlab *>(hint));
+}
+
+/* A page read out of the `ogg_sync_state`, along with the packets that
+ * `ogg_stream_packetout()` returned after it was submitted to its stream. */
+struct DemuxPage {
+  ogg_page page;
+  ogg_page_desc desc;
+  ogg_stream_state *created;
+  PageSlab *slab;
+  std::vector<ogg_packet> out;
+};
+
+/* combination of "ogg_sync_write", and then "ogg_sync_pageout",
+ * "ogg_stream_pagein" and "ogg_stream_packetout" until libogg needs more data,
+ * all in a single trip to the thread pool. Pages with a serialno that isn't in
+ * `states` get a brand new `ogg_stream_state`. The packet data gets copied out,
+ * since the next "pagein" on the same stream would invalidate it: either into
+ * a buffer of its own, or, in "slabs" mode, by copying the page body once into
+ * a `PageSlab` that all the packets contained in the page point into.
+ */
+class OggSyncDemuxWorker : public StateWorker {
+ public:
+  OggSyncDemuxWorker(AddonData *addon, ogg_sync_state *oy, char *buffer, long size,
+    const std::map<int, ogg_stream_state *> &states, bool slabs, long reserve,
+    Nan::Callback *callback)
+    : StateWorker(callback), addon(addon), oy(oy), buffer(buffer), size(size),
+      states(states), slabs(slabs), reserve(reserve), failed(NULL), rtn(0) { }
+  ~OggSyncDemuxWorker () {
+    /* anything that didn't make it over to JS land */
+    for (size_t i = 0; i < pages.size(); i++) {
+      DemuxPage &p = pages[i];
+      if (p.created) free_stream_state(p.created);
+      for (size_t j = 0; j < p.out.size(); j++) {
+        if (!slab_contains(p.slab, p.out[j].packet)) free(p.out[j].packet);
+      }
+      if (p.slab) slab_unref(p.slab);
+    }
+  }
+  void Execute () {
+    if (size > 0) {
+      char *localBuffer = ogg_sync_buffer(oy, size);
+      if (localBuffer == NULL) {
+        rtn = -1;
+        failed = "ogg_sync_write";
+        return;
+      }
+      memcpy(localBuffer, buffer, size);
+      rtn = ogg_sync_wrote(oy, size);
+      if (rtn != 0) {
+        failed = "ogg_sync_write";
+        return;
+      }
+    }
+
+    /* the page checksum gets verified by "ogg_stream_pagein_checked", as it
+     * copies the page body, rather than in a pass of its own. When only some
+     * pages get verified (see "ogg_sync_set_verify"), "ogg_sync_pageout"
+     * takes care of it instead */
+    bool fused = oy->verify_interval == 0 || oy->verify_interval == 1;
+
+    for (;;) {
+      ogg_page page;
+      int r = fused ? ogg_sync_pageout_unchecked(oy, &page) : ogg_sync_pageout(oy, &page);
+      if (r == 0) break; /* need more data */
+      if (r != 1) {
+        rtn = r;
+        failed = "ogg_sync_pageout";
+        return;
+      }
+
+      /* the header gets decoded once, here, for the stream lookup, the
+       * pagein and JS land alike */
+      ogg_page_desc desc;
+      if (ogg_page_describe(&page, &desc) != 0) {
+        rtn = -1;
+        failed = "ogg_page_describe";
+        return;
+      }
+      int serialno = desc.serialno;
+      ogg_stream_state *os;
+      ogg_stream_state *created = NULL;
+      std::map<int, ogg_stream_state *>::iterator it = states.find(serialno);
+      /* a BOS page after the EOS of its serial number starts a stream anew */
+      if (it != states.end() && desc.bos && it->second->e_o_s) it = states.end();
+      if (it != states.end()) {
+        os = it->second;
+        rtn = ogg_stream_pagein_desc(os, &page, &desc, fused);
+      } else {
+        /* don't start a stream for something that isn't even a page */
+        if (fused && ogg_page_checksum_check(&page) != 0) {
+          rtn = -2;
+        } else {
+          os = created = static_cast<ogg_stream_state *>(malloc(sizeof(ogg_stream_state)));
+          rtn = os == NULL ? -1 : ogg_stream_init(os, serialno);
+          if (rtn != 0) {
+            if (created) free(created);
+            failed = "ogg_stream_init";
+            return;
+          }
+          if (reserve > 0 && ogg_stream_reserve(os, reserve) != 0) {
+            free_stream_state(created);
+            rtn = -1;
+            failed = "ogg_stream_reserve";
+            return;
+          }
+          states[serialno] = os;
+          rtn = ogg_stream_pagein_desc(os, &page, &desc, 0);
+        }
+      }
+      if (rtn == -2) {
+        /* bad checksum, "ogg_sync_pageout" would have skipped it */
+        rtn = ogg_sync_pagereject(oy, &page);
+        if (rtn != 0) {
+          failed = "ogg_sync_pageout";
+          return;
+        }
+        continue;
+      }
+      /* counted the way "ogg_sync_pageout" would have */
+      if (fused && rtn == 0) oy->pages_verified++;
+
+      pages.push_back(DemuxPage());
+      DemuxPage &p = pages.back();
+      p.page = page;
+      p.desc = desc;
+      p.created = created;
+      p.slab = NULL;
+
+      if (rtn != 0) {
+        failed = "ogg_stream_pagein";
+        return;
+      }
+
+      /* the page body (minus any skipped leading segments) was appended to
+       * `body_data`, so it always ends at the fill mark */
+      long body_start = os->body_fill - page.body_len;
+
+      for (;;) {
+        ogg_packet packet;
+        r = ogg_stream_packetout(os, &packet);
+        if (r == 0) break;
+        /* libogg issued a sync warning (hole in the data), try it again */
+        if (r == -1) continue;
+
+        long offset = static_cast<long>(packet.packet - os->body_data) - body_start;
+        if (slabs && packet.bytes > 0 && offset >= 0 && offset + packet.bytes <= page.body_len) {
+          /* packet is entirely within this page */
+          if (p.slab == NULL) p.slab = slab_new(page.body, page.body_len);
+          if (p.slab != NULL) {
+            packet.packet = p.slab->data + offset;
+            p.out.push_back(packet);
+            continue;
+          }
+        }
+
+        unsigned char *data = static_cast<unsigned char *>(malloc(packet.bytes > 0 ? packet.bytes : 1));
+        if (data == NULL) {
+          rtn = -1;
+          failed = "ogg_stream_packetout";
+          return;
+        }
+        memcpy(data, packet.packet, packet.bytes);
+        packet.packet = data;
+        p.out.push_back(packet);
+      }
+    }
+  }
+  void HandleOKCallback () {
+    Nan::HandleScope scope;
+
+    Local<Array> result = Nan::New<Array>(static_cast<int>(pages.size()));
+    for (size_t i = 0; i < pages.size(); i++) {
+      DemuxPage &p = pages[i];
+      Local<Object> entry = Nan::New<Object>();
+
+      Nan::Set(entry, Nan::New<String>("page").ToLocalChecked(),
+        Nan::CopyBuffer(reinterpret_cast<char *>(&p.page), sizeof(ogg_page)).ToLocalChecked());
+      Nan::Set(entry, Nan::New<String>("desc").ToLocalChecked(),
+        Nan::CopyBuffer(reinterpret_cast<char *>(&p.desc), sizeof(ogg_page_desc)).ToLocalChecked());
+      if (p.created) {
+        Nan::Set(entry, Nan::New<String>("os").ToLocalChecked(),
+          OggStreamState::Adopt(addon, p.created));
+        p.created = NULL;
+      }
+
+      /* each `ogg_packet` Buffer keeps a reference to the Buffer holding its
+       * data, just like `ogg_packet#replace()` does */
+      Local<Array> out = Nan::New<Array>(static_cast<int>(p.out.size()));
+      for (size_t j = 0; j < p.out.size(); j++) {
+        ogg_packet &packet = p.out[j];
+        Local<Object> data;
+        if (slab_contains(p.slab, packet.packet)) {
+          p.slab->refs++;
+          data = Nan::NewBuffer(reinterpret_cast<char *>(packet.packet), packet.bytes,
+            free_slab_ref, p.slab).ToLocalChecked();
+        } else {
+          data = Nan::NewBuffer(reinterpret_cast<char *>(packet.packet),
+            packet.bytes).ToLocalChecked();
+        }
+        Local<Object> buf = Nan::CopyBuffer(reinterpret_cast<char *>(&packet),
+          sizeof(ogg_packet)).ToLocalChecked();
+        Nan::Set(buf, Nan::New<String>("_packet").ToLocalChecked(), data);
+        Nan::Set(out, static_cast<uint32_t>(j), buf);
+      }
+      p.out.clear();
+      if (p.slab) {
+        slab_unref(p.slab);
+        p.slab = NULL;
+      }
+      Nan::Set(entry, Nan::New<String>("out").ToLocalChecked(), out);
+
+      Nan::Set(result, static_cast<uint32_t>(i), entry);
+    }
+
+    v8::Local<Value> argv[3];
+    argv[0] = Nan::New<Integer>(rtn);
+    if (failed) {
+      argv[1] = Nan::New<String>(failed).ToLocalChecked();
+    } else {
+      argv[1] = Nan::Null();
+    }
+    argv[2] = result;
+
+    callback->Call(3, argv);
+  }
+ private:
+  AddonData *addon;
+  ogg_sync_state *oy;
+  char *buffer;
+  long size;
+  std::map<int, ogg_stream_state *> states;
+  bool slabs;
+  long reserve;
+  std::vector<DemuxPage> pages;
+  const char *failed;
+  int rtn;
+};
+
+static StateWorker *ogg_sync_demux_worker(Nan::NAN_METHOD_ARGS_TYPE info) {
+  AddonData *addon = AddonData::From(info);
+  OggSyncState *state = OggSyncState::From(addon, info[0]);
+  if (state == NULL) return NULL;
+  char *buffer = UnwrapPointer(info[1]);
+  long size = buffer == NULL ? 0 : static_cast<long>(Nan::To<double>(info[2]).FromJust());
+  Local<Array> serialnos = info[3].As<Array>();
+  Local<Array> streams = info[4].As<Array>();
+  bool slabs = Nan::To<bool>(info[5]).FromJust();
+  long reserve = static_cast<long>(Nan::To<double>(info[6]).FromJust());
+
+  std::map<int, ogg_stream_state *> states;
+  std::vector<OggStreamState *> held;
+  for (uint32_t i = 0; i < serialnos->Length(); i++) {
+    int serialno = static_cast<int>(Nan::To<int64_t>(Nan::Get(serialnos, i).ToLocalChecked()).FromJust());
+    OggStreamState *stream = OggStreamState::From(addon, Nan::Get(streams, i).ToLocalChecked());
+    if (stream == NULL) return NULL;
+    states[serialno] = &stream->os;
+    held.push_back(stream);
+  }
+
+  Nan::Callback *callback = new Nan::Callback(info[7].As<Function>());
+  OggSyncDemuxWorker *worker = new OggSyncDemuxWorker(addon, &state->oy, buffer, size, states, slabs,
+    reserve, callback);
+  worker->Hold(state);
+  for (size_t i = 0; i < held.size(); i++) worker->Hold(held[i]);
+  return worker;
 }
+WORKER_METHOD(ogg_sync_demux)
 
 /* Converts an `ogg_page` instance to a node Buffer instance */
 NAN_METHOD(node_ogg_page_to_buffer) {
   Nan::HandleScope scope;
 
   ogg_page *op = reinterpret_cast<ogg_page *>(UnwrapPointer(info[0]));
+  if (IsRecycled(op)) {
+    return Nan::ThrowError("ogg_page_to_buffer() called with a recycled ogg_page");
+  }
   unsigned char *buf = reinterpret_cast<unsigned char *>(UnwrapPointer(info[1]));
   memcpy(buf, op->header, op->header_len);
   memcpy(buf + op->header_len, op->body, op->body_len);
@@ -345,60 +1071,360 @@ NAN_METHOD(node_ogg_packet_get_packet) {
 }
 
 
-/* packet->bytes */
-NAN_METHOD(node_ogg_packet_bytes) {
+/* Replaces the `ogg_packet` "packet" pointer with a Node.js buffer instance */
+NAN_METHOD(node_ogg_packet_replace_buffer) {
   Nan::HandleScope scope;
+
   ogg_packet *packet = reinterpret_cast<ogg_packet *>(UnwrapPointer(info[0]));
-  info.GetReturnValue().Set(Nan::New<Number>(packet->bytes));
+  unsigned char *buf = reinterpret_cast<unsigned char *>(UnwrapPointer(info[1]));
+  memcpy(buf, packet->packet, packet->bytes);
+  packet->packet = buf;
+}
+
+
+/* Frees the `AddonData` when the environment (i.e. a Worker) goes away. */
+static void DeleteAddonData(void *arg) {
+  AddonData *addon = static_cast<AddonData *>(arg);
+  addon->completions->Close();
+  delete addon;
 }
 
+/* Walks an ogg file once, writing the index of its pages next to it. Touches no
+ * JS-visible state, so it runs on no particular strand. */
+class PageIndexBuildWorker : public Nan::AsyncWorker {
+ public:
+  PageIndexBuildWorker(const std::string &path, const std::string &index_path,
+      Nan::Callback *callback)
+    : Nan::AsyncWorker(callback), path(path), index_path(index_path), count(0) { }
+  void Execute () {
+    std::string error;
+    if (!PageIndex::Build(path.c_str(), index_path.c_str(), &count, &error)) {
+      SetErrorMessage(error.c_str());
+    }
+  }
+  void HandleOKCallback () {
+    Nan::HandleScope scope;
 
-/* packet->b_o_s */
-NAN_METHOD(node_ogg_packet_b_o_s) {
+    v8::Local<Value> argv[2] = {
+      Nan::Null(),
+      Nan::New<Number>(static_cast<double>(count))
+    };
+
+    callback->Call(2, argv);
+  }
+ private:
+  std::string path;
+  std::string index_path;
+  uint64_t count;
+};
+
+NAN_METHOD(node_page_index_build) {
   Nan::HandleScope scope;
-  ogg_packet *packet = reinterpret_cast<ogg_packet *>(UnwrapPointer(info[0]));
-  info.GetReturnValue().Set(Nan::New<Number>(packet->b_o_s));
+  Nan::Utf8String path(info[0]);
+  Nan::Utf8String index_path(info[1]);
+  Nan::Callback *callback = new Nan::Callback(info[2].As<Function>());
+
+  PageIndexBuildWorker *worker = new PageIndexBuildWorker(*path, *index_path, callback);
+  AddonData::From(info)->completions->Queue(worker, NULL);
 }
 
+static void unmap_page_index(char *data, void *hint) {
+  PageIndex::Unmap(data, reinterpret_cast<uintptr_t>(hint));
+}
 
-/* packet->e_o_s */
-NAN_METHOD(node_ogg_packet_e_o_s) {
+/* Maps a page index into memory, as a Buffer that unmaps it once collected. */
+NAN_METHOD(node_page_index_map) {
   Nan::HandleScope scope;
-  ogg_packet *packet = reinterpret_cast<ogg_packet *>(UnwrapPointer(info[0]));
-  info.GetReturnValue().Set(Nan::New<Number>(packet->e_o_s));
+  Nan::Utf8String index_path(info[0]);
+  std::string error;
+  size_t length;
+  char *data = PageIndex::Map(*index_path, &length, &error);
+  if (data == NULL) {
+    return Nan::ThrowError(error.c_str());
+  }
+  info.GetReturnValue().Set(Nan::NewBuffer(data, length, unmap_page_index,
+    reinterpret_cast<void *>(static_cast<uintptr_t>(length))).ToLocalChecked());
 }
 
+/* Returns the range of entries [begin, end) of a stream. */
+NAN_METHOD(node_page_index_stream) {
+  Nan::HandleScope scope;
+  const char *data = UnwrapPointer(info[0]);
+  if (data == NULL) return Nan::ThrowTypeError("a page index Buffer is required");
+  uint32_t serialno = static_cast<uint32_t>(Nan::To<int32_t>(info[1]).FromJust());
+  uint64_t begin, end;
+  PageIndex::Stream(data, serialno, &begin, &end);
+
+  Local<Array> range = Nan::New<Array>(2);
+  Nan::Set(range, 0, Nan::New<Number>(static_cast<double>(begin)));
+  Nan::Set(range, 1, Nan::New<Number>(static_cast<double>(end)));
+  info.GetReturnValue().Set(range);
+}
 
-/* packet->granulepos */
-NAN_METHOD(node_ogg_packet_granulepos) {
+/* Returns the entry of the first page of a stream at or past a granulepos, or
+ * -1 when there's none. */
+NAN_METHOD(node_page_index_find) {
   Nan::HandleScope scope;
-  ogg_packet *packet = reinterpret_cast<ogg_packet *>(UnwrapPointer(info[0]));
-  info.GetReturnValue().Set(Nan::New<Number>(static_cast<double>(packet->granulepos)));
+  const char *data = UnwrapPointer(info[0]);
+  if (data == NULL) return Nan::ThrowTypeError("a page index Buffer is required");
+  uint32_t serialno = static_cast<uint32_t>(Nan::To<int32_t>(info[1]).FromJust());
+  int64_t granulepos = static_cast<int64_t>(Nan::To<double>(info[2]).FromJust());
+  int64_t i = PageIndex::Find(data, serialno, granulepos);
+  info.GetReturnValue().Set(Nan::New<Number>(static_cast<double>(i)));
 }
 
+/* Finds out the extent of the streams of an ogg file from either end of it. */
+class ProbeWorker : public Nan::AsyncWorker {
+ public:
+  ProbeWorker(const std::string &path, Nan::Callback *callback)
+    : Nan::AsyncWorker(callback), path(path) { }
+  void Execute () {
+    std::string error;
+    if (!Probe::Run(path.c_str(), &result, &error)) {
+      SetErrorMessage(error.c_str());
+    }
+  }
+  void HandleOKCallback () {
+    Nan::HandleScope scope;
+
+    Local<Array> streams = Nan::New<Array>(static_cast<int>(result.streams.size()));
+    for (size_t i = 0; i < result.streams.size(); i++) {
+      const ProbeStream &s = result.streams[i];
+      /* page numbers run on from the BOS page, give or take lost pages */
+      long pages = s.last_pageno == -1 ? 0 : s.last_pageno - s.first_pageno + 1;
+      double bytes = s.last_end > s.first_offset ? static_cast<double>(s.last_end - s.first_offset) : 0;
+      Local<Object> stream = Nan::New<Object>();
+      Nan::Set(stream, Nan::New<String>("serialno").ToLocalChecked(), Nan::New<Integer>(s.serialno));
+      Nan::Set(stream, Nan::New<String>("firstGranulepos").ToLocalChecked(),
+        Nan::New<Number>(static_cast<double>(s.first_granulepos)));
+      Nan::Set(stream, Nan::New<String>("lastGranulepos").ToLocalChecked(),
+        Nan::New<Number>(static_cast<double>(s.last_granulepos)));
+      Nan::Set(stream, Nan::New<String>("pages").ToLocalChecked(),
+        Nan::New<Number>(static_cast<double>(pages)));
+      Nan::Set(stream, Nan::New<String>("bytes").ToLocalChecked(), Nan::New<Number>(bytes));
+      Nan::Set(stream, Nan::New<String>("eos").ToLocalChecked(), Nan::New<Boolean>(s.eos));
+      Nan::Set(streams, static_cast<uint32_t>(i), stream);
+    }
+
+    Local<Object> info = Nan::New<Object>();
+    Nan::Set(info, Nan::New<String>("size").ToLocalChecked(),
+      Nan::New<Number>(static_cast<double>(result.size)));
+    Nan::Set(info, Nan::New<String>("bytesRead").ToLocalChecked(),
+      Nan::New<Number>(static_cast<double>(result.bytes_read)));
+    Nan::Set(info, Nan::New<String>("streams").ToLocalChecked(), streams);
 
-/* packet->packetno */
-NAN_METHOD(node_ogg_packet_packetno) {
+    v8::Local<Value> argv[2] = { Nan::Null(), info };
+
+    callback->Call(2, argv);
+  }
+ private:
+  std::string path;
+  ProbeResult result;
+};
+
+NAN_METHOD(node_probe) {
   Nan::HandleScope scope;
-  ogg_packet *packet = reinterpret_cast<ogg_packet *>(UnwrapPointer(info[0]));
-  info.GetReturnValue().Set(Nan::New<Number>(static_cast<double>(packet->packetno)));
+  Nan::Utf8String path(info[0]);
+  Nan::Callback *callback = new Nan::Callback(info[1].As<Function>());
+
+  ProbeWorker *worker = new ProbeWorker(*path, callback);
+  AddonData::From(info)->completions->Queue(worker, NULL);
 }
 
+/* The fields of a `fishead` packet, as returned to JS. */
+static Local<Object> SkeletonHeadObject(const Skeleton &skeleton) {
+  Local<Object> head = Nan::New<Object>();
+  Nan::Set(head, Nan::New<String>("type").ToLocalChecked(), Nan::New<String>("fishead").ToLocalChecked());
+  Nan::Set(head, Nan::New<String>("versionMajor").ToLocalChecked(), Nan::New<Integer>(skeleton.version_major));
+  Nan::Set(head, Nan::New<String>("versionMinor").ToLocalChecked(), Nan::New<Integer>(skeleton.version_minor));
+  Nan::Set(head, Nan::New<String>("presentationNum").ToLocalChecked(),
+    Nan::New<Number>(static_cast<double>(skeleton.presentation_num)));
+  Nan::Set(head, Nan::New<String>("presentationDen").ToLocalChecked(),
+    Nan::New<Number>(static_cast<double>(skeleton.presentation_den)));
+  Nan::Set(head, Nan::New<String>("basetimeNum").ToLocalChecked(),
+    Nan::New<Number>(static_cast<double>(skeleton.basetime_num)));
+  Nan::Set(head, Nan::New<String>("basetimeDen").ToLocalChecked(),
+    Nan::New<Number>(static_cast<double>(skeleton.basetime_den)));
+  Nan::Set(head, Nan::New<String>("segmentLength").ToLocalChecked(),
+    Nan::New<Number>(static_cast<double>(skeleton.segment_length)));
+  Nan::Set(head, Nan::New<String>("contentOffset").ToLocalChecked(),
+    Nan::New<Number>(static_cast<double>(skeleton.content_offset)));
+  return head;
+}
 
-/* Replaces the `ogg_packet` "packet" pointer with a Node.js buffer instance */
-NAN_METHOD(node_ogg_packet_replace_buffer) {
+/* The fields of the `fisbone` and `index` packets of a stream, as returned to
+ * JS. The keypoints are handed over packed, for "skeleton_find" to search. */
+static Local<Object> SkeletonTrackObject(const SkeletonTrack &track, const char *type) {
+  Local<Object> obj = Nan::New<Object>();
+  Nan::Set(obj, Nan::New<String>("type").ToLocalChecked(), Nan::New<String>(type).ToLocalChecked());
+  Nan::Set(obj, Nan::New<String>("serialno").ToLocalChecked(),
+    Nan::New<Integer>(static_cast<int32_t>(track.serialno)));
+  Nan::Set(obj, Nan::New<String>("headerPackets").ToLocalChecked(), Nan::New<Integer>(track.header_packets));
+  Nan::Set(obj, Nan::New<String>("granulerateNum").ToLocalChecked(),
+    Nan::New<Number>(static_cast<double>(track.granulerate_num)));
+  Nan::Set(obj, Nan::New<String>("granulerateDen").ToLocalChecked(),
+    Nan::New<Number>(static_cast<double>(track.granulerate_den)));
+  Nan::Set(obj, Nan::New<String>("basegranule").ToLocalChecked(),
+    Nan::New<Number>(static_cast<double>(track.basegranule)));
+  Nan::Set(obj, Nan::New<String>("preroll").ToLocalChecked(), Nan::New<Integer>(track.preroll));
+  Nan::Set(obj, Nan::New<String>("granuleshift").ToLocalChecked(), Nan::New<Integer>(track.granuleshift));
+  if (track.has_index) {
+    Nan::Set(obj, Nan::New<String>("timeDen").ToLocalChecked(),
+      Nan::New<Number>(static_cast<double>(track.time_den)));
+    Nan::Set(obj, Nan::New<String>("firstTime").ToLocalChecked(),
+      Nan::New<Number>(static_cast<double>(track.first_time)));
+    Nan::Set(obj, Nan::New<String>("lastTime").ToLocalChecked(),
+      Nan::New<Number>(static_cast<double>(track.last_time)));
+    const char *data = track.keypoints.empty() ? "" :
+      reinterpret_cast<const char *>(&track.keypoints[0]);
+    Nan::Set(obj, Nan::New<String>("keypoints").ToLocalChecked(), Nan::CopyBuffer(data,
+      static_cast<uint32_t>(track.keypoints.size() * sizeof(SkeletonKeypoint))).ToLocalChecked());
+  }
+  return obj;
+}
+
+/* Parses a single Skeleton packet, returning `null` for anything else. */
+NAN_METHOD(node_skeleton_parse) {
   Nan::HandleScope scope;
+  const unsigned char *data = reinterpret_cast<unsigned char *>(UnwrapPointer(info[0]));
+  if (data == NULL) return Nan::ThrowTypeError("a packet Buffer is required");
+  long bytes = static_cast<long>(node::Buffer::Length(info[0].As<Object>()));
+
+  Skeleton skeleton = Skeleton();
+  switch (SkeletonParser::Parse(data, bytes, &skeleton)) {
+    case SKELETON_FISHEAD:
+      info.GetReturnValue().Set(SkeletonHeadObject(skeleton));
+      break;
+    case SKELETON_FISBONE:
+      info.GetReturnValue().Set(SkeletonTrackObject(skeleton.tracks[0], "fisbone"));
+      break;
+    case SKELETON_INDEX:
+      info.GetReturnValue().Set(SkeletonTrackObject(skeleton.tracks[0], "index"));
+      break;
+    default:
+      info.GetReturnValue().SetNull();
+  }
+}
 
-  ogg_packet *packet = reinterpret_cast<ogg_packet *>(UnwrapPointer(info[0]));
-  unsigned char *buf = reinterpret_cast<unsigned char *>(UnwrapPointer(info[1]));
-  memcpy(buf, packet->packet, packet->bytes);
-  packet->packet = buf;
+/* Reads the Skeleton headers at the start of a file. */
+class SkeletonReadWorker : public Nan::AsyncWorker {
+ public:
+  SkeletonReadWorker(uv_file fd, Nan::Callback *callback)
+    : Nan::AsyncWorker(callback), fd(fd), skeleton(), found(false) { }
+  void Execute () {
+    std::string error;
+    if (!SkeletonParser::Read(fd, &skeleton, &found, &error)) {
+      SetErrorMessage(error.c_str());
+    }
+  }
+  void HandleOKCallback () {
+    Nan::HandleScope scope;
+
+    v8::Local<Value> argv[2] = { Nan::Null(), Nan::Null() };
+    if (found) {
+      Local<Object> head = SkeletonHeadObject(skeleton);
+      Local<Array> tracks = Nan::New<Array>(static_cast<int>(skeleton.tracks.size()));
+      for (size_t i = 0; i < skeleton.tracks.size(); i++) {
+        Nan::Set(tracks, static_cast<uint32_t>(i), SkeletonTrackObject(skeleton.tracks[i], "fisbone"));
+      }
+      Nan::Set(head, Nan::New<String>("tracks").ToLocalChecked(), tracks);
+      argv[1] = head;
+    }
+
+    callback->Call(2, argv);
+  }
+ private:
+  uv_file fd;
+  Skeleton skeleton;
+  bool found;
+};
+
+NAN_METHOD(node_skeleton_read) {
+  Nan::HandleScope scope;
+  uv_file fd = static_cast<uv_file>(Nan::To<int32_t>(info[0]).FromJust());
+  Nan::Callback *callback = new Nan::Callback(info[1].As<Function>());
+
+  SkeletonReadWorker *worker = new SkeletonReadWorker(fd, callback);
+  AddonData::From(info)->completions->Queue(worker, NULL);
+}
+
+/* Returns the last keypoint at or before a time, or `null`. */
+NAN_METHOD(node_skeleton_find) {
+  Nan::HandleScope scope;
+  const char *data = UnwrapPointer(info[0]);
+  if (data == NULL) return Nan::ThrowTypeError("a keypoints Buffer is required");
+  size_t count = node::Buffer::Length(info[0].As<Object>()) / sizeof(SkeletonKeypoint);
+  int64_t time = static_cast<int64_t>(Nan::To<double>(info[1]).FromJust());
+
+  const SkeletonKeypoint *keypoint = SkeletonParser::Find(
+    reinterpret_cast<const SkeletonKeypoint *>(data), count, time);
+  if (keypoint == NULL) return info.GetReturnValue().SetNull();
+
+  Local<Object> result = Nan::New<Object>();
+  Nan::Set(result, Nan::New<String>("offset").ToLocalChecked(),
+    Nan::New<Number>(static_cast<double>(keypoint->offset)));
+  Nan::Set(result, Nan::New<String>("time").ToLocalChecked(),
+    Nan::New<Number>(static_cast<double>(keypoint->time)));
+  info.GetReturnValue().Set(result);
+}
+
+/* Sets the number of threads in the binding's thread pool. */
+NAN_METHOD(node_threadpool_resize) {
+  Nan::HandleScope scope;
+  ThreadPool::Resize(static_cast<unsigned int>(Nan::To<uint32_t>(info[0]).FromJust()));
+}
+
+/* Returns a snapshot of the binding's thread pool counters. */
+NAN_METHOD(node_threadpool_stats) {
+  Nan::HandleScope scope;
+  ThreadPoolStats stats;
+  ThreadPool::GetStats(&stats);
+
+  Local<Object> result = Nan::New<Object>();
+  Nan::Set(result, Nan::New<String>("size").ToLocalChecked(), Nan::New<Number>(stats.size));
+  Nan::Set(result, Nan::New<String>("threads").ToLocalChecked(), Nan::New<Number>(stats.threads));
+  Nan::Set(result, Nan::New<String>("queued").ToLocalChecked(), Nan::New<Number>(stats.queued));
+  Nan::Set(result, Nan::New<String>("running").ToLocalChecked(), Nan::New<Number>(stats.running));
+  Nan::Set(result, Nan::New<String>("completed").ToLocalChecked(), Nan::New<Number>(stats.completed));
+  info.GetReturnValue().Set(result);
 }
 
+/* Returns a snapshot of the counters of the allocator libogg runs on. */
+NAN_METHOD(node_arena_stats) {
+  Nan::HandleScope scope;
+  ArenaStats stats;
+  Arena::GetStats(&stats);
+
+  Local<Object> result = Nan::New<Object>();
+  Nan::Set(result, Nan::New<String>("allocated").ToLocalChecked(), Nan::New<Number>(stats.allocated));
+  Nan::Set(result, Nan::New<String>("cached").ToLocalChecked(), Nan::New<Number>(stats.cached));
+  Nan::Set(result, Nan::New<String>("hits").ToLocalChecked(), Nan::New<Number>(stats.hits));
+  Nan::Set(result, Nan::New<String>("misses").ToLocalChecked(), Nan::New<Number>(stats.misses));
+  info.GetReturnValue().Set(result);
+}
+
+/* Like `Nan::SetMethod()`, but hands `data` to `fn` as `info.Data()`. */
+static void SetMethod(Local<Object> target, Local<Value> data, const char *name,
+    Nan::FunctionCallback fn) {
+  Local<FunctionTemplate> t = Nan::New<FunctionTemplate>(fn, data);
+  Local<String> fn_name = Nan::New<String>(name).ToLocalChecked();
+  t->SetClassName(fn_name);
+  Nan::Set(target, fn_name, Nan::GetFunction(t).ToLocalChecked());
+}
 
 NAN_MODULE_INIT(Initialize) {
   Nan::HandleScope scope;
 
+  /* before any libogg state gets created, in this or any other environment */
+  Arena::Install();
+
+  AddonData *addon = new AddonData();
+  addon->completions = new Completions(Nan::GetCurrentEventLoop());
+  Local<Value> data = Nan::New<External>(addon);
+#if NODE_MODULE_VERSION >= NODE_10_0_MODULE_VERSION
+  node::AddEnvironmentCleanupHook(v8::Isolate::GetCurrent(), DeleteAddonData, addon);
+#endif
+
   /* sizeof's */
 #define SIZEOF(value) \
   Nan::ForceSet(target, Nan::New<String>("sizeof_" #value).ToLocalChecked(), \
@@ -408,33 +1434,117 @@ NAN_MODULE_INIT(Initialize) {
   SIZEOF(ogg_stream_state);
   SIZEOF(ogg_page);
   SIZEOF(ogg_packet);
-
-  Nan::SetMethod(target, "ogg_sync_init", node_ogg_sync_init);
-  Nan::SetMethod(target, "ogg_sync_write", node_ogg_sync_write);
-  Nan::SetMethod(target, "ogg_sync_pageout", node_ogg_sync_pageout);
-
-  Nan::SetMethod(target, "ogg_stream_init", node_ogg_stream_init);
-  Nan::SetMethod(target, "ogg_stream_pagein", node_ogg_stream_pagein);
-  Nan::SetMethod(target, "ogg_stream_packetout", node_ogg_stream_packetout);
-  Nan::SetMethod(target, "ogg_stream_packetin", node_ogg_stream_packetin);
-  Nan::SetMethod(target, "ogg_stream_pageout", node_ogg_stream_pageout);
-  Nan::SetMethod(target, "ogg_stream_flush", node_ogg_stream_flush);
+  SIZEOF(ogg_page_desc);
+  SIZEOF(long);
+
+  /* the page index file layout, see page_index.h */
+  typedef PageIndexHeader page_index_header;
+  typedef PageIndexEntry page_index_entry;
+  SIZEOF(page_index_header);
+  SIZEOF(page_index_entry);
+
+  /* offsetof's, so that JS can read `ogg_packet` and `ogg_page_desc` fields straight out of the
+   * struct instead of calling in here for each one */
+#define OFFSETOF(type, member) \
+  Nan::ForceSet(target, Nan::New<String>("offsetof_" #type "_" #member).ToLocalChecked(), \
+      Nan::New<Integer>(static_cast<int32_t>(offsetof(type, member))), \
+      static_cast<PropertyAttribute>(ReadOnly|DontDelete))
+  OFFSETOF(ogg_packet, bytes);
+  OFFSETOF(ogg_packet, b_o_s);
+  OFFSETOF(ogg_packet, e_o_s);
+  OFFSETOF(ogg_packet, granulepos);
+  OFFSETOF(ogg_packet, packetno);
+  OFFSETOF(ogg_page_desc, granulepos);
+  OFFSETOF(ogg_page_desc, pageno);
+  OFFSETOF(ogg_page_desc, header_len);
+  OFFSETOF(ogg_page_desc, body_len);
+  OFFSETOF(ogg_page_desc, lead);
+  OFFSETOF(ogg_page_desc, tail);
+  OFFSETOF(ogg_page_desc, serialno);
+  OFFSETOF(ogg_page_desc, version);
+  OFFSETOF(ogg_page_desc, continued);
+  OFFSETOF(ogg_page_desc, bos);
+  OFFSETOF(ogg_page_desc, eos);
+  OFFSETOF(ogg_page_desc, segments);
+  OFFSETOF(ogg_page_desc, packets);
+  OFFSETOF(page_index_header, count);
+  OFFSETOF(page_index_header, media_size);
+  OFFSETOF(page_index_header, streams);
+  OFFSETOF(page_index_entry, granulepos);
+  OFFSETOF(page_index_entry, offset);
+  OFFSETOF(page_index_entry, serialno);
+  OFFSETOF(page_index_entry, pageno);
+  OFFSETOF(page_index_entry, bytes);
+  OFFSETOF(page_index_entry, flags);
+  Nan::Set(target, Nan::New<String>("PAGE_INDEX_CONTINUED").ToLocalChecked(), Nan::New<Integer>(PAGE_INDEX_CONTINUED));
+  Nan::Set(target, Nan::New<String>("PAGE_INDEX_BOS").ToLocalChecked(), Nan::New<Integer>(PAGE_INDEX_BOS));
+  Nan::Set(target, Nan::New<String>("PAGE_INDEX_EOS").ToLocalChecked(), Nan::New<Integer>(PAGE_INDEX_EOS));
+
+  static const uint16_t one = 1;
+  Nan::ForceSet(target, Nan::New<String>("little_endian").ToLocalChecked(),
+      Nan::New<Boolean>(*reinterpret_cast<const uint8_t *>(&one) == 1),
+      static_cast<PropertyAttribute>(ReadOnly|DontDelete));
+
+  OggSyncState::Init(target, addon);
+  OggStreamState::Init(target, addon);
+
+  /* modes for "ogg_stream_iovecin" */
+  Nan::Set(target, Nan::New<String>("IOVECIN_NONE").ToLocalChecked(), Nan::New<Integer>(IOVECIN_NONE));
+  Nan::Set(target, Nan::New<String>("IOVECIN_PAGEOUT").ToLocalChecked(), Nan::New<Integer>(IOVECIN_PAGEOUT));
+  Nan::Set(target, Nan::New<String>("IOVECIN_FLUSH").ToLocalChecked(), Nan::New<Integer>(IOVECIN_FLUSH));
+  Nan::Set(target, Nan::New<String>("IOVECIN_REF").ToLocalChecked(), Nan::New<Integer>(IOVECIN_REF));
+
+  SetMethod(target, data, "ogg_sync_buffer", node_ogg_sync_buffer);
+  SetMethod(target, data, "ogg_sync_wrote", node_ogg_sync_wrote);
+  SetMethod(target, data, "ogg_sync_set_verify", node_ogg_sync_set_verify);
+  SetMethod(target, data, "ogg_sync_stats", node_ogg_sync_stats);
+  SetMethod(target, data, "ogg_sync_write", node_ogg_sync_write);
+  SetMethod(target, data, "ogg_sync_write_sync", node_ogg_sync_write_sync);
+  SetMethod(target, data, "ogg_sync_pageout", node_ogg_sync_pageout);
+  SetMethod(target, data, "ogg_sync_pageout_sync", node_ogg_sync_pageout_sync);
+  SetMethod(target, data, "ogg_sync_pageseek", node_ogg_sync_pageseek);
+  SetMethod(target, data, "ogg_sync_pageseek_sync", node_ogg_sync_pageseek_sync);
+  SetMethod(target, data, "ogg_sync_reset", node_ogg_sync_reset);
+
+  SetMethod(target, data, "ogg_stream_reserve", node_ogg_stream_reserve);
+  SetMethod(target, data, "ogg_stream_reset", node_ogg_stream_reset);
+  SetMethod(target, data, "ogg_stream_pagein", node_ogg_stream_pagein);
+  SetMethod(target, data, "ogg_stream_pagein_sync", node_ogg_stream_pagein_sync);
+  SetMethod(target, data, "ogg_stream_packetout", node_ogg_stream_packetout);
+  SetMethod(target, data, "ogg_stream_packetout_sync", node_ogg_stream_packetout_sync);
+  SetMethod(target, data, "ogg_stream_packetin", node_ogg_stream_packetin);
+  SetMethod(target, data, "ogg_stream_packetin_sync", node_ogg_stream_packetin_sync);
+  SetMethod(target, data, "ogg_stream_pageout", node_ogg_stream_pageout);
+  SetMethod(target, data, "ogg_stream_pageout_sync", node_ogg_stream_pageout_sync);
+  SetMethod(target, data, "ogg_stream_flush", node_ogg_stream_flush);
+  SetMethod(target, data, "ogg_stream_flush_sync", node_ogg_stream_flush_sync);
+  SetMethod(target, data, "ogg_stream_iovecin", node_ogg_stream_iovecin);
+  SetMethod(target, data, "ogg_stream_iovecin_sync", node_ogg_stream_iovecin_sync);
 
   /* custom functions */
-  Nan::SetMethod(target, "ogg_page_to_buffer", node_ogg_page_to_buffer);
-
-  Nan::SetMethod(target, "ogg_packet_set_packet", node_ogg_packet_set_packet);
-  Nan::SetMethod(target, "ogg_packet_get_packet", node_ogg_packet_get_packet);
-  Nan::SetMethod(target, "ogg_packet_bytes", node_ogg_packet_bytes);
-  Nan::SetMethod(target, "ogg_packet_b_o_s", node_ogg_packet_b_o_s);
-  Nan::SetMethod(target, "ogg_packet_e_o_s", node_ogg_packet_e_o_s);
-  Nan::SetMethod(target, "ogg_packet_granulepos", node_ogg_packet_granulepos);
-  Nan::SetMethod(target, "ogg_packet_packetno", node_ogg_packet_packetno);
-  Nan::Set(target, Nan::New<String>("ogg_packet_replace_buffer").ToLocalChecked(),
-    Nan::New<FunctionTemplate>(node_ogg_packet_replace_buffer)->GetFunction());
+  SetMethod(target, data, "ogg_sync_demux", node_ogg_sync_demux);
+  SetMethod(target, data, "ogg_sync_demux_sync", node_ogg_sync_demux_sync);
+  SetMethod(target, data, "ogg_page_to_buffer", node_ogg_page_to_buffer);
+
+  SetMethod(target, data, "ogg_packet_set_packet", node_ogg_packet_set_packet);
+  SetMethod(target, data, "ogg_packet_get_packet", node_ogg_packet_get_packet);
+  SetMethod(target, data, "ogg_packet_replace_buffer", node_ogg_packet_replace_buffer);
+
+  SetMethod(target, data, "threadpool_resize", node_threadpool_resize);
+  SetMethod(target, data, "threadpool_stats", node_threadpool_stats);
+  SetMethod(target, data, "arena_stats", node_arena_stats);
+
+  SetMethod(target, data, "page_index_build", node_page_index_build);
+  SetMethod(target, data, "page_index_map", node_page_index_map);
+  SetMethod(target, data, "page_index_stream", node_page_index_stream);
+  SetMethod(target, data, "page_index_find", node_page_index_find);
+  SetMethod(target, data, "probe", node_probe);
+  SetMethod(target, data, "skeleton_parse", node_skeleton_parse);
+  SetMethod(target, data, "skeleton_read", node_skeleton_read);
+  SetMethod(target, data, "skeleton_find", node_skeleton_find);
 
 }
 
 } // nodeogg namespace
 
-NODE_MODULE(ogg, nodeogg::Initialize)
+NAN_MODULE_WORKER_ENABLED(ogg, nodeogg::Initialize)
@@ -0,0 +1,263 @@
+/*
+ * Copyright (c) 2012, Nathan Rajlich <nathan@tootallnate.net>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+#include "ogg_state.h"
+
+using namespace v8;
+
+namespace nodeogg {
+
+AddonData::~AddonData() {
+  std::set<OggState *> alive;
+  alive.swap(states);
+  for (std::set<OggState *>::iterator it = alive.begin(); it != alive.end(); ++it) {
+    (*it)->Detach();
+  }
+  sync_tpl.Reset();
+  stream_tpl.Reset();
+  stream_constructor.Reset();
+}
+
+
+OggState::OggState(AddonData *addon)
+  : addon(addon), busy(0), working(0), destroying(false), destroyed(false), accounted(0) {
+  addon->states.insert(this);
+}
+
+OggState::~OggState() {
+  if (addon != NULL) addon->states.erase(this);
+}
+
+/* Called when the environment goes away before this object got collected.
+ * The libogg state is cleared unless a worker is still using it, in which case
+ * it has to be leaked. */
+void OggState::Detach() {
+  addon = NULL;
+  if (busy == 0) {
+    Clear();
+    destroyed = true;
+  }
+}
+
+/* Called by a worker before it starts using the state. */
+void OggState::Hold() {
+  busy++;
+  working++;
+}
+
+/* Called by a worker once it no longer touches the state, before its callback
+ * runs. The state is kept alive until it's `Release()`d. */
+void OggState::Done() {
+  working--;
+}
+
+/* Called by a worker once it's done with the state. Carries out a deferred
+ * `destroy()`, and reports whatever libogg allocated in the meantime. */
+void OggState::Release() {
+  if (--busy == 0 && destroying) {
+    destroying = false;
+    Destroy();
+  } else {
+    Account();
+  }
+}
+
+/* Reports the change in libogg's allocations since the last call to V8. */
+void OggState::Account() {
+  if (addon == NULL) return;
+  long storage = destroyed ? 0 : Storage();
+  if (storage != accounted) {
+    Nan::AdjustExternalMemory(static_cast<int>(storage - accounted));
+    accounted = storage;
+  }
+}
+
+void OggState::Destroy() {
+  if (destroyed) return;
+  if (busy > 0) {
+    /* a worker is still using the state, `Release()` finishes the job */
+    destroying = true;
+    return;
+  }
+  Clear();
+  destroyed = true;
+  Account();
+}
+
+/* state.destroy() */
+NAN_METHOD(OggState::JsDestroy) {
+  Nan::HandleScope scope;
+  OggState *state = Nan::ObjectWrap::Unwrap<OggState>(info.Holder());
+  state->Destroy();
+}
+
+/* state.destroyed */
+NAN_GETTER(OggState::JsDestroyed) {
+  Nan::HandleScope scope;
+  OggState *state = Nan::ObjectWrap::Unwrap<OggState>(info.Holder());
+  info.GetReturnValue().Set(Nan::New<Boolean>(state->IsDestroyed()));
+}
+
+void OggState::SetPrototype(Local<FunctionTemplate> tpl) {
+  tpl->InstanceTemplate()->SetInternalFieldCount(1);
+  Nan::SetPrototypeMethod(tpl, "destroy", JsDestroy);
+  Nan::SetAccessor(tpl->InstanceTemplate(),
+    Nan::New<String>("destroyed").ToLocalChecked(), JsDestroyed);
+}
+
+
+OggSyncState::OggSyncState(AddonData *addon) : OggState(addon) {
+  memset(&oy, 0, sizeof(oy));
+}
+
+OggSyncState::~OggSyncState() {
+  Destroy();
+}
+
+void OggSyncState::Clear() {
+  ogg_sync_clear(&oy);
+}
+
+long OggSyncState::Storage() const {
+  return static_cast<long>(Arena::Size(oy.data, oy.storage) +
+    Arena::Size(oy.scratch, oy.scratch_storage));
+}
+
+/* new OggSyncState() */
+NAN_METHOD(OggSyncState::New) {
+  Nan::HandleScope scope;
+  if (!info.IsConstructCall()) {
+    return Nan::ThrowTypeError("OggSyncState must be called with `new`");
+  }
+
+  OggSyncState *state = new OggSyncState(AddonData::From(info));
+  /* a ring buffer never moves the bytes that haven't been returned yet,
+   * however large the chunks getting written are */
+  ogg_sync_init_ring(&state->oy);
+  state->Wrap(info.This());
+  info.GetReturnValue().Set(info.This());
+}
+
+/* Returns the `OggSyncState` wrapped by `value`, or throws and returns NULL if
+ * it isn't one, or has been destroyed. */
+OggSyncState *OggSyncState::From(AddonData *addon, Local<Value> value) {
+  if (!value->IsObject() || !Nan::New(addon->sync_tpl)->HasInstance(value)) {
+    Nan::ThrowTypeError("expected an OggSyncState instance");
+    return NULL;
+  }
+  OggSyncState *state = Nan::ObjectWrap::Unwrap<OggSyncState>(value.As<Object>());
+  if (state->IsDestroyed()) {
+    Nan::ThrowError("OggSyncState has been destroyed");
+    return NULL;
+  }
+  return state;
+}
+
+void OggSyncState::Init(Local<Object> target, AddonData *addon) {
+  Local<FunctionTemplate> t = Nan::New<FunctionTemplate>(New, Nan::New<External>(addon));
+  t->SetClassName(Nan::New<String>("OggSyncState").ToLocalChecked());
+  SetPrototype(t);
+  addon->sync_tpl.Reset(t);
+  Nan::Set(target, Nan::New<String>("OggSyncState").ToLocalChecked(),
+    Nan::GetFunction(t).ToLocalChecked());
+}
+
+
+OggStreamState::OggStreamState(AddonData *addon) : OggState(addon) {
+  memset(&os, 0, sizeof(os));
+}
+
+OggStreamState::~OggStreamState() {
+  Destroy();
+}
+
+void OggStreamState::Clear() {
+  ogg_stream_clear(&os);
+}
+
+long OggStreamState::Storage() const {
+  return static_cast<long>(Arena::Size(os.body_data, os.body_storage) +
+    Arena::Size(os.lacing_vals, os.lacing_storage * sizeof(*os.lacing_vals)) +
+    Arena::Size(os.granule_vals, os.lacing_storage * sizeof(*os.granule_vals)) +
+    Arena::Size(os.crc_vals, os.lacing_storage * sizeof(*os.crc_vals)) +
+    Arena::Size(os.ref_vals, os.ref_storage * sizeof(*os.ref_vals)) +
+    Arena::Size(os.page_vals, os.page_storage * sizeof(*os.page_vals)));
+}
+
+/* new OggStreamState(serialno) */
+NAN_METHOD(OggStreamState::New) {
+  Nan::HandleScope scope;
+  if (!info.IsConstructCall()) {
+    return Nan::ThrowTypeError("OggStreamState must be called with `new`");
+  }
+
+  OggStreamState *state = new OggStreamState(AddonData::From(info));
+  if (info[0]->IsExternal()) {
+    /* an `ogg_stream_state` that was initialized on the thread pool, see
+     * `Adopt()` */
+    ogg_stream_state *os = static_cast<ogg_stream_state *>(info[0].As<External>()->Value());
+    state->os = *os;
+    free(os);
+  } else {
+    int serialno = static_cast<int>(Nan::To<int64_t>(info[0]).FromJust());
+    if (ogg_stream_init(&state->os, serialno) != 0) {
+      delete state;
+      return Nan::ThrowError("ogg_stream_init() failed");
+    }
+  }
+  state->Wrap(info.This());
+  state->Account();
+  info.GetReturnValue().Set(info.This());
+}
+
+/* Returns the `OggStreamState` wrapped by `value`, or throws and returns NULL
+ * if it isn't one, or has been destroyed. */
+OggStreamState *OggStreamState::From(AddonData *addon, Local<Value> value) {
+  if (!value->IsObject() || !Nan::New(addon->stream_tpl)->HasInstance(value)) {
+    Nan::ThrowTypeError("expected an OggStreamState instance");
+    return NULL;
+  }
+  OggStreamState *state = Nan::ObjectWrap::Unwrap<OggStreamState>(value.As<Object>());
+  if (state->IsDestroyed()) {
+    Nan::ThrowError("OggStreamState has been destroyed");
+    return NULL;
+  }
+  return state;
+}
+
+/* Wraps the malloc()'d, already initialized `os` into a new `OggStreamState`
+ * instance, which takes over its contents and frees `os` itself. */
+Local<Object> OggStreamState::Adopt(AddonData *addon, ogg_stream_state *os) {
+  Nan::EscapableHandleScope scope;
+  Local<Value> argv[1] = { Nan::New<External>(os) };
+  return scope.Escape(Nan::NewInstance(Nan::New(addon->stream_constructor), 1, argv).ToLocalChecked());
+}
+
+void OggStreamState::Init(Local<Object> target, AddonData *addon) {
+  Local<FunctionTemplate> t = Nan::New<FunctionTemplate>(New, Nan::New<External>(addon));
+  t->SetClassName(Nan::New<String>("OggStreamState").ToLocalChecked());
+  SetPrototype(t);
+  addon->stream_tpl.Reset(t);
+  addon->stream_constructor.Reset(Nan::GetFunction(t).ToLocalChecked());
+  Nan::Set(target, Nan::New<String>("OggStreamState").ToLocalChecked(),
+    Nan::GetFunction(t).ToLocalChecked());
+}
+
+} // nodeogg namespace
@@ -0,0 +1,135 @@
+/*
+ * Copyright (c) 2012, Nathan Rajlich <nathan@tootallnate.net>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef NODE_OGG_STATE_H_
+#define NODE_OGG_STATE_H_
+
+#include <nan.h>
+#include <set>
+
+#include "ogg/ogg.h"
+#include "thread_pool.h"
+
+namespace nodeogg {
+
+class OggState;
+
+/*
+ * Per-instance data of the addon. Every isolate that loads it (the main
+ * thread, and each `worker_threads` Worker) gets its own, handed to the binding
+ * functions as their `info.Data()`, so no V8 handle is shared between them.
+ * It is deleted when its environment is torn down, which also clears the
+ * libogg state of every object that is still alive at that point.
+ */
+
+struct AddonData {
+  Nan::Persistent<v8::FunctionTemplate> sync_tpl;
+  Nan::Persistent<v8::FunctionTemplate> stream_tpl;
+  Nan::Persistent<v8::Function> stream_constructor;
+  std::set<OggState *> states;
+  Completions *completions;
+
+  ~AddonData();
+
+  static AddonData *From(Nan::NAN_METHOD_ARGS_TYPE info) {
+    return static_cast<AddonData *>(info.Data().As<v8::External>()->Value());
+  }
+};
+
+/*
+ * Base class of the JS objects owning an `ogg_sync_state` or `ogg_stream_state`.
+ * The libogg state is cleared when `destroy()` is called, or when the object
+ * gets garbage collected, whichever comes first. Workers `Hold()` the state
+ * while they use it, in which case `destroy()` is deferred until the last one
+ * `Release()`s it. JS may call into the state again as soon as a worker is
+ * `Done()` with it, i.e. from its callback on. The memory libogg allocated for the state is reported to V8
+ * through `Nan::AdjustExternalMemory()`, so that GC pressure tracks it.
+ * Everything here happens on the JS thread owning the object.
+ */
+
+class OggState : public Nan::ObjectWrap {
+ public:
+  void Hold();
+  void Done();
+  void Release();
+  void Account();
+  bool IsDestroyed() const { return destroyed || destroying; }
+  bool IsBusy() const { return working > 0; }
+  void Detach();
+  Strand *GetStrand() { return &strand; }
+
+ protected:
+  explicit OggState(AddonData *addon);
+  virtual ~OggState();
+
+  /* subclasses must call this from their own destructor, since `Clear()`
+   * can't be dispatched to them from ours */
+  void Destroy();
+  virtual void Clear() = 0;
+  virtual long Storage() const = 0;
+
+  static NAN_METHOD(JsDestroy);
+  static NAN_GETTER(JsDestroyed);
+  static void SetPrototype(v8::Local<v8::FunctionTemplate> tpl);
+
+ private:
+  AddonData *addon;
+  Strand strand;
+  int busy;
+  int working;
+  bool destroying;
+  bool destroyed;
+  long accounted;
+};
+
+/* `ogg_sync_state` */
+class OggSyncState : public OggState {
+ public:
+  static void Init(v8::Local<v8::Object> target, AddonData *addon);
+  static OggSyncState *From(AddonData *addon, v8::Local<v8::Value> value);
+
+  ogg_sync_state oy;
+
+ private:
+  explicit OggSyncState(AddonData *addon);
+  ~OggSyncState();
+  void Clear();
+  long Storage() const;
+
+  static NAN_METHOD(New);
+};
+
+/* `ogg_stream_state` */
+class OggStreamState : public OggState {
+ public:
+  static void Init(v8::Local<v8::Object> target, AddonData *addon);
+  static OggStreamState *From(AddonData *addon, v8::Local<v8::Value> value);
+  static v8::Local<v8::Object> Adopt(AddonData *addon, ogg_stream_state *os);
+
+  ogg_stream_state os;
+
+ private:
+  explicit OggStreamState(AddonData *addon);
+  ~OggStreamState();
+  void Clear();
+  long Storage() const;
+
+  static NAN_METHOD(New);
+};
+
+} // nodeogg namespace
+
+#endif // NODE_OGG_STATE_H_
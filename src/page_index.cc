@@ -0,0 +1,295 @@
+/*
+ * Copyright (c) 2012, Nathan Rajlich <nathan@tootallnate.net>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <set>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "page_index.h"
+
+#include "ogg/ogg.h"
+
+namespace nodeogg {
+
+/* number of bytes of the ogg file read at a time while building */
+#define CHUNK_SIZE 65536
+
+static inline const PageIndexEntry *EntriesOf(const char *data) {
+  return reinterpret_cast<const PageIndexEntry *>(data + sizeof(PageIndexHeader));
+}
+
+static inline std::string ErrorString(const char *what, const char *path) {
+  return std::string(what) + " \"" + path + "\": " + strerror(errno);
+}
+
+static bool BySerialno(const PageIndexEntry &a, const PageIndexEntry &b) {
+  return a.serialno < b.serialno;
+}
+
+/* Walks the ogg file at `path` once, and writes the index of its pages to
+ * `index_path`. The index is written next to it first and then renamed into
+ * place, so that it's never seen half-written. */
+bool PageIndex::Build(const char *path, const char *index_path, uint64_t *count,
+    std::string *error) {
+  FILE *in = fopen(path, "rb");
+  if (in == NULL) {
+    *error = ErrorString("can't open", path);
+    return false;
+  }
+
+  ogg_sync_state oy;
+  ogg_page page;
+  ogg_page_desc desc;
+  std::vector<PageIndexEntry> entries;
+  std::set<uint32_t> serialnos;
+  /* file offset of what `ogg_sync_pageseek()` looks at next, and the number of
+   * bytes read so far */
+  uint64_t offset = 0;
+  uint64_t media_size = 0;
+  bool ok = true;
+
+  ogg_sync_init(&oy);
+  for (;;) {
+    long n = ogg_sync_pageseek(&oy, &page);
+    if (n < 0) {
+      offset += static_cast<uint64_t>(-n);
+      continue;
+    }
+    if (n > 0) {
+      if (ogg_page_describe(&page, &desc) == 0) {
+        PageIndexEntry entry;
+        entry.granulepos = desc.granulepos;
+        entry.offset = offset;
+        entry.serialno = static_cast<uint32_t>(desc.serialno);
+        entry.pageno = static_cast<uint32_t>(desc.pageno);
+        entry.bytes = static_cast<uint32_t>(n);
+        entry.flags = (desc.continued ? PAGE_INDEX_CONTINUED : 0) |
+                      (desc.bos ? PAGE_INDEX_BOS : 0) |
+                      (desc.eos ? PAGE_INDEX_EOS : 0);
+        entries.push_back(entry);
+        serialnos.insert(entry.serialno);
+      }
+      offset += static_cast<uint64_t>(n);
+      continue;
+    }
+    char *buffer = ogg_sync_buffer(&oy, CHUNK_SIZE);
+    if (buffer == NULL) {
+      *error = "ogg_sync_buffer() failed";
+      ok = false;
+      break;
+    }
+    size_t bytes = fread(buffer, 1, CHUNK_SIZE, in);
+    if (bytes == 0) {
+      if (ferror(in)) {
+        *error = ErrorString("can't read", path);
+        ok = false;
+      }
+      break;
+    }
+    ogg_sync_wrote(&oy, static_cast<long>(bytes));
+    media_size += bytes;
+  }
+  ogg_sync_clear(&oy);
+  fclose(in);
+  if (!ok) return false;
+
+  /* stable, so that each stream's pages stay in file order */
+  std::stable_sort(entries.begin(), entries.end(), BySerialno);
+
+  PageIndexHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, PAGE_INDEX_MAGIC, sizeof(header.magic));
+  header.version = PAGE_INDEX_VERSION;
+  header.byte_order = PAGE_INDEX_BYTE_ORDER;
+  header.header_size = sizeof(PageIndexHeader);
+  header.entry_size = sizeof(PageIndexEntry);
+  header.count = entries.size();
+  header.media_size = media_size;
+  header.streams = static_cast<uint32_t>(serialnos.size());
+
+  std::string tmp = std::string(index_path) + ".tmp";
+  FILE *out = fopen(tmp.c_str(), "wb");
+  if (out == NULL) {
+    *error = ErrorString("can't open", tmp.c_str());
+    return false;
+  }
+  ok = fwrite(&header, sizeof(header), 1, out) == 1 &&
+       (entries.empty() ||
+        fwrite(&entries[0], sizeof(PageIndexEntry), entries.size(), out) == entries.size());
+  if (!ok) *error = ErrorString("can't write", tmp.c_str());
+  if (fclose(out) != 0 && ok) {
+    *error = ErrorString("can't write", tmp.c_str());
+    ok = false;
+  }
+#ifdef _WIN32
+  /* rename() doesn't replace existing files there */
+  if (ok) remove(index_path);
+#endif
+  if (ok && rename(tmp.c_str(), index_path) != 0) {
+    *error = ErrorString("can't rename", tmp.c_str());
+    ok = false;
+  }
+  if (!ok) {
+    remove(tmp.c_str());
+    return false;
+  }
+  *count = entries.size();
+  return true;
+}
+
+/* Maps the index at `index_path` into memory, copy-on-write so that stray
+ * writes to it never reach the file. Returns NULL, with `error` set, when it
+ * can't be mapped or isn't a page index this build understands. */
+char *PageIndex::Map(const char *index_path, size_t *length, std::string *error) {
+  char *data;
+#ifdef _WIN32
+  HANDLE file = CreateFileA(index_path, GENERIC_READ, FILE_SHARE_READ, NULL,
+      OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (file == INVALID_HANDLE_VALUE) {
+    *error = std::string("can't open \"") + index_path + "\"";
+    return NULL;
+  }
+  LARGE_INTEGER size;
+  if (!GetFileSizeEx(file, &size) || size.QuadPart < (LONGLONG)sizeof(PageIndexHeader)) {
+    CloseHandle(file);
+    *error = std::string("not a page index: \"") + index_path + "\"";
+    return NULL;
+  }
+  HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_WRITECOPY, 0, 0, NULL);
+  CloseHandle(file);
+  if (mapping == NULL) {
+    *error = std::string("can't map \"") + index_path + "\"";
+    return NULL;
+  }
+  data = static_cast<char *>(MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, 0));
+  CloseHandle(mapping);
+  if (data == NULL) {
+    *error = std::string("can't map \"") + index_path + "\"";
+    return NULL;
+  }
+  *length = static_cast<size_t>(size.QuadPart);
+#else
+  int fd = open(index_path, O_RDONLY);
+  if (fd < 0) {
+    *error = ErrorString("can't open", index_path);
+    return NULL;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(PageIndexHeader)) {
+    close(fd);
+    *error = std::string("not a page index: \"") + index_path + "\"";
+    return NULL;
+  }
+  void *addr = mmap(NULL, static_cast<size_t>(st.st_size), PROT_READ | PROT_WRITE,
+      MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (addr == MAP_FAILED) {
+    *error = ErrorString("can't map", index_path);
+    return NULL;
+  }
+  data = static_cast<char *>(addr);
+  *length = static_cast<size_t>(st.st_size);
+#endif
+
+  const PageIndexHeader *header = reinterpret_cast<const PageIndexHeader *>(data);
+  const char *problem = NULL;
+  if (memcmp(header->magic, PAGE_INDEX_MAGIC, sizeof(header->magic)) != 0) {
+    problem = "not a page index";
+  } else if (header->byte_order != PAGE_INDEX_BYTE_ORDER) {
+    problem = "page index of another byte order";
+  } else if (header->version != PAGE_INDEX_VERSION ||
+             header->header_size != sizeof(PageIndexHeader) ||
+             header->entry_size != sizeof(PageIndexEntry)) {
+    problem = "unsupported page index version";
+  } else if (header->count > (*length - sizeof(PageIndexHeader)) / sizeof(PageIndexEntry)) {
+    problem = "truncated page index";
+  }
+  if (problem != NULL) {
+    Unmap(data, *length);
+    *error = std::string(problem) + ": \"" + index_path + "\"";
+    return NULL;
+  }
+  return data;
+}
+
+void PageIndex::Unmap(char *data, size_t length) {
+#ifdef _WIN32
+  (void)length;
+  UnmapViewOfFile(data);
+#else
+  munmap(data, length);
+#endif
+}
+
+/* Finds the entries [begin, end) of stream `serialno`. */
+void PageIndex::Stream(const char *data, uint32_t serialno, uint64_t *begin, uint64_t *end) {
+  const PageIndexHeader *header = reinterpret_cast<const PageIndexHeader *>(data);
+  const PageIndexEntry *entries = EntriesOf(data);
+  uint64_t lo = 0;
+  uint64_t hi = header->count;
+  while (lo < hi) {
+    uint64_t mid = lo + (hi - lo) / 2;
+    if (entries[mid].serialno < serialno) lo = mid + 1;
+    else hi = mid;
+  }
+  *begin = lo;
+  hi = header->count;
+  while (lo < hi) {
+    uint64_t mid = lo + (hi - lo) / 2;
+    if (entries[mid].serialno <= serialno) lo = mid + 1;
+    else hi = mid;
+  }
+  *end = lo;
+}
+
+/* Whether the granulepos at entry `i` has reached `target`. Pages where no
+ * packet ends have a granulepos of -1, and go by the last page before them
+ * that has one. */
+static inline bool Reached(const PageIndexEntry *entries, uint64_t begin, uint64_t i,
+    int64_t target) {
+  while (i > begin && entries[i].granulepos == -1) i--;
+  return entries[i].granulepos != -1 && entries[i].granulepos >= target;
+}
+
+/* Returns the entry of the first page of stream `serialno` whose granulepos
+ * is at or past `granulepos`, or -1 when there's none. */
+int64_t PageIndex::Find(const char *data, uint32_t serialno, int64_t granulepos) {
+  const PageIndexEntry *entries = EntriesOf(data);
+  uint64_t begin, end;
+  Stream(data, serialno, &begin, &end);
+  uint64_t lo = begin;
+  uint64_t hi = end;
+  while (lo < hi) {
+    uint64_t mid = lo + (hi - lo) / 2;
+    if (Reached(entries, begin, mid, granulepos)) hi = mid;
+    else lo = mid + 1;
+  }
+  return lo == end ? -1 : static_cast<int64_t>(lo);
+}
+
+} // nodeogg namespace
@@ -0,0 +1,76 @@
+/*
+ * Copyright (c) 2012, Nathan Rajlich <nathan@tootallnate.net>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef NODE_OGG_PAGE_INDEX_H_
+#define NODE_OGG_PAGE_INDEX_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+
+namespace nodeogg {
+
+/*
+ * Page index sidecar file: a header followed by one entry per page of the ogg
+ * file, grouped by stream (in increasing serialno order) and in file order
+ * within each stream. Fields are in the byte order of the host that built the
+ * index, which `byte_order` tells; an index from a host of the other byte
+ * order is refused rather than swapped. The file is mapped straight into
+ * memory and searched in place.
+ */
+
+#define PAGE_INDEX_MAGIC "OggPgIdx"
+#define PAGE_INDEX_VERSION 1
+#define PAGE_INDEX_BYTE_ORDER 0x01020304
+
+struct PageIndexHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t byte_order;
+  uint32_t header_size;
+  uint32_t entry_size;
+  uint64_t count;
+  uint64_t media_size;  /* size of the ogg file, to tell a stale index */
+  uint32_t streams;
+  uint32_t reserved[5];
+};
+
+#define PAGE_INDEX_CONTINUED 1
+#define PAGE_INDEX_BOS 2
+#define PAGE_INDEX_EOS 4
+
+struct PageIndexEntry {
+  int64_t granulepos;
+  uint64_t offset;      /* of the page in the ogg file */
+  uint32_t serialno;
+  uint32_t pageno;
+  uint32_t bytes;       /* header and body */
+  uint32_t flags;
+};
+
+class PageIndex {
+ public:
+  static bool Build(const char *path, const char *index_path, uint64_t *count,
+      std::string *error);
+  static char *Map(const char *index_path, size_t *length, std::string *error);
+  static void Unmap(char *data, size_t length);
+  static void Stream(const char *data, uint32_t serialno, uint64_t *begin, uint64_t *end);
+  static int64_t Find(const char *data, uint32_t serialno, int64_t granulepos);
+};
+
+} // nodeogg namespace
+
+#endif // NODE_OGG_PAGE_INDEX_H_
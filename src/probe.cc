@@ -0,0 +1,216 @@
+/*
+ * Copyright (c) 2012, Nathan Rajlich <nathan@tootallnate.net>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <map>
+
+#include "probe.h"
+
+#include "ogg/ogg.h"
+
+namespace nodeogg {
+
+/* bytes read from the start of the file, and in the first backward window */
+#define WINDOW_SIZE 65536
+
+/* the largest a page can be: a full header, and 255 segments of 255 bytes */
+#define MAX_PAGE_SIZE (27 + 255 + 255 * 255)
+
+#ifdef _WIN32
+#define fseek64(file, offset, whence) _fseeki64(file, static_cast<__int64>(offset), whence)
+#define ftell64 _ftelli64
+#else
+#define fseek64(file, offset, whence) fseeko(file, static_cast<off_t>(offset), whence)
+#define ftell64 ftello
+#endif
+
+/* A page found by `Scan()`. */
+struct ScannedPage {
+  uint64_t offset;
+  uint64_t end;
+  ogg_page_desc desc;
+};
+
+/* Reads the file from `start` up to `end`, and appends the pages starting
+ * before `limit` to `pages`. Pages that don't end before `end` are left out. */
+static bool Scan(FILE *file, ogg_sync_state *oy, uint64_t start, uint64_t end,
+    uint64_t limit, std::vector<ScannedPage> *pages, ProbeResult *result) {
+  ogg_page page;
+  ScannedPage scanned;
+  uint64_t offset = start;
+  uint64_t read = start;
+
+  ogg_sync_reset(oy);
+  if (fseek64(file, start, SEEK_SET) != 0) return false;
+  for (;;) {
+    long n = ogg_sync_pageseek(oy, &page);
+    if (n < 0) {
+      offset += static_cast<uint64_t>(-n);
+      continue;
+    }
+    if (n > 0) {
+      if (offset >= limit) return true;
+      if (ogg_page_describe(&page, &scanned.desc) == 0) {
+        scanned.offset = offset;
+        scanned.end = offset + static_cast<uint64_t>(n);
+        pages->push_back(scanned);
+      }
+      offset += static_cast<uint64_t>(n);
+      continue;
+    }
+    if (read >= end) return true;
+    size_t want = end - read < WINDOW_SIZE ? static_cast<size_t>(end - read) : WINDOW_SIZE;
+    char *buffer = ogg_sync_buffer(oy, static_cast<long>(want));
+    if (buffer == NULL) return false;
+    size_t bytes = fread(buffer, 1, want, file);
+    if (bytes == 0) return !ferror(file);
+    ogg_sync_wrote(oy, static_cast<long>(bytes));
+    read += bytes;
+    result->bytes_read += bytes;
+  }
+}
+
+bool Probe::Run(const char *path, ProbeResult *result, std::string *error) {
+  FILE *file = fopen(path, "rb");
+  if (file == NULL) {
+    *error = std::string("can't open \"") + path + "\": " + strerror(errno);
+    return false;
+  }
+  result->size = 0;
+  result->bytes_read = 0;
+  result->streams.clear();
+  if (fseek64(file, 0, SEEK_END) == 0) {
+    result->size = static_cast<uint64_t>(ftell64(file));
+  }
+
+  ogg_sync_state oy;
+  std::vector<ScannedPage> pages;
+  std::map<int, size_t> streams;
+  /* streams whose last page, or last granulepos, hasn't been found yet */
+  size_t pending = 0;
+  bool ok = true;
+
+  ogg_sync_init(&oy);
+
+  /* the BOS pages of all the streams come first, and are followed by their
+   * headers, which is where the first granule positions are */
+  uint64_t end = WINDOW_SIZE;
+  for (;;) {
+    pages.clear();
+    if (!Scan(file, &oy, 0, end, end, &pages, result)) {
+      ok = false;
+      break;
+    }
+    bool done = end >= result->size;
+    for (size_t i = 0; i < pages.size(); i++) {
+      const ogg_page_desc &desc = pages[i].desc;
+      if (desc.bos && streams.find(desc.serialno) == streams.end()) {
+        ProbeStream stream;
+        stream.serialno = desc.serialno;
+        stream.first_granulepos = -1;
+        stream.last_granulepos = -1;
+        stream.first_pageno = desc.pageno;
+        stream.last_pageno = -1;
+        stream.first_offset = pages[i].offset;
+        stream.last_end = 0;
+        stream.eos = false;
+        streams[desc.serialno] = result->streams.size();
+        result->streams.push_back(stream);
+      } else if (!desc.bos) {
+        done = true;
+      }
+      std::map<int, size_t>::iterator it = streams.find(desc.serialno);
+      if (it == streams.end()) continue;
+      ProbeStream &stream = result->streams[it->second];
+      if (desc.granulepos != -1) {
+        if (stream.first_granulepos == -1) stream.first_granulepos = desc.granulepos;
+        stream.last_granulepos = desc.granulepos;
+      }
+      if (desc.eos) {
+        /* short streams, i.e. Skeleton, are over before the others begin */
+        stream.last_pageno = desc.pageno;
+        stream.last_end = pages[i].end;
+        stream.eos = true;
+      }
+    }
+    /* only a file made entirely of BOS pages gets here twice */
+    if (done) break;
+    end *= 2;
+  }
+  for (size_t i = 0; i < result->streams.size(); i++) {
+    ProbeStream &stream = result->streams[i];
+    if (stream.eos && stream.last_granulepos != -1) continue;
+    /* whatever the start of the file said, the end of it has the last word */
+    stream.last_pageno = -1;
+    stream.last_granulepos = -1;
+    stream.eos = false;
+    pending++;
+  }
+
+  /* the last pages, from the end backwards; a window reaches up to the first
+   * page found by the previous one, which is where the page straddling the
+   * start of that one ends */
+  uint64_t window = WINDOW_SIZE;
+  uint64_t limit = result->size;
+  uint64_t stop = result->size;
+  while (ok && pending > 0 && limit > 0) {
+    uint64_t start = limit > window ? limit - window : 0;
+    pages.clear();
+    if (!Scan(file, &oy, start, stop, limit, &pages, result)) {
+      ok = false;
+      break;
+    }
+    /* newest first */
+    for (size_t i = pages.size(); i-- > 0; ) {
+      const ogg_page_desc &desc = pages[i].desc;
+      std::map<int, size_t>::iterator it = streams.find(desc.serialno);
+      if (it == streams.end()) continue;
+      ProbeStream &stream = result->streams[it->second];
+      bool was_pending = stream.last_pageno == -1 || stream.last_granulepos == -1;
+      if (stream.last_pageno == -1) {
+        stream.last_pageno = desc.pageno;
+        stream.last_end = pages[i].end;
+        stream.eos = desc.eos != 0;
+      }
+      if (stream.last_granulepos == -1 && desc.granulepos != -1) {
+        stream.last_granulepos = desc.granulepos;
+      }
+      if (was_pending && stream.last_granulepos != -1) pending--;
+    }
+    /* without a page, the next window has to reach for the biggest one */
+    if (pages.empty()) {
+      if (start + MAX_PAGE_SIZE < stop) stop = start + MAX_PAGE_SIZE;
+    } else {
+      stop = pages[0].offset;
+    }
+    limit = start;
+    window *= 2;
+  }
+  ogg_sync_clear(&oy);
+
+  if (ferror(file)) {
+    *error = std::string("can't read \"") + path + "\": " + strerror(errno);
+    ok = false;
+  } else if (!ok) {
+    *error = std::string("can't probe \"") + path + "\"";
+  }
+  fclose(file);
+  return ok;
+}
+
+} // nodeogg namespace
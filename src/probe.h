@@ -0,0 +1,61 @@
+/*
+ * Copyright (c) 2012, Nathan Rajlich <nathan@tootallnate.net>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef NODE_OGG_PROBE_H_
+#define NODE_OGG_PROBE_H_
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace nodeogg {
+
+/* What `Probe::Run()` found out about a stream. A granule position is -1 when
+ * no page of the stream had one in the part of the file that was read. */
+struct ProbeStream {
+  int serialno;
+  int64_t first_granulepos;
+  int64_t last_granulepos;
+  long first_pageno;
+  long last_pageno;
+  uint64_t first_offset;
+  uint64_t last_end;
+  bool eos;
+};
+
+struct ProbeResult {
+  uint64_t size;
+  uint64_t bytes_read;
+  std::vector<ProbeStream> streams;
+};
+
+/*
+ * Finds the first and last granule position, the page count and the extent of
+ * every stream of an ogg file without reading all of it: the BOS pages at the
+ * start of the file tell the streams apart, and each stream's last page is
+ * then looked for from the end of the file backwards, in windows doubling in
+ * size until all of them were found. For a regular file, that is a few
+ * kilobytes from either end.
+ */
+
+class Probe {
+ public:
+  static bool Run(const char *path, ProbeResult *result, std::string *error);
+};
+
+} // nodeogg namespace
+
+#endif // NODE_OGG_PROBE_H_
@@ -0,0 +1,226 @@
+/*
+ * Copyright (c) 2012, Nathan Rajlich <nathan@tootallnate.net>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <string.h>
+#include <map>
+
+#include "skeleton.h"
+
+#include "ogg/ogg.h"
+
+namespace nodeogg {
+
+/* bytes read at a time, and at most, looking for the Skeleton headers; those
+ * of a long video with a keyframe index run to a few hundred kilobytes */
+#define CHUNK_SIZE 65536
+#define MAX_HEADER_BYTES (16 * 1024 * 1024)
+
+#define FISHEAD_SIZE 64
+#define FISHEAD_4_SIZE 80
+#define FISBONE_SIZE 52
+#define INDEX_SIZE 42
+
+/* Skeleton fields are little-endian */
+static inline uint32_t Read32(const unsigned char *p) {
+  return static_cast<uint32_t>(p[0]) | static_cast<uint32_t>(p[1]) << 8 |
+         static_cast<uint32_t>(p[2]) << 16 | static_cast<uint32_t>(p[3]) << 24;
+}
+
+static inline int64_t Read64(const unsigned char *p) {
+  return static_cast<int64_t>(static_cast<uint64_t>(Read32(p)) |
+                              static_cast<uint64_t>(Read32(p + 4)) << 32);
+}
+
+/* Reads a variable-length number of the keypoint list: 7 bits per byte, least
+ * significant first, the last byte having its top bit set. Returns NULL when
+ * it runs past `end`, or into more than 63 bits. */
+static const unsigned char *ReadVarint(const unsigned char *p, const unsigned char *end,
+    int64_t *value) {
+  uint64_t n = 0;
+  int shift = 0;
+  while (p < end && shift < 63) {
+    unsigned char byte = *p++;
+    n |= static_cast<uint64_t>(byte & 0x7f) << shift;
+    if (byte & 0x80) {
+      *value = static_cast<int64_t>(n);
+      return p;
+    }
+    shift += 7;
+  }
+  return NULL;
+}
+
+static SkeletonTrack *TrackOf(Skeleton *skeleton, uint32_t serialno) {
+  for (size_t i = 0; i < skeleton->tracks.size(); i++) {
+    if (skeleton->tracks[i].serialno == serialno) return &skeleton->tracks[i];
+  }
+  SkeletonTrack track = SkeletonTrack();
+  track.serialno = serialno;
+  skeleton->tracks.push_back(track);
+  return &skeleton->tracks.back();
+}
+
+SkeletonPacket SkeletonParser::Parse(const unsigned char *data, long bytes, Skeleton *skeleton) {
+  if (bytes >= FISHEAD_SIZE && memcmp(data, "fishead\0", 8) == 0) {
+    skeleton->version_major = data[8] | data[9] << 8;
+    skeleton->version_minor = data[10] | data[11] << 8;
+    skeleton->presentation_num = Read64(data + 12);
+    skeleton->presentation_den = Read64(data + 20);
+    skeleton->basetime_num = Read64(data + 28);
+    skeleton->basetime_den = Read64(data + 36);
+    skeleton->segment_length = 0;
+    skeleton->content_offset = 0;
+    if (skeleton->version_major >= 4 && bytes >= FISHEAD_4_SIZE) {
+      skeleton->segment_length = static_cast<uint64_t>(Read64(data + 64));
+      skeleton->content_offset = static_cast<uint64_t>(Read64(data + 72));
+    }
+    return SKELETON_FISHEAD;
+  }
+
+  if (bytes >= FISBONE_SIZE && memcmp(data, "fisbone\0", 8) == 0) {
+    SkeletonTrack *track = TrackOf(skeleton, Read32(data + 12));
+    track->header_packets = Read32(data + 16);
+    track->granulerate_num = Read64(data + 20);
+    track->granulerate_den = Read64(data + 28);
+    track->basegranule = Read64(data + 36);
+    track->preroll = Read32(data + 44);
+    track->granuleshift = data[48];
+    return SKELETON_FISBONE;
+  }
+
+  if (bytes >= INDEX_SIZE && memcmp(data, "index\0", 6) == 0) {
+    int64_t time_den = Read64(data + 18);
+    uint64_t count = static_cast<uint64_t>(Read64(data + 10));
+    if (time_den <= 0) return SKELETON_NONE;
+
+    /* each keypoint takes at least 2 bytes, which bounds what a broken count
+     * can make us reserve */
+    const unsigned char *p = data + INDEX_SIZE;
+    const unsigned char *end = data + bytes;
+    uint64_t room = static_cast<uint64_t>(end - p) / 2;
+    std::vector<SkeletonKeypoint> keypoints;
+    keypoints.reserve(static_cast<size_t>(count < room ? count : room));
+    SkeletonKeypoint keypoint = { 0, 0 };
+    for (uint64_t i = 0; i < count; i++) {
+      int64_t offset_delta, time_delta;
+      p = ReadVarint(p, end, &offset_delta);
+      if (p == NULL) return SKELETON_NONE;
+      p = ReadVarint(p, end, &time_delta);
+      if (p == NULL) return SKELETON_NONE;
+      keypoint.offset += offset_delta;
+      keypoint.time += time_delta;
+      keypoints.push_back(keypoint);
+    }
+
+    SkeletonTrack *track = TrackOf(skeleton, Read32(data + 6));
+    track->has_index = true;
+    track->time_den = time_den;
+    track->first_time = Read64(data + 26);
+    track->last_time = Read64(data + 34);
+    track->keypoints.swap(keypoints);
+    return SKELETON_INDEX;
+  }
+
+  return SKELETON_NONE;
+}
+
+/* Reads `bytes` bytes at `offset` of `fd`, returning the number of bytes read
+ * or a negative libuv error code. */
+static long ReadAt(uv_file fd, char *buffer, long bytes, int64_t offset) {
+  uv_fs_t req;
+  uv_buf_t buf = uv_buf_init(buffer, static_cast<unsigned int>(bytes));
+  /* no callback, so it runs right here, and doesn't need a loop */
+  int r = uv_fs_read(NULL, &req, fd, &buf, 1, offset, NULL);
+  uv_fs_req_cleanup(&req);
+  return r;
+}
+
+bool SkeletonParser::Read(uv_file fd, Skeleton *skeleton, bool *found, std::string *error) {
+  ogg_sync_state oy;
+  ogg_stream_state os;
+  ogg_page page;
+  ogg_packet packet;
+  int64_t offset = 0;
+  bool started = false;
+  bool done = false;
+  bool ok = true;
+
+  *found = false;
+  ogg_sync_init(&oy);
+  memset(&os, 0, sizeof(os));
+
+  while (!done) {
+    int r = ogg_sync_pageout(&oy, &page);
+    if (r < 0) continue;
+    if (r == 0) {
+      if (offset >= MAX_HEADER_BYTES) break;
+      char *buffer = ogg_sync_buffer(&oy, CHUNK_SIZE);
+      if (buffer == NULL) {
+        *error = "ogg_sync_buffer() failed";
+        ok = false;
+        break;
+      }
+      long bytes = ReadAt(fd, buffer, CHUNK_SIZE, offset);
+      if (bytes < 0) {
+        *error = std::string("can't read the Skeleton: ") + uv_strerror(static_cast<int>(bytes));
+        ok = false;
+        break;
+      }
+      if (bytes == 0) break;
+      ogg_sync_wrote(&oy, bytes);
+      offset += bytes;
+      continue;
+    }
+
+    if (!started) {
+      /* a Skeleton has to be the first stream of the file */
+      if (!ogg_page_bos(&page) || page.body_len < 8 || memcmp(page.body, "fishead\0", 8) != 0) {
+        break;
+      }
+      ogg_stream_init(&os, ogg_page_serialno(&page));
+      started = true;
+    }
+    if (ogg_page_serialno(&page) != os.serialno) continue;
+    if (ogg_stream_pagein(&os, &page) != 0) break;
+    while (ogg_stream_packetout(&os, &packet) == 1) {
+      if (SkeletonParser::Parse(packet.packet, packet.bytes, skeleton) == SKELETON_FISHEAD) {
+        *found = true;
+      }
+      /* the empty EOS packet closes the Skeleton headers */
+      if (packet.e_o_s) done = true;
+    }
+  }
+
+  if (started) ogg_stream_clear(&os);
+  ogg_sync_clear(&oy);
+  return ok;
+}
+
+/* Returns the last keypoint at or before `time`, in units of `time_den`, which
+ * is where decoding has to start from to get there, or NULL if there's none. */
+const SkeletonKeypoint *SkeletonParser::Find(const SkeletonKeypoint *keypoints, size_t count,
+    int64_t time) {
+  size_t lo = 0;
+  size_t hi = count;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (keypoints[mid].time <= time) lo = mid + 1;
+    else hi = mid;
+  }
+  return lo == 0 ? NULL : &keypoints[lo - 1];
+}
+
+} // nodeogg namespace
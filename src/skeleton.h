@@ -0,0 +1,90 @@
+/*
+ * Copyright (c) 2012, Nathan Rajlich <nathan@tootallnate.net>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef NODE_OGG_SKELETON_H_
+#define NODE_OGG_SKELETON_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <uv.h>
+#include <string>
+#include <vector>
+
+namespace nodeogg {
+
+/* A keyframe of a Skeleton 4.0 `index` packet: the offset of the page the
+ * keyframe starts on, and its presentation time in units of the index's
+ * `time_den`. */
+struct SkeletonKeypoint {
+  int64_t offset;
+  int64_t time;
+};
+
+/* What the `fisbone` and `index` packets of a stream say about it. */
+struct SkeletonTrack {
+  uint32_t serialno;
+  uint32_t header_packets;
+  int64_t granulerate_num;
+  int64_t granulerate_den;
+  int64_t basegranule;
+  uint32_t preroll;
+  int granuleshift;
+  bool has_index;
+  int64_t time_den;
+  int64_t first_time;
+  int64_t last_time;
+  std::vector<SkeletonKeypoint> keypoints;
+};
+
+/* The `fishead` packet, and the tracks that follow it. */
+struct Skeleton {
+  int version_major;
+  int version_minor;
+  int64_t presentation_num;
+  int64_t presentation_den;
+  int64_t basetime_num;
+  int64_t basetime_den;
+  uint64_t segment_length;
+  uint64_t content_offset;
+  std::vector<SkeletonTrack> tracks;
+};
+
+enum SkeletonPacket {
+  SKELETON_NONE,
+  SKELETON_FISHEAD,
+  SKELETON_FISBONE,
+  SKELETON_INDEX
+};
+
+/*
+ * Parses the packets of an Ogg Skeleton stream. `Parse()` takes a single
+ * packet, filling in `skeleton`, or the track of `skeleton` the packet is
+ * about, and returns what kind of packet it was, or SKELETON_NONE for anything
+ * it can't make sense of. `Read()` reads the Skeleton headers at the start of
+ * the file `fd`, and tells whether there were any.
+ */
+
+class SkeletonParser {
+ public:
+  static SkeletonPacket Parse(const unsigned char *data, long bytes, Skeleton *skeleton);
+  static bool Read(uv_file fd, Skeleton *skeleton, bool *found, std::string *error);
+  static const SkeletonKeypoint *Find(const SkeletonKeypoint *keypoints, size_t count,
+      int64_t time);
+};
+
+} // nodeogg namespace
+
+#endif // NODE_OGG_SKELETON_H_
@@ -0,0 +1,218 @@
+/*
+ * Copyright (c) 2012, Nathan Rajlich <nathan@tootallnate.net>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdlib.h>
+
+#include "thread_pool.h"
+
+namespace nodeogg {
+
+static uv_once_t once = UV_ONCE_INIT;
+static uv_mutex_t mutex;
+static uv_cond_t cond;
+
+/* tasks whose strand is free to run them */
+static std::deque<Task> *ready;
+
+/* threads that exited after the pool was shrunk, waiting to be joined */
+static std::vector<uv_thread_t *> *exited;
+
+static unsigned int pool_size = 4;
+static unsigned int threads = 0;
+static unsigned long queued = 0;
+static unsigned long running = 0;
+static double completed = 0;
+
+void ThreadPool::Init() {
+  uv_mutex_init(&mutex);
+  uv_cond_init(&cond);
+  ready = new std::deque<Task>();
+  exited = new std::vector<uv_thread_t *>();
+
+  const char *env = getenv("OGG_THREADPOOL_SIZE");
+  if (env != NULL && atoi(env) > 0) pool_size = atoi(env);
+}
+
+/* Joins the threads that exited after a `Resize()`. */
+void ThreadPool::Reap() {
+  std::vector<uv_thread_t *> gone;
+  uv_mutex_lock(&mutex);
+  gone.swap(*exited);
+  uv_mutex_unlock(&mutex);
+  for (size_t i = 0; i < gone.size(); i++) {
+    uv_thread_join(gone[i]);
+    delete gone[i];
+  }
+}
+
+void ThreadPool::Queue(const Task &task) {
+  uv_once(&once, Init);
+  Reap();
+
+  uv_mutex_lock(&mutex);
+  while (threads < pool_size) {
+    uv_thread_t *thread = new uv_thread_t;
+    if (uv_thread_create(thread, Run, thread) != 0) {
+      delete thread;
+      break;
+    }
+    threads++;
+  }
+
+  queued++;
+  if (task.strand != NULL && task.strand->running) {
+    task.strand->pending.push_back(task);
+  } else {
+    if (task.strand != NULL) task.strand->running = true;
+    ready->push_back(task);
+    uv_cond_signal(&cond);
+  }
+  uv_mutex_unlock(&mutex);
+}
+
+/* Sets the number of threads. Extra threads are started with the next task,
+ * surplus ones exit once they're done with their current task. */
+void ThreadPool::Resize(unsigned int n) {
+  uv_once(&once, Init);
+  uv_mutex_lock(&mutex);
+  pool_size = n > 0 ? n : 1;
+  uv_cond_broadcast(&cond);
+  uv_mutex_unlock(&mutex);
+  Reap();
+}
+
+void ThreadPool::GetStats(ThreadPoolStats *stats) {
+  uv_once(&once, Init);
+  uv_mutex_lock(&mutex);
+  stats->size = pool_size;
+  stats->threads = threads;
+  stats->queued = queued;
+  stats->running = running;
+  stats->completed = completed;
+  uv_mutex_unlock(&mutex);
+}
+
+void ThreadPool::Run(void *arg) {
+  uv_mutex_lock(&mutex);
+  for (;;) {
+    while (ready->empty() && threads <= pool_size) uv_cond_wait(&cond, &mutex);
+    if (threads > pool_size) {
+      threads--;
+      exited->push_back(static_cast<uv_thread_t *>(arg));
+      break;
+    }
+
+    Task task = ready->front();
+    ready->pop_front();
+    queued--;
+    running++;
+    uv_mutex_unlock(&mutex);
+
+    task.worker->Execute();
+
+    uv_mutex_lock(&mutex);
+    running--;
+    completed++;
+    if (task.strand != NULL) {
+      if (task.strand->pending.empty()) {
+        task.strand->running = false;
+      } else {
+        ready->push_back(task.strand->pending.front());
+        task.strand->pending.pop_front();
+        uv_cond_signal(&cond);
+      }
+    }
+    uv_mutex_unlock(&mutex);
+
+    /* the strand may be gone as soon as the callback has run */
+    task.completions->Push(task.worker);
+
+    uv_mutex_lock(&mutex);
+  }
+  uv_mutex_unlock(&mutex);
+}
+
+
+Completions::Completions(uv_loop_t *loop) : pending(0), refs(0) {
+  uv_mutex_init(&mutex);
+  uv_cond_init(&idle);
+  uv_async_init(loop, &async, OnAsync);
+  async.data = this;
+  uv_unref(reinterpret_cast<uv_handle_t *>(&async));
+}
+
+Completions::~Completions() {
+  uv_cond_destroy(&idle);
+  uv_mutex_destroy(&mutex);
+}
+
+/* Queues `worker` on the pool. Called on the loop thread. */
+void Completions::Queue(Nan::AsyncWorker *worker, Strand *strand) {
+  if (refs++ == 0) uv_ref(reinterpret_cast<uv_handle_t *>(&async));
+
+  uv_mutex_lock(&mutex);
+  pending++;
+  uv_mutex_unlock(&mutex);
+
+  Task task = { worker, strand, this };
+  ThreadPool::Queue(task);
+}
+
+/* Called on a pool thread once `worker` has been executed. */
+void Completions::Push(Nan::AsyncWorker *worker) {
+  uv_mutex_lock(&mutex);
+  done.push_back(worker);
+  uv_async_send(&async);
+  if (--pending == 0) uv_cond_signal(&idle);
+  uv_mutex_unlock(&mutex);
+}
+
+void Completions::OnAsync(uv_async_t *handle) {
+  Completions *self = static_cast<Completions *>(handle->data);
+  std::vector<Nan::AsyncWorker *> finished;
+  uv_mutex_lock(&self->mutex);
+  finished.swap(self->done);
+  uv_mutex_unlock(&self->mutex);
+
+  Nan::HandleScope scope;
+  for (size_t i = 0; i < finished.size(); i++) {
+    finished[i]->WorkComplete();
+    finished[i]->Destroy();
+  }
+
+  self->refs -= static_cast<int>(finished.size());
+  if (self->refs == 0) uv_unref(reinterpret_cast<uv_handle_t *>(&self->async));
+}
+
+/* Tears down when the environment goes away: waits for the outstanding
+ * workers, drops the ones whose callbacks will never run, and deletes itself
+ * once the loop is done with the handle. */
+void Completions::Close() {
+  std::vector<Nan::AsyncWorker *> finished;
+  uv_mutex_lock(&mutex);
+  while (pending > 0) uv_cond_wait(&idle, &mutex);
+  finished.swap(done);
+  uv_mutex_unlock(&mutex);
+
+  for (size_t i = 0; i < finished.size(); i++) finished[i]->Destroy();
+  uv_close(reinterpret_cast<uv_handle_t *>(&async), OnClose);
+}
+
+void Completions::OnClose(uv_handle_t *handle) {
+  delete static_cast<Completions *>(handle->data);
+}
+
+} // nodeogg namespace
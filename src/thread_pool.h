@@ -0,0 +1,106 @@
+/*
+ * Copyright (c) 2012, Nathan Rajlich <nathan@tootallnate.net>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef NODE_OGG_THREAD_POOL_H_
+#define NODE_OGG_THREAD_POOL_H_
+
+#include <uv.h>
+#include <nan.h>
+#include <deque>
+#include <vector>
+
+namespace nodeogg {
+
+class Strand;
+class Completions;
+
+/* A worker queued on the `ThreadPool`. */
+struct Task {
+  Nan::AsyncWorker *worker;
+  Strand *strand;
+  Completions *completions;
+};
+
+/*
+ * Tasks queued on the same strand run one at a time, in the order they were
+ * queued, while tasks on different strands may run in parallel. Every
+ * `ogg_sync_state` and `ogg_stream_state` has its own. Only ever touched with
+ * the pool's lock held.
+ */
+
+class Strand {
+ public:
+  Strand() : running(false) { }
+ private:
+  friend class ThreadPool;
+  std::deque<Task> pending;
+  bool running;
+};
+
+struct ThreadPoolStats {
+  unsigned int size;
+  unsigned int threads;
+  unsigned long queued;
+  unsigned long running;
+  double completed;
+};
+
+/*
+ * Process-wide pool of threads running the binding's workers, so that
+ * demuxing doesn't compete with `fs` and friends for the libuv thread pool.
+ * Its size defaults to $OGG_THREADPOOL_SIZE, or 4, and can be changed at any
+ * time.
+ */
+
+class ThreadPool {
+ public:
+  static void Queue(const Task &task);
+  static void Resize(unsigned int size);
+  static void GetStats(ThreadPoolStats *stats);
+ private:
+  static void Init();
+  static void Run(void *arg);
+  static void Reap();
+};
+
+/*
+ * Loop side of the pool: hands finished workers back to the event loop of the
+ * environment that queued them, to run their callbacks. Only keeps the loop
+ * alive while some of its workers are outstanding.
+ */
+
+class Completions {
+ public:
+  explicit Completions(uv_loop_t *loop);
+  void Queue(Nan::AsyncWorker *worker, Strand *strand);
+  void Push(Nan::AsyncWorker *worker);
+  void Close();
+ private:
+  ~Completions();
+  static void OnAsync(uv_async_t *handle);
+  static void OnClose(uv_handle_t *handle);
+
+  uv_async_t async;
+  uv_mutex_t mutex;
+  uv_cond_t idle;
+  std::vector<Nan::AsyncWorker *> done;
+  int pending;
+  int refs;
+};
+
+} // nodeogg namespace
+
+#endif // NODE_OGG_THREAD_POOL_H_
@@ -1,8 +1,11 @@
 
 var fs = require('fs');
+var crypto = require('crypto');
+var os = require('os');
 var path = require('path');
 var assert = require('assert');
-var Decoder = require('../').Decoder;
+var ogg = require('../');
+var Decoder = ogg.Decoder;
 var fixtures = path.resolve(__dirname, 'fixtures');
 
 describe('Decoder', function () {
@@ -98,6 +101,529 @@ describe('Decoder', function () {
       input.pipe(decoder);
     });
 
+    it('should get the same "packet" events with `batch: false`', function (done) {
+      var decoder = new Decoder({ batch: false });
+      var input = fs.createReadStream(fixture);
+      var expected = { 1761486570: 3, 252396615: 134 };
+      var got = { 1761486570: 0, 252396615: 0 };
+      decoder.on('stream', function (stream) {
+        stream.on('packet', function () {
+          got[stream.serialno]++;
+        });
+      });
+      decoder.on('finish', function () {
+        assert.deepEqual(expected, got);
+        done();
+      });
+      input.pipe(decoder);
+    });
+
+    it('should get the same "packet" events with synchronous libogg calls', function (done) {
+      var decoder = new Decoder({ batch: false, syncThreshold: Infinity });
+      var input = fs.createReadStream(fixture);
+      var expected = { 1761486570: 3, 252396615: 134 };
+      var got = { 1761486570: 0, 252396615: 0 };
+      decoder.on('stream', function (stream) {
+        stream.on('packet', function () {
+          got[stream.serialno]++;
+        });
+      });
+      decoder.on('finish', function () {
+        assert.deepEqual(expected, got);
+        done();
+      });
+      input.pipe(decoder);
+    });
+
+    it('should page out small pages of a large chunk synchronously', function (done) {
+      var binding = require('../lib/binding');
+      var pageout = binding.ogg_sync_pageout;
+      var pageoutSync = binding.ogg_sync_pageout_sync;
+      var calls = { async: 0, sync: 0 };
+      binding.ogg_sync_pageout = function () {
+        calls.async++;
+        return pageout.apply(this, arguments);
+      };
+      binding.ogg_sync_pageout_sync = function () {
+        calls.sync++;
+        return pageoutSync.apply(this, arguments);
+      };
+
+      // the whole file in one write, but no page of it is 8192 bytes
+      var decoder = new Decoder({ batch: false });
+      decoder.on('stream', function (stream) {
+        stream.resume();
+      });
+      decoder.on('finish', function () {
+        binding.ogg_sync_pageout = pageout;
+        binding.ogg_sync_pageout_sync = pageoutSync;
+        assert.equal(0, calls.async);
+        assert(calls.sync > 80);
+        done();
+      });
+      decoder.end(fs.readFileSync(fixture));
+    });
+
+    it('should start a new stream for a serialno seen again after its EOS', function (done) {
+      var data = fs.readFileSync(fixture);
+      chain({}, function () {
+        chain({ batch: false }, done);
+      });
+      function chain (opts, fn) {
+        var decoder = new Decoder(opts);
+        var expected = { 1761486570: 6, 252396615: 268 };
+        var got = { 1761486570: 0, 252396615: 0 };
+        var streams = 0;
+        decoder.on('stream', function (stream) {
+          streams++;
+          stream.on('packet', function () {
+            got[stream.serialno]++;
+          });
+        });
+        decoder.on('error', done);
+        decoder.on('finish', function () {
+          assert.equal(4, streams);
+          assert.deepEqual(expected, got);
+          fn();
+        });
+        // the file chained to itself, serial numbers and all
+        decoder.write(data);
+        decoder.end(data);
+      }
+    });
+
+    it('should run the libogg calls on the binding\'s thread pool', function (done) {
+      var decoder = new Decoder({ syncThreshold: 0 });
+      var input = fs.createReadStream(fixture);
+      var before = ogg.threadPoolStats().completed;
+      decoder.on('stream', function (stream) {
+        stream.resume();
+      });
+      decoder.on('finish', function () {
+        var stats = ogg.threadPoolStats();
+        assert(stats.completed > before);
+        assert.equal(ogg.threads, stats.size);
+        assert(stats.threads <= stats.size);
+        done();
+      });
+      input.pipe(decoder);
+    });
+
+    it('should take libogg\'s buffers from the binding\'s allocator', function (done) {
+      var decoder = new Decoder();
+      var input = fs.createReadStream(fixture);
+      var before = ogg.memoryStats();
+      decoder.on('stream', function (stream) {
+        stream.resume();
+      });
+      decoder.on('finish', function () {
+        var stats = ogg.memoryStats();
+        assert(stats.hits + stats.misses > before.hits + before.misses);
+        assert(stats.allocated >= 0);
+        assert(stats.cached >= 0);
+        done();
+      });
+      input.pipe(decoder);
+    });
+
+    it('should describe each page as `page.desc`', function (done) {
+      collect({}, function (expected) {
+        collect({ batch: false }, function (got) {
+          assert.deepEqual(expected, got);
+          done();
+        });
+      });
+      function collect (opts, fn) {
+        var decoder = new Decoder(opts);
+        var pages = [];
+        var bos = 0;
+        var eos = 0;
+        decoder.on('page', function (page) {
+          var desc = page.desc;
+          assert.equal(page.serialno, desc.serialno);
+          assert.equal(page.packets, desc.packets);
+          assert.equal(27 + desc.segments, desc.header_len);
+          if (desc.bos) bos++;
+          if (desc.eos) eos++;
+          pages.push([ desc.serialno, desc.pageno, desc.granulepos, desc.body_len ]);
+        });
+        decoder.on('stream', function (stream) {
+          stream.resume();
+        });
+        decoder.on('error', done);
+        decoder.on('finish', function () {
+          assert.equal(2, bos);
+          assert.equal(2, eos);
+          fn(pages);
+        });
+        fs.createReadStream(fixture).pipe(decoder);
+      }
+    });
+
+    it('should seek to the page holding a granulepos with `FileDecoder`', function (done) {
+      var serialno = 252396615;
+      var decoder = new Decoder();
+      var granules = [];
+      decoder.on('page', function (page) {
+        if (serialno === page.desc.serialno && -1 !== page.desc.granulepos) {
+          granules.push(page.desc.granulepos);
+        }
+      });
+      decoder.on('stream', function (stream) {
+        stream.resume();
+      });
+      decoder.on('error', done);
+      decoder.on('finish', function () {
+        var target = granules[Math.floor(granules.length / 2)];
+        var expected = granules.slice(granules.indexOf(target));
+        seek({ chunkSize: 4096 }, target, function (got) {
+          assert.deepEqual(expected, got);
+          // every pageseek's callback reading on from the thread pool
+          seek({ chunkSize: 4096, syncThreshold: 0 }, target, function (got) {
+            assert.deepEqual(expected, got);
+            done();
+          });
+        });
+      });
+      fs.createReadStream(fixture).pipe(decoder);
+
+      function seek (opts, target, fn) {
+        var fd = fs.openSync(fixture, 'r');
+        var file = new ogg.FileDecoder(fd, opts);
+        var got = [];
+        file.on('page', function (page) {
+          if (serialno === page.desc.serialno && -1 !== page.desc.granulepos) {
+            got.push(page.desc.granulepos);
+          }
+        });
+        file.on('stream', function (stream) {
+          stream.resume();
+        });
+        file.on('error', done);
+        file.on('finish', function () {
+          fs.closeSync(fd);
+          fn(got);
+        });
+        file.seek(serialno, target, function (err, offset) {
+          if (err) return done(err);
+          assert(offset > 0);
+        });
+      }
+    });
+
+    it('should find the same pages in a `PageIndex` of the file', function (done) {
+      var serialno = 252396615;
+      var decoder = new Decoder();
+      var granules = [];
+      decoder.on('page', function (page) {
+        if (serialno === page.desc.serialno && -1 !== page.desc.granulepos) {
+          granules.push(page.desc.granulepos);
+        }
+      });
+      decoder.on('stream', function (stream) {
+        stream.resume();
+      });
+      decoder.on('error', done);
+      decoder.on('finish', function () {
+        var indexPath = path.resolve(os.tmpdir(), 'node-ogg-' + process.pid + '.idx');
+        ogg.PageIndex.build(fixture, indexPath, function (err, count) {
+          if (err) return done(err);
+          var index = ogg.PageIndex.open(indexPath);
+          fs.unlinkSync(indexPath);
+          assert.equal(count, index.count);
+          assert.equal(fs.statSync(fixture).size, index.mediaSize);
+          assert.deepEqual([ 252396615, 1761486570 ], index.serialnos());
+          assert.equal(granules[granules.length - 1], index.duration(serialno));
+          granules.forEach(function (granulepos) {
+            assert.equal(granulepos, index.find(serialno, granulepos).granulepos);
+          });
+          assert.equal(null, index.find(serialno, granules[granules.length - 1] + 1));
+          var range = index.range(serialno, granules[1], granules[2]);
+          assert(range.start < range.end);
+          done();
+        });
+      });
+      fs.createReadStream(fixture).pipe(decoder);
+    });
+
+    it('should probe the same last granulepos as the Decoder gets to', function (done) {
+      var decoder = new Decoder();
+      var last = {};
+      var pages = {};
+      decoder.on('page', function (page) {
+        var serialno = page.desc.serialno;
+        pages[serialno] = (pages[serialno] || 0) + 1;
+        if (-1 !== page.desc.granulepos) last[serialno] = page.desc.granulepos;
+      });
+      decoder.on('stream', function (stream) {
+        stream.resume();
+      });
+      decoder.on('error', done);
+      decoder.on('finish', function () {
+        ogg.probe(fixture, function (err, info) {
+          if (err) return done(err);
+          assert.equal(fs.statSync(fixture).size, info.size);
+          assert(info.bytesRead < info.size);
+          assert.deepEqual([ 1761486570, 252396615 ], info.streams.map(function (s) {
+            return s.serialno;
+          }));
+          info.streams.forEach(function (s) {
+            assert.equal(last[s.serialno], s.lastGranulepos);
+            assert.equal(pages[s.serialno], s.pages);
+            assert.equal(true, s.eos);
+          });
+          done();
+        });
+      });
+      fs.createReadStream(fixture).pipe(decoder);
+    });
+
+    it('should read the Skeleton headers at the start of the file', function (done) {
+      var fd = fs.openSync(fixture, 'r');
+      ogg.Skeleton.read(fd, function (err, skeleton) {
+        fs.closeSync(fd);
+        if (err) return done(err);
+        assert.equal(3, skeleton.versionMajor);
+        assert.equal(1, skeleton.tracks.length);
+        assert.equal(252396615, skeleton.tracks[0].serialno);
+        assert.equal(6, skeleton.tracks[0].granuleshift);
+        // Skeleton 3.0 has no keyframe index, so seeks bisect the file
+        assert.equal(null, skeleton.keypoint(252396615, 1000));
+        done();
+      });
+    });
+
+    it('should get the same "packet" events when reading into `.buffer()`', function (done) {
+      var decoder = new Decoder();
+      var fd = fs.openSync(fixture, 'r');
+      var expected = { 1761486570: 3, 252396615: 134 };
+      var got = { 1761486570: 0, 252396615: 0 };
+      decoder.on('stream', function (stream) {
+        stream.on('packet', function () {
+          got[stream.serialno]++;
+        });
+      });
+      decoder.on('finish', function () {
+        assert.deepEqual(expected, got);
+        done();
+      });
+      read();
+      function read () {
+        var buf = decoder.buffer(4096);
+        fs.read(fd, buf, 0, buf.length, null, function (err, bytes) {
+          if (err) return done(err);
+          if (0 === bytes) {
+            fs.closeSync(fd);
+            return decoder.end();
+          }
+          decoder.wrote(bytes, function (err) {
+            if (err) return done(err);
+            read();
+          });
+        });
+      }
+    });
+
+    it('should keep `.buffer()`/`.wrote()` and `.write()` from overlapping', function (done) {
+      var decoder = new Decoder({ syncThreshold: 0 });
+      var data = fs.readFileSync(fixture);
+      var half = Math.floor(data.length / 2);
+      var expected = { 1761486570: 3, 252396615: 134 };
+      var got = { 1761486570: 0, 252396615: 0 };
+      decoder.on('stream', function (stream) {
+        stream.on('packet', function () {
+          got[stream.serialno]++;
+        });
+      });
+      decoder.on('finish', function () {
+        assert.deepEqual(expected, got);
+        done();
+      });
+
+      // the second half, written while `buffer()` is out, waits for `wrote()`
+      var buf = decoder.buffer(half);
+      decoder.write(data.slice(half));
+      data.copy(buf, 0, 0, half);
+      decoder.wrote(half, function (err) {
+        if (err) return done(err);
+      });
+
+      // the first half is being demuxed on the thread pool
+      assert.throws(function () {
+        decoder.buffer(4096);
+      }, /while a write is in progress/);
+      decoder.end();
+    });
+
+    it('should allow `.buffer()` from the callback of a `.wrote()` yielding no packets', function (done) {
+      var decoder = new Decoder({ syncThreshold: 0 });
+      var data = fs.readFileSync(fixture);
+      var expected = { 1761486570: 3, 252396615: 134 };
+      var got = { 1761486570: 0, 252396615: 0 };
+      decoder.on('stream', function (stream) {
+        stream.on('packet', function () {
+          got[stream.serialno]++;
+        });
+      });
+      decoder.on('finish', function () {
+        assert.deepEqual(expected, got);
+        done();
+      });
+
+      // not even a whole page header, demuxed on the thread pool
+      var buf = decoder.buffer(20);
+      data.copy(buf, 0, 0, 20);
+      decoder.wrote(20, function (err) {
+        if (err) return done(err);
+        var rest = data.length - 20;
+        buf = decoder.buffer(rest);
+        data.copy(buf, 0, 20);
+        decoder.wrote(rest, function (err) {
+          if (err) return done(err);
+          decoder.end();
+        });
+      });
+    });
+
+    it('should get the same packet data with `slabs: true`', function (done) {
+      digest({}, function (err, expected) {
+        if (err) return done(err);
+        digest({ slabs: true }, function (err, got) {
+          if (err) return done(err);
+          assert.deepEqual(expected, got);
+          done();
+        });
+      });
+      function digest (opts, fn) {
+        var decoder = new Decoder(opts);
+        var hashes = {};
+        decoder.on('stream', function (stream) {
+          var hash = hashes[stream.serialno] = crypto.createHash('md5');
+          stream.on('packet', function (packet) {
+            hash.update(packet.packet);
+          });
+        });
+        decoder.on('error', fn);
+        decoder.on('finish', function () {
+          Object.keys(hashes).forEach(function (serialno) {
+            hashes[serialno] = hashes[serialno].digest('hex');
+          });
+          fn(null, hashes);
+        });
+        fs.createReadStream(fixture).pipe(decoder);
+      }
+    });
+
+    it('should get the same "packet" events with `maxPacketSize`', function (done) {
+      var expected = { 1761486570: 3, 252396615: 134 };
+      count({ maxPacketSize: 65536 }, function (got) {
+        assert.deepEqual(expected, got);
+        count({ maxPacketSize: 65536, batch: false }, function (got) {
+          assert.deepEqual(expected, got);
+          done();
+        });
+      });
+      function count (opts, fn) {
+        var decoder = new Decoder(opts);
+        var got = { 1761486570: 0, 252396615: 0 };
+        decoder.on('stream', function (stream) {
+          stream.on('packet', function () {
+            got[stream.serialno]++;
+          });
+        });
+        decoder.on('error', done);
+        decoder.on('finish', function () {
+          fn(got);
+        });
+        fs.createReadStream(fixture).pipe(decoder);
+      }
+    });
+
+    it('should only verify the page checksums asked for', function (done) {
+      var expected = { 1761486570: 3, 252396615: 134 };
+      count({}, function (got, all) {
+        assert.deepEqual(expected, got);
+        assert(all.verified > 0);
+        assert.equal(0, all.skipped);
+        count({ verify: false }, function (got, none) {
+          assert.deepEqual(expected, got);
+          assert.equal(0, none.verified);
+          assert.equal(all.verified, none.skipped);
+          count({ verify: 2, batch: false }, function (got, half) {
+            assert.deepEqual(expected, got);
+            assert.equal(all.verified, half.verified + half.skipped);
+            assert.equal(Math.floor(all.verified / 2), half.verified);
+            done();
+          });
+        });
+      });
+      function count (opts, fn) {
+        var decoder = new Decoder(opts);
+        var got = { 1761486570: 0, 252396615: 0 };
+        decoder.on('stream', function (stream) {
+          stream.on('packet', function () {
+            got[stream.serialno]++;
+          });
+        });
+        decoder.on('error', done);
+        decoder.on('finish', function () {
+          fn(got, decoder.checksums());
+        });
+        fs.createReadStream(fixture).pipe(decoder);
+      }
+    });
+
+    it('should free the libogg state once done', function (done) {
+      var decoder = new Decoder();
+      var input = fs.createReadStream(fixture);
+      var streams = [];
+      decoder.on('stream', function (stream) {
+        streams.push(stream);
+        assert.equal(false, stream.os.destroyed);
+        stream.on('end', function () {
+          assert.equal(true, stream.os.destroyed);
+        });
+        stream.resume();
+      });
+      decoder.on('finish', function () {
+        assert.equal(true, decoder.oy.destroyed);
+        assert.equal(2, streams.length);
+        assert.throws(function () {
+          decoder.buffer(4096);
+        }, /destroyed/);
+        done();
+      });
+      input.pipe(decoder);
+    });
+
+    it('should get the same "packet" events inside a `worker_threads` Worker', function (done) {
+      var worker_threads;
+      try {
+        worker_threads = require('worker_threads');
+      } catch (e) {
+        return this.skip();
+      }
+      var code = [
+        'var fs = require("fs");',
+        'var threads = require("worker_threads");',
+        'var Decoder = require(' + JSON.stringify(path.resolve(__dirname, '..')) + ').Decoder;',
+        'var decoder = new Decoder();',
+        'var got = {};',
+        'decoder.on("stream", function (stream) {',
+        '  got[stream.serialno] = 0;',
+        '  stream.on("packet", function () { got[stream.serialno]++; });',
+        '});',
+        'decoder.on("finish", function () { threads.parentPort.postMessage(got); });',
+        'fs.createReadStream(threads.workerData).pipe(decoder);'
+      ].join('\n');
+      var worker = new worker_threads.Worker(code, { eval: true, workerData: fixture });
+      worker.on('error', done);
+      worker.on('message', function (got) {
+        assert.deepEqual({ 1761486570: 3, 252396615: 134 }, got);
+        done();
+      });
+    });
+
     it('should get 1 "end" event for each "stream"', function (done) {
       var decoder = new Decoder();
       var input = fs.createReadStream(fixture);
@@ -119,4 +645,73 @@ describe('Decoder', function () {
 
   });
 
+  describe('Skeleton', function () {
+
+    function int64 (n) {
+      var buf = new Buffer(8);
+      buf.writeUInt32LE(n % 4294967296, 0);
+      buf.writeUInt32LE(Math.floor(n / 4294967296), 4);
+      return buf;
+    }
+
+    function uint32 (n) {
+      var buf = new Buffer(4);
+      buf.writeUInt32LE(n, 0);
+      return buf;
+    }
+
+    function varint (n) {
+      var bytes = [];
+      do {
+        bytes.push(n & 0x7f);
+        n = Math.floor(n / 128);
+      } while (n > 0);
+      bytes[bytes.length - 1] |= 0x80;
+      return new Buffer(bytes);
+    }
+
+    it('should parse `fishead`, `fisbone` and `index` packets', function () {
+      var head = ogg.Skeleton.parse(Buffer.concat([
+        new Buffer('fishead\0'), new Buffer([ 4, 0, 0, 0 ]),
+        int64(0), int64(1000), int64(0), int64(1000), new Buffer(20),
+        int64(0), int64(4096)
+      ]));
+      assert.equal('fishead', head.type);
+      assert.equal(4, head.versionMajor);
+      assert.equal(1000, head.presentationDen);
+      assert.equal(4096, head.contentOffset);
+
+      var bone = ogg.Skeleton.parse(Buffer.concat([
+        new Buffer('fisbone\0'), uint32(44), uint32(1234), uint32(3),
+        int64(30), int64(1), int64(0), uint32(0), new Buffer([ 6, 0, 0, 0 ])
+      ]));
+      assert.equal('fisbone', bone.type);
+      assert.equal(1234, bone.serialno);
+      assert.equal(30, bone.granulerateNum);
+      assert.equal(6, bone.granuleshift);
+
+      // keyframes at 0s, 1s and 2s, at offsets 4096, 10000 and 20000
+      var index = ogg.Skeleton.parse(Buffer.concat([
+        new Buffer('index\0'), uint32(1234), int64(3), int64(1000), int64(0), int64(3000),
+        varint(4096), varint(0), varint(5904), varint(1000), varint(10000), varint(1000)
+      ]));
+      assert.equal('index', index.type);
+      assert.equal(1234, index.serialno);
+      assert.equal(1000, index.timeDen);
+      assert.equal(null, ogg.Skeleton.find(index.keypoints, -1));
+      assert.deepEqual({ offset: 10000, time: 1000 }, ogg.Skeleton.find(index.keypoints, 1999));
+      assert.deepEqual({ offset: 20000, time: 2000 }, ogg.Skeleton.find(index.keypoints, 5000));
+
+      // frame 45 at 30fps is at 1.5s, past the keyframe at 1s
+      bone.timeDen = index.timeDen;
+      bone.keypoints = index.keypoints;
+      var skeleton = new ogg.Skeleton({ tracks: [ bone ] });
+      assert.deepEqual({ offset: 10000, time: 1000 }, skeleton.keypoint(1234, 30 * 64 + 15));
+      assert.equal(null, skeleton.keypoint(4321, 0));
+
+      assert.equal(null, ogg.Skeleton.parse(new Buffer('theora')));
+    });
+
+  });
+
 });
@@ -1,5 +1,6 @@
 
 var fs = require('fs');
+var os = require('os');
 var ogg = require('../');
 var path = require('path');
 var Encoder = ogg.Encoder;
@@ -76,6 +77,246 @@ describe('Encoder', function () {
       });
     });
 
+    it('should output the same pages for `.packetinMany()` as for `.packetin()`', function (done) {
+      encode(function (s, fn) {
+        var packet = new ogg_packet();
+        packet.packet = new Buffer('foobarbaz');
+        packet.bytes = packet.packet.length;
+        packet.b_o_s = 1;
+        packet.e_o_s = 1;
+        packet.granulepos = 0;
+        packet.packetno = 0;
+        s.packetin(packet, function (err) {
+          if (err) return fn(err);
+          s.pageout(fn);
+        });
+      }, function (err, expected) {
+        if (err) return done(err);
+        encode(function (s, fn) {
+          s.packetinMany([ {
+            packet: [ new Buffer('foo'), new Buffer('bar'), new Buffer('baz') ],
+            e_o_s: 1,
+            granulepos: 0
+          } ], fn);
+        }, function (err, got) {
+          if (err) return done(err);
+          assert.equal(expected.toString('hex'), got.toString('hex'));
+          done();
+        });
+      });
+      function encode (write, fn) {
+        var e = new Encoder();
+        var bufs = [];
+        e.on('data', function (buf) {
+          bufs.push(buf);
+        });
+        e.on('end', function () {
+          fn(null, Buffer.concat(bufs));
+        });
+        write(e.stream(1234), function (err) {
+          if (err) fn(err);
+        });
+      }
+    });
+
+    it('should output the same bytes with `zeroCopy`, slicing the packet Buffers', function (done) {
+      var big = new Buffer(20000);
+      for (var i = 0; i < big.length; i++) big[i] = i * 7 & 0xff;
+      encode({}, function (err, expected) {
+        if (err) return done(err);
+        encode({ zeroCopy: true }, function (err, got, chunks) {
+          if (err) return done(err);
+          assert.equal(expected.toString('hex'), got.toString('hex'));
+          assert(chunks.length > 2);
+          assert(chunks.some(function (chunk) {
+            return chunk.buffer === big.buffer;
+          }));
+          done();
+        });
+      });
+      function encode (opts, fn) {
+        var e = new Encoder(opts);
+        var chunks = [];
+        e.on('data', function (buf) {
+          chunks.push(buf);
+        });
+        e.on('end', function () {
+          fn(null, Buffer.concat(chunks), chunks);
+        });
+        var s = e.stream(1234);
+        var first = new ogg_packet();
+        first.packet = new Buffer('header');
+        first.bytes = first.packet.length;
+        first.b_o_s = 1;
+        first.e_o_s = 0;
+        first.granulepos = 0;
+        first.packetno = 0;
+        s.packetin(first, function (err) {
+          if (err) return fn(err);
+          s.packetinMany([
+            { packet: [ new Buffer('foo'), big.slice(0, 10000) ], e_o_s: 0, granulepos: 1 },
+            { packet: big.slice(10000), e_o_s: 1, granulepos: 2 }
+          ], function (err) {
+            if (err) fn(err);
+          });
+        });
+      }
+    });
+
+    it('should recycle the `ogg_page` struct between "page" events', function (done) {
+      var e = new Encoder();
+      e.resume();
+      e.on('end', function () {
+        assert.equal(2, pages.length);
+        assert.strictEqual(pages[0], pages[1]);
+        assert.equal(true, pages[1].recycled);
+        done();
+      });
+      var s = e.stream();
+      var pages = [];
+      s.on('page', function (stream, page) {
+        pages.push(page);
+      });
+
+      var first = new ogg_packet();
+      first.packet = new Buffer('foo');
+      first.bytes = first.packet.length;
+      first.b_o_s = 1;
+      first.e_o_s = 0;
+      first.granulepos = 0;
+      first.packetno = 0;
+
+      var last = new ogg_packet();
+      last.packet = new Buffer('bar');
+      last.bytes = last.packet.length;
+      last.b_o_s = 0;
+      last.e_o_s = 1;
+      last.granulepos = 1;
+      last.packetno = 1;
+
+      s.packetin(first, function (err) {
+        if (err) return done(err);
+        s.flush(function (err) {
+          if (err) return done(err);
+          s.packetin(last, function (err) {
+            if (err) return done(err);
+            s.flush(function (err) {
+              if (err) return done(err);
+            });
+          });
+        });
+      });
+    });
+
+  });
+
+  describe('with the `skeleton` option', function () {
+
+    it('should index the keyframes of the tracks for `writeSkeleton()`', function (done) {
+      encode([], function (err, skeleton, data, pages) {
+        if (err) return done(err);
+        assert.equal(2, pages.length);
+        assert.equal(0, pages[0].offset);
+        assert.equal(4, skeleton.versionMajor);
+        assert.equal(data.length, skeleton.segmentLength);
+        assert.equal(1, skeleton.tracks.length);
+        var track = skeleton.tracks[0];
+        assert.equal(1234, track.serialno);
+        assert.equal(1, track.headerPackets);
+        assert.equal(6, track.granuleshift);
+        assert.equal(10, track.keypoints.length / 16);
+
+        // frame 25 is 4 frames past the keyframe 21, at 840ms
+        var keypoint = skeleton.keypoint(1234, 21 * 64 + 4);
+        assert.equal(840, keypoint.time);
+        assert.equal('OggS', data.toString('binary', keypoint.offset, keypoint.offset + 4));
+        assert.equal(1234, data.readUInt32LE(keypoint.offset + 14));
+        done();
+      });
+    });
+
+    it('should point `contentOffset` past a header packet spanning pages', function (done) {
+      encode([ new Buffer(100000) ], function (err, skeleton, data) {
+        if (err) return done(err);
+        assert.equal(2, skeleton.tracks[0].headerPackets);
+
+        // the first page with a positive granulepos, past those of -1 the
+        // header packet spans
+        var offset = 0;
+        var spanned = 0;
+        while (data.readInt32LE(offset + 10) < 0 || 0 === data.readUInt32LE(offset + 6)) {
+          if (-1 === data.readInt32LE(offset + 10)) spanned++;
+          var segments = data[offset + 26];
+          var bytes = 27 + segments;
+          for (var i = 0; i < segments; i++) bytes += data[offset + 27 + i];
+          offset += bytes;
+        }
+        assert(spanned > 0);
+        assert.equal(1234, data.readUInt32LE(offset + 14));
+        assert.equal(offset, skeleton.contentOffset);
+        done();
+      });
+    });
+
+    /**
+     * Encodes a BOS packet, the `headers` packets, and 100 frames of 2000
+     * bytes with a keyframe every 10, into a file with a Skeleton. `fn` gets
+     * the Skeleton read back, the contents of the file, and the "skeleton"
+     * pages.
+     */
+
+    function encode (headers, fn) {
+      var file = path.join(os.tmpdir(), 'node-ogg-skeleton-' + process.pid + '.ogv');
+      var e = new Encoder({ skeleton: { serialno: 42 } });
+      var out = fs.createWriteStream(file);
+      var pages = null;
+      e.on('skeleton', function (p) {
+        pages = p;
+      });
+      e.pipe(out);
+      out.on('finish', function () {
+        e.writeSkeleton(file, function (err) {
+          if (err) return fn(err);
+          var fd = fs.openSync(file, 'r');
+          ogg.Skeleton.read(fd, function (err, skeleton) {
+            fs.closeSync(fd);
+            var data = fs.readFileSync(file);
+            fs.unlinkSync(file);
+            fn(err, skeleton, data, pages);
+          });
+        });
+      });
+
+      var s = e.stream(1234, { granulerateNum: 25, granulerateDen: 1, granuleshift: 6 });
+      var header = new ogg_packet();
+      header.packet = new Buffer('header');
+      header.bytes = header.packet.length;
+      header.b_o_s = 1;
+      header.e_o_s = 0;
+      header.granulepos = 0;
+      header.packetno = 0;
+
+      var frames = [];
+      for (var f = 1; f <= 100; f++) {
+        var keyframe = f - (f - 1) % 10;
+        frames.push({ packet: new Buffer(2000), e_o_s: 100 === f ? 1 : 0, granulepos: keyframe * 64 + f - keyframe });
+      }
+      s.packetin(header, function (err) {
+        if (err) return fn(err);
+        s.packetinMany(headers.map(function (data) {
+          return { packet: data, e_o_s: 0, granulepos: 0 };
+        }), function (err) {
+          if (err) return fn(err);
+          s.flush(function (err) {
+            if (err) return fn(err);
+            s.packetinMany(frames, function (err) {
+              if (err) fn(err);
+            });
+          });
+        });
+      });
+    }
+
   });
 
   describe('with three .stream()s', function () {